@@ -2,6 +2,7 @@
 
 #include "compiler.h"
 #include "types.h"
+#include "x86-consts.h"
 
 // Input a single byte from the specified port.
 static inline uint8_t inb(uint16_t port)
@@ -32,8 +33,145 @@ static inline void insl(void *ptr, uint16_t port, int count)
 		     : "memory", "cc");
 }
 
+// Execute CPUID for the specified leaf and subleaf.
+static inline void cpuid(uint32_t leaf, uint32_t subleaf, uint32_t *eax,
+			 uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+	asm volatile("cpuid"
+		     : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+		     : "a"(leaf), "c"(subleaf));
+}
+
+// Read the timestamp counter.
+static inline uint64_t rdtsc(void)
+{
+	uint32_t lo, hi;
+	asm volatile("rdtsc" : "=a"(lo), "=d"(hi));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+// Read the specified model-specific register.
+static inline uint64_t rdmsr(uint32_t msr)
+{
+	uint32_t lo, hi;
+	asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+	return ((uint64_t)hi << 32) | lo;
+}
+
+// Write the specified model-specific register.
+static inline void wrmsr(uint32_t msr, uint64_t val)
+{
+	asm volatile("wrmsr"
+		     :
+		     : "c"(msr), "a"((uint32_t)val), "d"((uint32_t)(val >> 32))
+		     : "memory");
+}
+
+// Read the RFLAGS register.
+static inline uint64_t read_rflags(void)
+{
+	uint64_t val;
+	asm volatile("pushfq; popq %0" : "=r"(val));
+	return val;
+}
+
+// Disable maskable interrupts on this CPU.
+static inline void irq_disable(void)
+{
+	asm volatile("cli" : : : "memory");
+}
+
+// Enable maskable interrupts on this CPU.
+static inline void irq_enable(void)
+{
+	asm volatile("sti" : : : "memory");
+}
+
+// Disable maskable interrupts on this CPU, returning the prior RFLAGS for
+// irq_restore().
+static inline uint64_t irq_save(void)
+{
+	uint64_t flags = read_rflags();
+
+	irq_disable();
+	return flags;
+}
+
+// Re-enable maskable interrupts if they were enabled when irq_save() returned
+// `flags`.
+static inline void irq_restore(uint64_t flags)
+{
+	if (flags & X86_RFLAGS_IF)
+		irq_enable();
+}
+
+// Enable maskable interrupts and halt until the next interrupt. STI delays
+// interrupt recognition until after the following instruction, so an interrupt
+// that is already pending wakes us rather than being handled before the HLT.
+static inline void irq_enable_halt(void)
+{
+	asm volatile("sti; hlt" : : : "memory");
+}
+
+// Read the CR2 register, which contains the faulting address on page fault.
+static inline uint64_t read_cr2(void)
+{
+	uint64_t val;
+	asm volatile("movq %%cr2, %0" : "=r"(val));
+	return val;
+}
+
+// Read the CR3 register.
+static inline uint64_t read_cr3(void)
+{
+	uint64_t val;
+	asm volatile("movq %%cr3, %0" : "=r"(val));
+	return val;
+}
+
+// Write the CR3 register, including any PCID and no-flush bits.
+static inline void write_cr3(uint64_t val)
+{
+	memory_fence();
+	asm volatile("movq %0, %%cr3" : : "r"(val) : "memory");
+}
+
+// Read the CR4 register.
+static inline uint64_t read_cr4(void)
+{
+	uint64_t val;
+	asm volatile("movq %%cr4, %0" : "=r"(val));
+	return val;
+}
+
+// Write the CR4 register.
+static inline void write_cr4(uint64_t val)
+{
+	asm volatile("movq %0, %%cr4" : : "r"(val) : "memory");
+}
+
+// Invalidate TLB entries for the page containing `addr` for the current PCID
+// and any global entry.
+static inline void invlpg(uint64_t addr)
+{
+	asm volatile("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+// Invalidate TLB entries as specified by INVPCID `type`, see X86_INVPCID_xxx.
+// ASSUMES: INVPCID is supported by the CPU.
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t addr)
+{
+	struct {
+		uint64_t pcid;
+		uint64_t addr;
+	} desc = {pcid, addr};
+
+	asm volatile("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+
 // Force a global TLB (Translation Lookahead Buffer) flush by reloading the PGD.
-// Will NOT clear entries marked with the PAGE_GLOBAL flag.
+// Will NOT clear entries marked with the PAGE_GLOBAL flag. If PCIDs are enabled,
+// only entries tagged with the current PCID are cleared.
 static inline void global_flush_tlb(void)
 {
 	memory_fence();
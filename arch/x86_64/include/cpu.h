@@ -0,0 +1,32 @@
+#pragma once
+
+#include "compiler.h"
+#include "cpumask.h"
+#include "percpu.h"
+#include "types.h"
+
+// The maximum number of CPUs we support.
+#define MAX_CPUS (64)
+static_assert(MAX_CPUS <= sizeof(cpumask_t) * 8);
+
+// The CPUs which are online and able to receive IPIs.
+extern cpumask_t cpu_online_mask;
+
+// The index of the CPU owning each per-CPU area.
+DECLARE_PER_CPU(uint32_t, cpu_number);
+
+// Obtain the index of the CPU we are currently executing on.
+static inline uint32_t cpu_id(void)
+{
+	return this_cpu_read(cpu_number);
+}
+
+// Iterate through each online CPU, assigning each to `_cpu`.
+#define for_each_cpu(_cpu) \
+	for_each_cpu_in_mask(_cpu, cpumask_read(&cpu_online_mask))
+
+// Mark the specified CPU online, recording its local APIC ID.
+void cpu_set_online(uint32_t cpu, uint32_t apic_id);
+
+// Obtain the local APIC ID of the specified CPU.
+uint32_t cpu_to_apic_id(uint32_t cpu);
@@ -1,3 +1,53 @@
 #pragma once
 
+// The number of interrupt vectors.
+#define NUM_INTERRUPTS (256)
+// The size in bytes of each interrupt entry stub, see isr.S.
+#define ISR_STUB_SIZE (16)
+
+// Page fault exception vector.
+#define INTERRUPT_VECTOR_PAGE_FAULT (14)
+// The first vector available for external interrupts, vectors below this are
+// reserved for exceptions.
+#define INTERRUPT_VECTOR_FIRST_EXTERNAL (32)
+// Inter-processor interrupt (IPI) vectors. We place these at the top of the
+// vector range so they take priority over device interrupts.
+#define INTERRUPT_VECTOR_TLB_SHOOTDOWN (0xf0)
+// Wakes a CPU halted waiting for a spinlock, see spinlock_qnode_wait(). Needs no
+// handler, the interrupt simply ends the HLT.
+#define INTERRUPT_VECTOR_SPINLOCK_KICK (0xf1)
+
+#ifndef __ASSEMBLER__
+
+#include "types.h"
+
+// Represents the state saved on interrupt, see isr.S.
+struct interrupt_frame {
+	// Pushed by the common handler.
+	uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+	uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+	// Pushed by the entry stub.
+	uint64_t vector;
+	uint64_t error_code; // 0 if the CPU does not push one for the vector.
+	// Pushed by the CPU.
+	uint64_t rip, cs, rflags, rsp, ss;
+};
+
+// Handles an interrupt.
+typedef void (*interrupt_handler_t)(struct interrupt_frame *frame);
+
+// Initialise interrupt descriptors and the local APIC.
 void interrupt_init(void);
+
+// Register handler for the specified interrupt vector. External interrupts are
+// acknowledged after the handler returns.
+void interrupt_register(uint8_t vector, interrupt_handler_t handler);
+
+// Retrieve the ID of the local APIC of the current CPU.
+uint32_t lapic_id(void);
+
+// Send an inter-processor interrupt with the specified vector to the CPU with
+// the specified local APIC ID.
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+
+#endif // __ASSEMBLER__
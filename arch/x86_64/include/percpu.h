@@ -0,0 +1,146 @@
+#pragma once
+
+#include "compiler.h"
+#include "types.h"
+
+// Per-CPU variables are placed in the .percpu section, which acts as a template
+// replicated for each CPU by percpu_init(). Each CPU's GS base is set to the
+// offset between its copy and the template, so a per-CPU variable's link-time
+// (RIP-relative) address used with a %gs: segment override references this
+// CPU's copy in a single instruction.
+//
+// Until percpu_init() is called GS base is 0 and all accesses reference the
+// template, which therefore doubles as the boot CPU's copy. Any per-CPU state
+// written before then is replicated to every CPU.
+
+// Per-CPU variables are renamed so they cannot be accidentally accessed
+// directly.
+#define PER_CPU_VAR(_name) per_cpu__##_name
+
+// Declare a per-CPU variable defined elsewhere.
+#define DECLARE_PER_CPU(_type, _name)                                 \
+	extern __attribute__((section(".percpu"))) __typeof__(_type) \
+		PER_CPU_VAR(_name)
+
+// Define a per-CPU variable. May be prefixed with `static`.
+#define DEFINE_PER_CPU(_type, _name)                           \
+	__attribute__((section(".percpu"))) __typeof__(_type) \
+		PER_CPU_VAR(_name)
+
+// The offset of each CPU's per-CPU area from the template.
+extern uint64_t percpu_offsets[];
+
+// The offset of this CPU's per-CPU area from the template, i.e. its GS base.
+DECLARE_PER_CPU(uint64_t, this_cpu_offset);
+
+#define _percpu_assert_size(_var)                                 \
+	static_assert(sizeof(_var) == 1 || sizeof(_var) == 2 ||   \
+			      sizeof(_var) == 4 || sizeof(_var) == 8, \
+		      "Unsupported per-CPU variable size")
+
+// Perform a single %gs:-relative `_op` (e.g. mov, add) with source operand
+// `_val` and this CPU's copy of `_var` as destination.
+#define _percpu_to_op(_op, _var, _val)                                        \
+	do {                                                                  \
+		_percpu_assert_size(_var);                                    \
+		__typeof__(_var) __val = (_val);                              \
+		switch (sizeof(_var)) {                                       \
+		case 1:                                                       \
+			asm volatile(_op "b %1, %%gs:%0"                      \
+				     : "+m"(_var)                             \
+				     : "qi"((uint8_t)(uint64_t)__val));       \
+			break;                                                \
+		case 2:                                                       \
+			asm volatile(_op "w %1, %%gs:%0"                      \
+				     : "+m"(_var)                             \
+				     : "ri"((uint16_t)(uint64_t)__val));      \
+			break;                                                \
+		case 4:                                                       \
+			asm volatile(_op "l %1, %%gs:%0"                      \
+				     : "+m"(_var)                             \
+				     : "ri"((uint32_t)(uint64_t)__val));      \
+			break;                                                \
+		case 8:                                                       \
+			asm volatile(_op "q %1, %%gs:%0"                      \
+				     : "+m"(_var)                             \
+				     : "re"((uint64_t)__val));                \
+			break;                                                \
+		}                                                             \
+	} while (0)
+
+// Read this CPU's copy of `_var` with a single %gs:-relative mov.
+#define _percpu_from_op(_var)                                                \
+	({                                                                   \
+		_percpu_assert_size(_var);                                   \
+		uint64_t __ret;                                              \
+		switch (sizeof(_var)) {                                      \
+		case 1: {                                                    \
+			uint8_t __ret8;                                      \
+			asm volatile("movb %%gs:%1, %0"                      \
+				     : "=q"(__ret8)                          \
+				     : "m"(_var));                           \
+			__ret = __ret8;                                      \
+			break;                                               \
+		}                                                            \
+		case 2: {                                                    \
+			uint16_t __ret16;                                    \
+			asm volatile("movw %%gs:%1, %0"                      \
+				     : "=r"(__ret16)                         \
+				     : "m"(_var));                           \
+			__ret = __ret16;                                     \
+			break;                                               \
+		}                                                            \
+		case 4: {                                                    \
+			uint32_t __ret32;                                    \
+			asm volatile("movl %%gs:%1, %0"                      \
+				     : "=r"(__ret32)                         \
+				     : "m"(_var));                           \
+			__ret = __ret32;                                     \
+			break;                                               \
+		}                                                            \
+		default:                                                     \
+			asm volatile("movq %%gs:%1, %0"                      \
+				     : "=r"(__ret)                           \
+				     : "m"(_var));                           \
+			break;                                               \
+		}                                                            \
+		(__typeof__(_var))__ret;                                     \
+	})
+
+// Read this CPU's copy of scalar per-CPU variable `_name`.
+#define this_cpu_read(_name) _percpu_from_op(PER_CPU_VAR(_name))
+
+// Write `_val` to this CPU's copy of scalar per-CPU variable `_name`.
+#define this_cpu_write(_name, _val) \
+	_percpu_to_op("mov", PER_CPU_VAR(_name), _val)
+
+// Add `_val` to this CPU's copy of integer per-CPU variable `_name`. This is a
+// single instruction so is atomic with respect to interrupts on this CPU, but
+// not with respect to other CPUs.
+#define this_cpu_add(_name, _val) \
+	_percpu_to_op("add", PER_CPU_VAR(_name), _val)
+
+// Obtain a pointer to the specified CPU's copy of per-CPU variable `_name`.
+#define per_cpu_ptr(_name, _cpu)                                           \
+	((__typeof__(&PER_CPU_VAR(_name)))((uint64_t)&PER_CPU_VAR(_name) + \
+					   percpu_offsets[_cpu]))
+
+// Obtain a pointer to this CPU's copy of per-CPU variable `_name`.
+#define this_cpu_ptr(_name)                                                \
+	((__typeof__(&PER_CPU_VAR(_name)))((uint64_t)&PER_CPU_VAR(_name) + \
+					   this_cpu_read(this_cpu_offset)))
+
+// Access the specified CPU's copy of per-CPU variable `_name`.
+#define per_cpu(_name, _cpu) (*per_cpu_ptr(_name, _cpu))
+
+// Reset GS base so per-CPU accesses reference the template until percpu_init()
+// is called. The bootloader does not guarantee its value.
+void percpu_early_init(void);
+
+// Allocate and populate per-CPU areas for every possible CPU from the template
+// and switch the boot CPU over to its area.
+void percpu_init(void);
+
+// Point the GS base of the CPU we are executing on at the per-CPU area of CPU
+// `cpu`. Must be called by each CPU as it is brought up.
+void percpu_init_cpu(uint32_t cpu);
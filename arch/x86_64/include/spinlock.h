@@ -3,12 +3,125 @@
 #include "asm.h"
 #include "atomic.h"
 #include "compiler.h"
+#include "config.h"
+#include "macros.h"
 #include "types.h"
 
-// Implementation heavily inspired by https://rigtorp.se/spinlock/
+// Queued spinlock implementation heavily inspired by linux's qspinlock, see
+// https://lwn.net/Articles/590243/ and the MCS paper - J. M. Mellor-Crummey and
+// M. L. Scott, "Algorithms for Scalable Synchronization on Shared-Memory
+// Multiprocessors".
+//
+// The uncontended path is a single compare-and-swap to acquire and a byte store
+// to release. Under contention waiters queue up FIFO, each spinning on its own
+// per-CPU queue node rather than all hammering the lock's cache line, and the
+// lock is handed from each waiter to the next.
+//
+// Waiters back off exponentially between checks, up to a cap, to ease pressure
+// on an SMT sibling and on the cache line being watched. Once a waiter has spun
+// for long enough it calls spinlock_qnode_wait() or spinlock_yield() to give up
+// the CPU, which matters when the CPU is a virtual one whose host may be better
+// off running the lock holder.
 
-// Represents a spinlock object.
-TYPE_WRAP(spinlock_t, atomic_t);
+struct spinlock_qnode;
+
+#ifdef __ZEPTUX_KERNEL
+#include "cpu.h"
+
+#define SPINLOCK_MAX_CPUS (MAX_CPUS)
+
+// Obtain the index of the CPU whose queue nodes we use.
+static inline uint32_t spinlock_cpu_id(void)
+{
+	return cpu_id();
+}
+
+// Called by a waiter which has spun for long enough but which nobody will kick,
+// see spinlock_qnode_wait(). We have nothing to yield to so keep spinning.
+static inline void spinlock_yield(void)
+{
+	hint_spinwait();
+}
+#else
+// Userland tests treat each thread as a CPU and must provide spinlock_cpu_id(),
+// spinlock_yield(), spinlock_qnode_wait(), spinlock_qnode_kick() and
+// spinlock_qnodes, see test_spinlock_user.cpp.
+#define SPINLOCK_MAX_CPUS (256)
+uint32_t spinlock_cpu_id(void);
+void spinlock_yield(void);
+#endif
+
+// Called by a waiter which has spun for SPINLOCK_SPINS_BEFORE_WAIT checks at
+// maximum backoff while waiting for our predecessor to set `node->head`. May
+// sleep until kicked via spinlock_qnode_kick() and may return before `head` is
+// set.
+void spinlock_qnode_wait(struct spinlock_qnode *node);
+
+// Wake the CPU which halted waiting on `node` in spinlock_qnode_wait().
+void spinlock_qnode_kick(struct spinlock_qnode *node);
+
+// We may take a spinlock in an interrupt handler while queued for another, so
+// each CPU has a queue node for each context that might nest.
+#define SPINLOCK_QNODES_PER_CPU (4)
+
+// Represents a spinlock object. The tail references the queue node of the last
+// CPU waiting on the lock, or is 0 if none are.
+typedef union {
+	atomic_t val;
+	struct {
+		uint8_t locked;
+		uint8_t reserved;
+		uint16_t tail;
+	};
+} spinlock_t;
+static_assert(sizeof(spinlock_t) == sizeof(uint32_t));
+
+#define SPINLOCK_LOCKED (1)
+#define SPINLOCK_LOCKED_MASK (0xff)
+#define SPINLOCK_TAIL_SHIFT (16)
+// The tail encodes the queue node index in its low bits and CPU index + 1 in
+// the remainder.
+#define SPINLOCK_TAIL_INDEX_BITS (2)
+static_assert(BIT_MASK(SPINLOCK_TAIL_INDEX_BITS) == SPINLOCK_QNODES_PER_CPU);
+static_assert(SPINLOCK_MAX_CPUS < BIT_MASK(16 - SPINLOCK_TAIL_INDEX_BITS));
+
+// The maximum number of PAUSE instructions a waiter executes between checks.
+#define SPINLOCK_BACKOFF_MAX (64)
+// The number of checks at maximum backoff before calling spinlock_qnode_wait().
+#define SPINLOCK_SPINS_BEFORE_WAIT (64)
+
+// Queue node states, see spinlock_qnode_wait().
+#define SPINLOCK_QNODE_RUNNING (0)
+#define SPINLOCK_QNODE_HALTED (1)
+
+// Represents an MCS queue node a CPU spins on while waiting for a lock.
+struct spinlock_qnode {
+	struct spinlock_qnode *next;
+	// Set by our predecessor once we are at the head of the queue.
+	atomic_t head;
+	// Set to SPINLOCK_QNODE_HALTED while we sleep waiting for `head`.
+	uint16_t state;
+	// The CPU the node belongs to, so our predecessor can kick us.
+	uint16_t cpu;
+};
+static_assert(SPINLOCK_MAX_CPUS <= 0x10000);
+
+// Represents a waiter's backoff state.
+struct spinlock_backoff {
+	// The number of PAUSE instructions to execute on the next backoff.
+	uint32_t pauses;
+	// The number of backoffs performed at SPINLOCK_BACKOFF_MAX.
+	uint32_t spins;
+};
+
+// Represents the queue nodes belonging to a CPU, occupying a cache line.
+struct spinlock_cpu_qnodes {
+	struct spinlock_qnode nodes[SPINLOCK_QNODES_PER_CPU];
+	// The number of nodes currently in use.
+	uint32_t count;
+} __attribute__((aligned(64)));
+
+extern struct spinlock_cpu_qnodes spinlock_qnodes[SPINLOCK_MAX_CPUS];
 
 // Simple mechanism for assigning an empty unlocked spinlock.
 static inline spinlock_t empty_spinlock(void)
@@ -16,26 +129,169 @@ static inline spinlock_t empty_spinlock(void)
 	return (spinlock_t){0};
 }
 
-// Acquire a spinlock.
-static inline void spinlock_acquire(spinlock_t *lock)
+// Determine whether the spinlock is held. Only useful for assertions.
+static inline bool spinlock_is_locked(spinlock_t *lock)
+{
+	return (atomic_load_relaxed(&lock->val) & SPINLOCK_LOCKED_MASK) != 0;
+}
+
+// Attempt to acquire a spinlock without waiting, returning true if acquired.
+static inline bool spinlock_try_acquire(spinlock_t *lock)
 {
-	while (true) {
-		// Attempt to acquire the lock right away. If the lock is
-		// available from the start we acquire it right away.
-		if (!atomic_exchange_acquire(&lock->x, 1))
-			return;
-
-		// Loop on _reads_ of the atomic value. Cache lines can be
-		// shared between cores on read, a write requires an update via
-		// the cache coherent mechanism.
-		while (atomic_load_relaxed(&lock->x)) {
-			hint_spinwait();
+	uint32_t expected = 0;
+	return atomic_try_cmpxchg_acquire(&lock->val, &expected,
+					  SPINLOCK_LOCKED);
+}
+
+// Part of the queued spinlock implementation - obtain the queue node encoded in
+// `tail`.
+static inline struct spinlock_qnode *_spinlock_tail_to_qnode(uint32_t tail)
+{
+	uint32_t cpu = (tail >> SPINLOCK_TAIL_INDEX_BITS) - 1;
+	uint32_t index = tail & BIT_MASK_BELOW(SPINLOCK_TAIL_INDEX_BITS);
+
+	return &spinlock_qnodes[cpu].nodes[index];
+}
+
+// Part of the queued spinlock implementation - back off before checking the
+// awaited condition again. Returns false once we have spun for long enough
+// that the caller should call spinlock_qnode_wait() or spinlock_yield()
+// instead.
+static inline bool _spinlock_backoff(struct spinlock_backoff *backoff)
+{
+	if (backoff->spins >= SPINLOCK_SPINS_BEFORE_WAIT)
+		return false;
+
+	for (uint32_t i = 0; i < backoff->pauses; i++) {
+		hint_spinwait();
+	}
+
+	if (backoff->pauses < SPINLOCK_BACKOFF_MAX)
+		backoff->pauses *= 2;
+	else
+		backoff->spins++;
+
+	return true;
+}
+
+// Part of the queued spinlock implementation - queue up for the lock using
+// queue node `index` of `cpu` and wait until it is handed to us.
+static inline void _spinlock_acquire_queued(spinlock_t *lock, uint32_t cpu,
+					    uint32_t index)
+{
+	struct spinlock_qnode *node = &spinlock_qnodes[cpu].nodes[index];
+	*node = (struct spinlock_qnode){.cpu = (uint16_t)cpu};
+	struct spinlock_backoff backoff = {.pauses = 1};
+	uint32_t tail = ((cpu + 1) << SPINLOCK_TAIL_INDEX_BITS) | index;
+
+	// Make ourselves the tail of the queue, publishing our node.
+	uint32_t val = atomic_load_relaxed(&lock->val);
+	uint32_t new_val;
+	do {
+		new_val = (val & SPINLOCK_LOCKED_MASK) |
+			  (tail << SPINLOCK_TAIL_SHIFT);
+	} while (!atomic_try_cmpxchg_release(&lock->val, &val, new_val));
+
+	// If there is a predecessor, link ourselves to it and wait for it to
+	// hand us the head of the queue.
+	uint32_t prev_tail = val >> SPINLOCK_TAIL_SHIFT;
+	if (prev_tail != 0) {
+		struct spinlock_qnode *prev = _spinlock_tail_to_qnode(prev_tail);
+
+		_atomic_store_release(&prev->next, node);
+		while (!atomic_load_acquire(&node->head)) {
+			if (!_spinlock_backoff(&backoff))
+				spinlock_qnode_wait(node);
 		}
+		backoff = (struct spinlock_backoff){.pauses = 1};
+	}
+
+	// We are at the head of the queue so only we wait on the lock word. The
+	// holder does not know we are here so we cannot sleep.
+	while ((val = atomic_load_acquire(&lock->val)) & SPINLOCK_LOCKED_MASK) {
+		if (!_spinlock_backoff(&backoff))
+			spinlock_yield();
+	}
+
+	// If we are the only waiter, take the lock and clear the tail at once.
+	if (val >> SPINLOCK_TAIL_SHIFT == tail &&
+	    atomic_try_cmpxchg_acquire(&lock->val, &val, SPINLOCK_LOCKED))
+		return;
+
+	// Otherwise there are waiters behind us. Nobody else can take the lock
+	// while the tail is set so we may simply mark it held.
+	atomic_fetch_or_seq_cst(&lock->val, SPINLOCK_LOCKED);
+
+	// Wait for our successor to link itself then hand it the queue head.
+	struct spinlock_qnode *next;
+	backoff = (struct spinlock_backoff){.pauses = 1};
+	while (!(next = _atomic_load_acquire(&node->next))) {
+		if (!_spinlock_backoff(&backoff))
+			spinlock_yield();
 	}
+	atomic_store_release(&next->head, 1);
+
+	// Pairs with the fence in spinlock_qnode_wait() so that either it sees
+	// `head` set or we see it halted.
+	smp_mb();
+	if (_atomic_load_relaxed(&next->state) == SPINLOCK_QNODE_HALTED)
+		spinlock_qnode_kick(next);
+}
+
+// Part of the queued spinlock implementation - the contended path.
+static inline COLD void _spinlock_acquire_slow(spinlock_t *lock)
+{
+	uint32_t cpu = spinlock_cpu_id();
+	struct spinlock_cpu_qnodes *qnodes = &spinlock_qnodes[cpu];
+	uint32_t index = qnodes->count++;
+
+	if (index < SPINLOCK_QNODES_PER_CPU) {
+		_spinlock_acquire_queued(lock, cpu, index);
+	} else {
+		// We have run out of queue nodes due to excessive nesting, so
+		// fall back to simply spinning.
+		struct spinlock_backoff backoff = {.pauses = 1};
+		while (!spinlock_try_acquire(lock)) {
+			if (!_spinlock_backoff(&backoff))
+				spinlock_yield();
+		}
+	}
+
+	qnodes->count--;
+}
+
+// Acquire a spinlock.
+static inline void spinlock_acquire(spinlock_t *lock)
+{
+	if (likely(spinlock_try_acquire(lock)))
+		return;
+
+	_spinlock_acquire_slow(lock);
 }
 
 // Release a spinlock. Noop if already cleared.
 static inline void spinlock_release(spinlock_t *lock)
 {
-	atomic_store_release(&lock->x, 0);
+	// Only the locked byte is cleared, leaving the queue intact.
+	_atomic_store_release(&lock->locked, 0);
 }
+
+#if defined(__ZEPTUX_KERNEL) && defined(CONFIG_LOCKSTAT)
+#include "lockstat.h"
+
+// Instrument acquisitions and releases to gather lock contention statistics,
+// giving each call site its own lock class, see lockstat.h. A macro does not
+// expand itself, so spinlock_release() below calls the function above.
+#define spinlock_acquire(_lock)                                              \
+	do {                                                                 \
+		static struct lockstat_class __lockstat_class =              \
+			LOCKSTAT_CLASS_INIT(#_lock);                         \
+		lockstat_acquire(_lock, &__lockstat_class);                  \
+	} while (0)
+#define spinlock_release(_lock)                    \
+	do {                                       \
+		spinlock_t *__lockstat_lock = (_lock); \
+		lockstat_release(__lockstat_lock);     \
+		spinlock_release(__lockstat_lock);     \
+	} while (0)
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "address_space.h"
+#include "cpumask.h"
+#include "page.h"
+#include "types.h"
+
+// The number of address spaces each CPU caches TLB entries for, each tagged with
+// its own PCID. PCID 0 is only used by the CR3 loaded prior to tlb_init() so
+// slot n is assigned PCID n + 1.
+#define TLB_NUM_ASIDS (6)
+// If a range exceeds this number of pages we invalidate all entries for the
+// address space rather than invalidating page-by-page.
+#define TLB_FLUSH_ALL_THRESHOLD (33)
+// The maximum number of discontiguous ranges a batch can hold before we give up
+// and invalidate the whole address space.
+#define TLB_BATCH_MAX_RANGES (8)
+// The maximum number of shootdown requests which can be queued for a CPU.
+#define TLB_MAILBOX_SIZE (16)
+
+// Represents a range of virtual addresses [start, end).
+struct tlb_range {
+	uint64_t start, end;
+};
+
+// Represents a set of invalidations to an address space which are performed
+// together, on each CPU which might have the address space's entries cached.
+struct tlb_batch {
+	struct address_space *as;
+	uint32_t num_ranges;
+	uint64_t num_pages;
+	bool flush_all;
+	struct tlb_range ranges[TLB_BATCH_MAX_RANGES];
+
+	// Assigned by tlb_shootdown_start().
+	uint64_t gen;	   // The address space TLB generation this flushes to.
+	cpumask_t pending; // CPUs which have yet to perform the invalidation.
+};
+
+// Initialise TLB management for the current CPU, enabling PCIDs if the CPU
+// supports them and switching to kernel_address_space.
+void tlb_init(void);
+
+// Determine whether address spaces are tagged with PCIDs.
+bool tlb_pcid_enabled(void);
+
+// Obtain the address space currently loaded on this CPU.
+struct address_space *tlb_current(void);
+
+// Switch the current CPU to the specified address space, reusing TLB entries
+// from when it was last loaded on this CPU if they are still valid.
+void tlb_switch(struct address_space *as);
+
+// Invalidate TLB entries for `num_pages` pages starting at `va` in the
+// specified address space. Only the current CPU is affected.
+void tlb_flush_range(struct address_space *as, virtaddr_t va,
+		     uint64_t num_pages);
+
+// Invalidate all TLB entries for the specified address space. Only the current
+// CPU is affected.
+void tlb_flush_all(struct address_space *as);
+
+// Initialise an empty batch of invalidations for the specified address space.
+void tlb_batch_init(struct tlb_batch *batch, struct address_space *as);
+
+// Add `num_pages` pages starting at `va` to the batch, coalescing with any
+// overlapping or adjacent ranges already present.
+void tlb_batch_add(struct tlb_batch *batch, virtaddr_t va, uint64_t num_pages);
+
+// Start invalidating the batch on all CPUs which may have the address space's
+// entries loaded, sending each remote CPU a single IPI and invalidating locally
+// while they respond. The caller may perform other work before waiting with
+// tlb_shootdown_wait(), but must not modify the batch until it completes.
+void tlb_shootdown_start(struct tlb_batch *batch);
+
+// Determine whether all CPUs have completed the shootdown.
+static inline bool tlb_shootdown_done(struct tlb_batch *batch)
+{
+	return cpumask_empty(&batch->pending);
+}
+
+// Wait for all CPUs to complete the shootdown, servicing any shootdowns
+// directed at this CPU in the meantime.
+void tlb_shootdown_wait(struct tlb_batch *batch);
+
+// Invalidate the batch on all CPUs and wait for completion.
+static inline void tlb_shootdown(struct tlb_batch *batch)
+{
+	tlb_shootdown_start(batch);
+	tlb_shootdown_wait(batch);
+}
+
+// Service any shootdown requests queued for the current CPU.
+void tlb_shootdown_process(void);
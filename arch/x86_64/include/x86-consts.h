@@ -2,6 +2,10 @@
 
 // CPUID flags:
 #define X86_LONGMODE_FLAG (1UL << 29)
+// CPUID leaf 1, ECX - Process-context identifiers supported.
+#define X86_CPUID_1_ECX_PCID (1UL << 17)
+// CPUID leaf 7, EBX - INVPCID instruction supported.
+#define X86_CPUID_7_EBX_INVPCID (1UL << 10)
 
 // Global Descriptor Table (GDT) entry flags:
 #define X86_GDTE_FLAG_4K_GRANULARITY (1UL << 3)
@@ -36,6 +40,29 @@
 #define X86_CR4_PGE (1UL << 7)
 // We want to set both.
 #define X86_CR4_INIT_FLAGS (X86_CR4_PAE | X86_CR4_PGE)
+// Enables process-context identifiers, tagging TLB entries with the lower 12
+// bits of CR3.
+#define X86_CR4_PCIDE (1UL << 17)
+
+// RFLAGS flags - see Intel Volume 1, figure 3-8.
+// Set if maskable interrupts are enabled.
+#define X86_RFLAGS_IF (1UL << 9)
+
+// With CR4.PCIDE set, the lower 12 bits of CR3 specify the PCID.
+#define X86_CR3_PCID_MASK (0xfffUL)
+// With CR4.PCIDE set, writing CR3 with this bit set does not invalidate TLB
+// entries tagged with the new PCID.
+#define X86_CR3_NOFLUSH (1UL << 63)
+
+// INVPCID invalidation types - see Intel Volume 2A, INVPCID.
+#define X86_INVPCID_ADDR (0)          // Single address, single PCID.
+#define X86_INVPCID_PCID (1)          // All non-global, single PCID.
+#define X86_INVPCID_ALL_GLOBAL (2)    // All including global, all PCIDs.
+#define X86_INVPCID_ALL_NONGLOBAL (3) // All non-global, all PCIDs.
+
+// Page fault error code flags - see Intel Volume 3A, 4.7.
+#define X86_PF_ERROR_PRESENT (1UL << 0) // Protection violation, not non-present.
+#define X86_PF_ERROR_WRITE (1UL << 1)   // Write access, not read.
 
 #define X86_MFR_EFER (0xc0000080UL)
 
@@ -49,6 +76,8 @@
 #define X86_IA32_APIC_BASE_MSR (0x1b)
 #define X86_IA32_APIC_BASE_MSR_ENABLE (0x800)
 
+#define X86_IA32_GS_BASE_MSR (0xc0000101)
+
 #define X86_PIC1_DATA_PORT (0x21)
 #define X86_PIC2_DATA_PORT (0xa1)
 
@@ -63,6 +92,7 @@
 #define X86_PAGE_FLAG_DIRTY_BIT (6)
 #define X86_PAGE_FLAG_PSE_BIT (7)
 #define X86_PAGE_FLAG_GLOBAL_BIT (8)
+#define X86_PAGE_FLAG_AVAIL_BIT (9) // Ignored by hardware, free for software use.
 #define X86_PAGE_FLAG_NX_BIT (63)
 
 #define X86_PAGE_FLAG_PRESENT (1UL << X86_PAGE_FLAG_PRESENT_BIT)
@@ -74,6 +104,7 @@
 #define X86_PAGE_FLAG_DIRTY (1UL << X86_PAGE_FLAG_DIRTY_BIT)
 #define X86_PAGE_FLAG_PSE (1UL << X86_PAGE_FLAG_PSE_BIT)
 #define X86_PAGE_FLAG_GLOBAL (1UL << X86_PAGE_FLAG_GLOBAL_BIT)
+#define X86_PAGE_FLAG_AVAIL (1UL << X86_PAGE_FLAG_AVAIL_BIT)
 #define X86_PAGE_FLAG_NX (1UL << X86_PAGE_FLAG_NX_BIT)
 
 #define X86_PAGE_FLAG_DEFAULT (X86_PAGE_FLAG_PRESENT | X86_PAGE_FLAG_RW)
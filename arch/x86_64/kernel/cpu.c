@@ -0,0 +1,17 @@
+#include "zeptux.h"
+
+cpumask_t cpu_online_mask;
+
+// Maps CPU index to local APIC ID. Written once as each CPU comes online.
+static uint32_t apic_ids[MAX_CPUS];
+
+void cpu_set_online(uint32_t cpu, uint32_t apic_id)
+{
+	apic_ids[cpu] = apic_id;
+	cpumask_set(&cpu_online_mask, cpu);
+}
+
+uint32_t cpu_to_apic_id(uint32_t cpu)
+{
+	return apic_ids[cpu];
+}
@@ -1,3 +1,4 @@
+#include "bootsector.h"
 #include "zeptux.h"
 
 #define APIC_IRQ_0 (32) // Offset to avoid conflict with errors.
@@ -5,11 +6,14 @@
 #define APIC_IRQ_ERROR (0x13)
 #define APIC_IRQ_SPURIOUS (0xdf) // Lower bits must be set.
 
+#define APIC_ID_OFFSET (0x20)	     // Local APIC ID.
 #define APIC_VER_OFFSET (0x30)	     // APIC version information.
 #define APIC_TPR_OFFSET (0x80)	     // Task Priority Register.
 #define APIC_EOI_OFFSET (0x0b0)	     // End Of Interrupt register.
 #define APIC_SPURIOUS_OFFSET (0x0f0) // For specifying spurious interrupt vector.
 #define APIC_ESR_OFFSET (0x280)	     // Error Status Register
+#define APIC_ICR_LOW_OFFSET (0x300)  // Interrupt Command Register [0, 31].
+#define APIC_ICR_HIGH_OFFSET (0x310) // Interrupt Command Register [32, 63].
 #define APIC_TIMER_OFFSET (0x320)    // Local timer register.
 #define APIC_PCINT_OFFSET (0x340)    // Performance counter register.
 #define APIC_LINT0_OFFSET (0x350)    // Local interrupt pin 0 register.
@@ -22,9 +26,14 @@
 #define APIC_MASK_FLAG (0x10000)     // Set bit to mask an interrupt.
 #define APIC_PERIODIC_FLAG (0x20000) // Set bit to indicate value periodic.
 
+#define APIC_ICR_DELIVERY_PENDING_FLAG (0x1000) // Set while IPI being sent.
+#define APIC_ICR_LEVEL_ASSERT_FLAG (0x4000)     // Must be set for fixed IPIs.
+#define APIC_ICR_DEST_SHIFT (24)	       // Destination in high register.
+
 #define APIC_INIT_TIMER_COUNT_VALUE (1000000000)
 
-#define NUM_INTERRUPTS (256)
+// IDT gate type/attributes for a present, ring 0, 64-bit interrupt gate.
+#define IDT_INTERRUPT_GATE (0x8e)
 
 // See https://wiki.osdev.org/Interrupt_Descriptor_Table#Structure_AMD64 and
 // intel manual 3a, section 6.14.1.
@@ -38,7 +47,36 @@ struct idt_descriptor {
 	uint32_t reserved;	// Should be zeroed.
 };
 
-struct idt_descriptor idts[NUM_INTERRUPTS];
+// Describes the location and size of a GDT or IDT as loaded by lgdt/lidt.
+struct table_register {
+	uint16_t limit; // Size in bytes - 1.
+	uint64_t base;
+} PACKED;
+
+static struct idt_descriptor idts[NUM_INTERRUPTS];
+static interrupt_handler_t handlers[NUM_INTERRUPTS];
+
+// The GDT used by the bootloader is no longer mapped once we have moved to the
+// kernel page tables, so we provide our own, identical, GDT. The CPU sets the
+// accessed flag on segment load so this cannot be placed in readonly memory.
+static uint64_t gdt[] = {
+	[0] = 0,
+	[GDT_SEGMENT_CODE32_INDEX] = MAKE_GDTE(
+		X86_GDTE_FLAG_4K_GRANULARITY | X86_GDTE_FLAG_32BIT_PROTECTED,
+		X86_GDTE_ACCESS_PRESENT | X86_GDTE_ACCESS_NONSYS |
+			X86_GDTE_ACCESS_EXEC | X86_GDTE_ACCESS_RW),
+	[GDT_SEGMENT_CODE64_INDEX] = MAKE_GDTE(
+		X86_GDTE_FLAG_4K_GRANULARITY | X86_GDTE_FLAG_64BIT_CODE,
+		X86_GDTE_ACCESS_PRESENT | X86_GDTE_ACCESS_NONSYS |
+			X86_GDTE_ACCESS_EXEC | X86_GDTE_ACCESS_RW),
+	[GDT_SEGMENT_DATA_INDEX] = MAKE_GDTE(
+		X86_GDTE_FLAG_4K_GRANULARITY | X86_GDTE_FLAG_32BIT_PROTECTED,
+		X86_GDTE_ACCESS_PRESENT | X86_GDTE_ACCESS_NONSYS |
+			X86_GDTE_ACCESS_RW),
+};
+
+// Interrupt entry stubs, each ISR_STUB_SIZE bytes in size. See isr.S.
+extern uint8_t isr_stubs[];
 
 // The maximum number of entries in the Local Vector Table, see intel manual 3a,
 // section 10.5.1.
@@ -77,6 +115,48 @@ static void lapic_clear_interrupt(void)
 	lapic_write_reg(APIC_EOI_OFFSET, 0);
 }
 
+// Load the kernel GDT. The segment selectors are identical to those used by the
+// bootloader so we need not reload segment registers.
+static void gdt_init(void)
+{
+	struct table_register reg = {
+		.limit = sizeof(gdt) - 1,
+		.base = (uint64_t)gdt,
+	};
+
+	asm volatile("lgdt %0" : : "m"(reg) : "memory");
+}
+
+// Assign an IDT gate for the specified vector to its entry stub.
+static void idt_set_gate(uint8_t vector)
+{
+	struct idt_descriptor *desc = &idts[vector];
+	uint64_t addr = (uint64_t)&isr_stubs[vector * ISR_STUB_SIZE];
+
+	desc->addr_lower16 = addr & 0xffff;
+	desc->code_selector = GDT_SEGMENT_CODE64;
+	desc->ist = 0;
+	desc->types_attr = IDT_INTERRUPT_GATE;
+	desc->addr_mid16 = (addr >> 16) & 0xffff;
+	desc->addr_upper32 = addr >> 32;
+	desc->reserved = 0;
+}
+
+// Populate and load the IDT.
+static void idt_init(void)
+{
+	for (int i = 0; i < NUM_INTERRUPTS; i++) {
+		idt_set_gate(i);
+	}
+
+	struct table_register reg = {
+		.limit = sizeof(idts) - 1,
+		.base = (uint64_t)idts,
+	};
+
+	asm volatile("lidt %0" : : "m"(reg) : "memory");
+}
+
 // Initialise the local APIC.
 static void lapic_init(void)
 {
@@ -123,7 +203,88 @@ static void lapic_init(void)
 	lapic_write_reg(APIC_TPR_OFFSET, 0);
 }
 
+// Handle a page fault by faulting in the page if it lies within a lazily backed
+// region of the relevant address space, panicking otherwise.
+static void page_fault_interrupt(struct interrupt_frame *frame)
+{
+	virtaddr_t va = {read_cr2()};
+	fault_flags_t flags = 0;
+
+	if (IS_MASK_SET(frame->error_code, X86_PF_ERROR_PRESENT))
+		flags |= FAULT_PROTECTION;
+	if (IS_MASK_SET(frame->error_code, X86_PF_ERROR_WRITE))
+		flags |= FAULT_WRITE;
+
+	// The kernel half of every address space is that of the kernel address
+	// space, though PGD entries added to it since the current address space
+	// was created are only copied on first access.
+	struct address_space *as = tlb_current();
+	if (va.x >= KERNEL_BASE) {
+		if (as != NULL && address_space_sync_kernel(as, va))
+			return;
+		as = &kernel_address_space;
+	}
+	if (as != NULL && address_space_fault(as, va, flags))
+		return;
+
+	panic("Unhandled page fault at 0x%lx (error code 0x%lx) at 0x%lx",
+	      va.x, frame->error_code, frame->rip);
+}
+
+// Called by the common interrupt entry code, see isr.S.
+void interrupt_dispatch(struct interrupt_frame *frame)
+{
+	uint64_t vector = frame->vector;
+	interrupt_handler_t handler = handlers[vector];
+
+	if (handler != NULL)
+		handler(frame);
+	else if (vector < INTERRUPT_VECTOR_FIRST_EXTERNAL)
+		panic("Unhandled exception %lu (error code 0x%lx) at 0x%lx",
+		      vector, frame->error_code, frame->rip);
+
+	// Spurious interrupts must not be acknowledged.
+	if (vector >= INTERRUPT_VECTOR_FIRST_EXTERNAL &&
+	    vector != APIC_IRQ_0 + APIC_IRQ_SPURIOUS)
+		lapic_clear_interrupt();
+}
+
 void interrupt_init(void)
 {
+	gdt_init();
+	idt_init();
 	lapic_init();
+
+	interrupt_register(INTERRUPT_VECTOR_PAGE_FAULT, page_fault_interrupt);
+
+	cpu_set_online(cpu_id(), lapic_id());
+}
+
+void interrupt_register(uint8_t vector, interrupt_handler_t handler)
+{
+	handlers[vector] = handler;
+}
+
+uint32_t lapic_id(void)
+{
+	return lapic_read_reg(APIC_ID_OFFSET) >> 24;
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector)
+{
+	// An interrupt handler sending its own IPI between the two ICR writes
+	// would retarget ours.
+	uint64_t flags = irq_save();
+
+	lapic_write_reg(APIC_ICR_HIGH_OFFSET, apic_id << APIC_ICR_DEST_SHIFT);
+	// Writing the low register sends the IPI.
+	lapic_write_reg(APIC_ICR_LOW_OFFSET,
+			APIC_ICR_LEVEL_ASSERT_FLAG | vector);
+
+	while (lapic_read_reg(APIC_ICR_LOW_OFFSET) &
+	       APIC_ICR_DELIVERY_PENDING_FLAG) {
+		hint_spinwait();
+	}
+
+	irq_restore(flags);
 }
@@ -0,0 +1,41 @@
+#include "zeptux.h"
+
+// Linker-provided bounds of the per-CPU template, see kernel/kernel.ld.
+extern uint8_t __percpu_start[], __percpu_end[];
+
+uint64_t percpu_offsets[MAX_CPUS];
+
+DEFINE_PER_CPU(uint64_t, this_cpu_offset);
+DEFINE_PER_CPU(uint32_t, cpu_number);
+
+void percpu_early_init(void)
+{
+	wrmsr(X86_IA32_GS_BASE_MSR, 0);
+}
+
+void percpu_init(void)
+{
+	uint64_t size = __percpu_end - __percpu_start;
+	// Keep each area page-aligned, which preserves the alignment of
+	// variables within the template and ensures no two CPUs share a cache
+	// line.
+	uint64_t area_size = ALIGN_UP(size, PAGE_SIZE);
+	uint8_t *areas = kmalloc(MAX_CPUS * area_size, KMALLOC_KERNEL);
+
+	for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+		uint8_t *area = &areas[cpu * area_size];
+		uint64_t offset = (uint64_t)area - (uint64_t)__percpu_start;
+
+		memcpy(area, __percpu_start, size);
+		percpu_offsets[cpu] = offset;
+		per_cpu(this_cpu_offset, cpu) = offset;
+		per_cpu(cpu_number, cpu) = cpu;
+	}
+
+	percpu_init_cpu(cpu_id());
+}
+
+void percpu_init_cpu(uint32_t cpu)
+{
+	wrmsr(X86_IA32_GS_BASE_MSR, percpu_offsets[cpu]);
+}
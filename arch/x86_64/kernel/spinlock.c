@@ -0,0 +1,32 @@
+#include "zeptux.h"
+
+struct spinlock_cpu_qnodes spinlock_qnodes[SPINLOCK_MAX_CPUS];
+
+void spinlock_qnode_wait(struct spinlock_qnode *node)
+{
+	// Nothing could wake us from HLT with interrupts disabled, so we can
+	// only spin.
+	if (!IS_MASK_SET(read_rflags(), X86_RFLAGS_IF)) {
+		hint_spinwait();
+		return;
+	}
+
+	// With interrupts disabled a kick sent after we check `head` stays
+	// pending until we halt, and then wakes us.
+	irq_disable();
+	_atomic_store_relaxed(&node->state, SPINLOCK_QNODE_HALTED);
+	// Pairs with the fence in _spinlock_acquire_queued() so that either we
+	// see `head` set or our predecessor sees us halted.
+	smp_mb();
+	if (!atomic_load_relaxed(&node->head))
+		irq_enable_halt();
+	else
+		irq_enable();
+	_atomic_store_relaxed(&node->state, SPINLOCK_QNODE_RUNNING);
+}
+
+void spinlock_qnode_kick(struct spinlock_qnode *node)
+{
+	lapic_send_ipi(cpu_to_apic_id(node->cpu),
+		       INTERRUPT_VECTOR_SPINLOCK_KICK);
+}
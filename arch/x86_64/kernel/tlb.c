@@ -0,0 +1,416 @@
+#include "zeptux.h"
+
+// Represents an association between a PCID on a CPU and the address space whose
+// entries are tagged with it.
+struct tlb_asid_slot {
+	uint64_t ctx_id; // 0 if unused.
+	// The address space TLB generation at the last flush of this PCID.
+	uint64_t tlb_gen;
+};
+
+// Represents per-CPU TLB state. Only ever accessed by the CPU in question.
+struct tlb_cpu_state {
+	struct tlb_asid_slot slots[TLB_NUM_ASIDS];
+	struct address_space *curr;
+	uint16_t curr_slot;
+	uint16_t next_victim; // We evict slots round-robin.
+};
+
+// Represents shootdown requests queued for a CPU by other CPUs. The lock is also
+// taken by the shootdown IPI handler, so must only be held with interrupts
+// disabled.
+struct tlb_mailbox {
+	spinlock_t lock;
+	uint32_t count;
+	struct tlb_batch *batches[TLB_MAILBOX_SIZE];
+};
+
+static DEFINE_PER_CPU(struct tlb_cpu_state, tlb_cpu_state);
+static struct tlb_mailbox mailboxes[MAX_CPUS];
+
+// These are set on the BSP and never changed thereafter.
+static bool pcid_enabled;
+static bool invpcid_supported;
+
+// Obtain TLB state for the current CPU.
+static struct tlb_cpu_state *this_cpu_state(void)
+{
+	return this_cpu_ptr(tlb_cpu_state);
+}
+
+// Convert a slot index to the PCID which tags it.
+static uint64_t slot_to_pcid(uint16_t slot)
+{
+	return slot + 1;
+}
+
+// Find the slot caching `as` on this CPU, evicting another if not present.
+// Returns true if entries tagged with the slot's PCID can be kept as-is.
+static bool choose_slot(struct tlb_cpu_state *state, struct address_space *as,
+			uint64_t gen, uint16_t *slot_ptr)
+{
+	for (uint16_t i = 0; i < TLB_NUM_ASIDS; i++) {
+		struct tlb_asid_slot *slot = &state->slots[i];
+
+		if (slot->ctx_id != as->ctx_id)
+			continue;
+
+		*slot_ptr = i;
+		if (slot->tlb_gen == gen)
+			return true;
+
+		slot->tlb_gen = gen;
+		return false;
+	}
+
+	// Entries tagged with the victim's PCID belong to another address
+	// space so must be flushed.
+	uint16_t victim = state->next_victim;
+	state->next_victim = (victim + 1) % TLB_NUM_ASIDS;
+
+	state->slots[victim].ctx_id = as->ctx_id;
+	state->slots[victim].tlb_gen = gen;
+	*slot_ptr = victim;
+	return false;
+}
+
+// Find the slot caching `as` on this CPU, or -1 if not present.
+static int find_slot(struct tlb_cpu_state *state, struct address_space *as)
+{
+	for (int i = 0; i < TLB_NUM_ASIDS; i++) {
+		if (state->slots[i].ctx_id == as->ctx_id)
+			return i;
+	}
+
+	return -1;
+}
+
+// Invalidate every TLB entry on this CPU, including global entries, for all
+// PCIDs.
+static void flush_everything(void)
+{
+	if (invpcid_supported) {
+		invpcid(X86_INVPCID_ALL_GLOBAL, 0, 0);
+		return;
+	}
+
+	// Toggling CR4.PGE invalidates everything including global entries.
+	uint64_t cr4 = read_cr4();
+	write_cr4(cr4 ^ X86_CR4_PGE);
+	write_cr4(cr4);
+}
+
+// Invalidate the ranges in `batch` on this CPU, recording the batch TLB
+// generation against the address space's slot if this leaves it up to date.
+static void flush_batch_local(struct tlb_batch *batch)
+{
+	struct tlb_cpu_state *state = this_cpu_state();
+	struct address_space *as = batch->as;
+	bool is_kernel = as == &kernel_address_space;
+	bool flush_all = batch->flush_all ||
+			 batch->num_pages > TLB_FLUSH_ALL_THRESHOLD;
+
+	int slot = -1;
+	if (state->curr == as)
+		slot = state->curr_slot;
+	else if (pcid_enabled)
+		slot = find_slot(state, as);
+
+	if (is_kernel && flush_all) {
+		// Kernel mappings are global so are cached regardless of which
+		// address space is loaded.
+		flush_everything();
+	} else if (is_kernel || state->curr == as) {
+		// INVLPG invalidates global entries whatever the current PCID.
+		if (flush_all) {
+			global_flush_tlb();
+		} else {
+			for (uint32_t i = 0; i < batch->num_ranges; i++) {
+				struct tlb_range *range = &batch->ranges[i];
+
+				for (uint64_t addr = range->start;
+				     addr < range->end; addr += PAGE_SIZE) {
+					invlpg(addr);
+				}
+			}
+		}
+	} else if (slot >= 0 && invpcid_supported) {
+		uint64_t pcid = slot_to_pcid(slot);
+
+		if (flush_all) {
+			invpcid(X86_INVPCID_PCID, pcid, 0);
+		} else {
+			for (uint32_t i = 0; i < batch->num_ranges; i++) {
+				struct tlb_range *range = &batch->ranges[i];
+
+				for (uint64_t addr = range->start;
+				     addr < range->end; addr += PAGE_SIZE) {
+					invpcid(X86_INVPCID_ADDR, pcid, addr);
+				}
+			}
+		}
+	} else {
+		// Without INVPCID we cannot target a PCID other than the
+		// current one, so we flush when we next switch to the address
+		// space instead.
+		return;
+	}
+
+	if (!pcid_enabled || slot < 0)
+		return;
+
+	// A partial flush only brings us up to date if we had already
+	// performed every prior flush, otherwise we leave the slot stale and
+	// flush everything on the next switch.
+	struct tlb_asid_slot *asid_slot = &state->slots[slot];
+	if (flush_all || asid_slot->tlb_gen + 1 == batch->gen) {
+		if (asid_slot->tlb_gen < batch->gen)
+			asid_slot->tlb_gen = batch->gen;
+	}
+}
+
+// Queue a shootdown request for a remote CPU, sending an IPI if it has no
+// requests already pending.
+static void send_shootdown(uint32_t cpu, struct tlb_batch *batch)
+{
+	struct tlb_mailbox *mailbox = &mailboxes[cpu];
+
+	while (true) {
+		uint64_t flags = irq_save();
+		spinlock_acquire(&mailbox->lock);
+
+		uint32_t count = mailbox->count;
+		if (count < TLB_MAILBOX_SIZE) {
+			mailbox->batches[count] = batch;
+			mailbox->count = count + 1;
+			spinlock_release(&mailbox->lock);
+			irq_restore(flags);
+
+			// If requests were already queued then an IPI is
+			// already on its way.
+			if (count == 0)
+				lapic_send_ipi(cpu_to_apic_id(cpu),
+					       INTERRUPT_VECTOR_TLB_SHOOTDOWN);
+			return;
+		}
+
+		spinlock_release(&mailbox->lock);
+		irq_restore(flags);
+
+		// The target might itself be waiting on us to service its
+		// requests.
+		tlb_shootdown_process();
+		hint_spinwait();
+	}
+}
+
+// Handle a TLB shootdown IPI.
+static void shootdown_interrupt(struct interrupt_frame *frame)
+{
+	IGNORE_PARAM(frame);
+
+	tlb_shootdown_process();
+}
+
+void tlb_init(void)
+{
+	struct tlb_cpu_state *state = this_cpu_state();
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid(0, 0, &eax, &ebx, &ecx, &edx);
+	uint32_t max_leaf = eax;
+
+	cpuid(1, 0, &eax, &ebx, &ecx, &edx);
+	bool pcid_supported = IS_MASK_SET(ecx, X86_CPUID_1_ECX_PCID);
+
+	// CR4.PCIDE may only be set while the current PCID is 0, which it is
+	// as we have not yet assigned any.
+	if (pcid_supported) {
+		write_cr4(read_cr4() | X86_CR4_PCIDE);
+		pcid_enabled = true;
+	}
+
+	// We only make use of INVPCID to target PCIDs other than the current
+	// one, which is meaningless without PCIDs.
+	if (pcid_enabled && max_leaf >= 7) {
+		cpuid(7, 0, &eax, &ebx, &ecx, &edx);
+		invpcid_supported = IS_MASK_SET(ebx, X86_CPUID_7_EBX_INVPCID);
+	}
+
+	interrupt_register(INTERRUPT_VECTOR_TLB_SHOOTDOWN, shootdown_interrupt);
+
+	state->curr = NULL;
+	tlb_switch(&kernel_address_space);
+}
+
+bool tlb_pcid_enabled(void)
+{
+	return pcid_enabled;
+}
+
+struct address_space *tlb_current(void)
+{
+	return this_cpu_state()->curr;
+}
+
+void tlb_switch(struct address_space *as)
+{
+	struct tlb_cpu_state *state = this_cpu_state();
+	struct address_space *prev = state->curr;
+	uint32_t cpu = cpu_id();
+
+	if (prev != as) {
+		if (prev != NULL)
+			cpumask_clear(&prev->active_cpus, cpu);
+		// This is a full barrier, so any shootdown initiated after our
+		// read of the generation below will see us as active.
+		cpumask_set(&as->active_cpus, cpu);
+	}
+
+	uint64_t gen = atomic_load_acquire(&as->tlb_gen);
+
+	if (!pcid_enabled) {
+		state->curr = as;
+		set_pgd(as->pgd);
+		return;
+	}
+
+	if (prev == as && state->slots[state->curr_slot].tlb_gen == gen)
+		return;
+
+	uint16_t slot;
+	uint64_t cr3 = as->pgd.x;
+	if (choose_slot(state, as, gen, &slot))
+		cr3 |= X86_CR3_NOFLUSH;
+	cr3 |= slot_to_pcid(slot);
+
+	state->curr = as;
+	state->curr_slot = slot;
+	write_cr3(cr3);
+}
+
+void tlb_flush_range(struct address_space *as, virtaddr_t va,
+		     uint64_t num_pages)
+{
+	struct tlb_batch batch;
+
+	tlb_batch_init(&batch, as);
+	tlb_batch_add(&batch, va, num_pages);
+
+	batch.gen = atomic_fetch_add_seq_cst(&as->tlb_gen, 1) + 1;
+	flush_batch_local(&batch);
+}
+
+void tlb_flush_all(struct address_space *as)
+{
+	struct tlb_batch batch;
+
+	tlb_batch_init(&batch, as);
+	batch.flush_all = true;
+
+	batch.gen = atomic_fetch_add_seq_cst(&as->tlb_gen, 1) + 1;
+	flush_batch_local(&batch);
+}
+
+void tlb_batch_init(struct tlb_batch *batch, struct address_space *as)
+{
+	batch->as = as;
+	batch->num_ranges = 0;
+	batch->num_pages = 0;
+	batch->flush_all = false;
+	batch->gen = 0;
+	atomic_store_relaxed(&batch->pending.bits, 0);
+}
+
+void tlb_batch_add(struct tlb_batch *batch, virtaddr_t va, uint64_t num_pages)
+{
+	if (batch->flush_all || num_pages == 0)
+		return;
+
+	uint64_t start = ALIGN(va.x, PAGE_SIZE);
+	uint64_t end = start + num_pages * PAGE_SIZE;
+
+	// Absorb any overlapping or adjacent ranges into this one.
+	for (uint32_t i = 0; i < batch->num_ranges;) {
+		struct tlb_range *range = &batch->ranges[i];
+
+		if (end < range->start || start > range->end) {
+			i++;
+			continue;
+		}
+
+		if (range->start < start)
+			start = range->start;
+		if (range->end > end)
+			end = range->end;
+
+		batch->num_pages -= (range->end - range->start) >> PAGE_SHIFT;
+		*range = batch->ranges[--batch->num_ranges];
+	}
+
+	if (batch->num_ranges == TLB_BATCH_MAX_RANGES) {
+		batch->flush_all = true;
+		return;
+	}
+
+	batch->ranges[batch->num_ranges++] = (struct tlb_range){start, end};
+	batch->num_pages += (end - start) >> PAGE_SHIFT;
+}
+
+void tlb_shootdown_start(struct tlb_batch *batch)
+{
+	struct address_space *as = batch->as;
+
+	// Any CPU which loads the address space after this will flush.
+	batch->gen = atomic_fetch_add_seq_cst(&as->tlb_gen, 1) + 1;
+
+	// Kernel mappings are global so every CPU might have them cached,
+	// otherwise only CPUs with the address space loaded are affected.
+	cpumask_t targets;
+	if (as == &kernel_address_space)
+		targets = cpumask_read(&cpu_online_mask);
+	else
+		targets = cpumask_read(&as->active_cpus);
+	targets.bits.x &= ~BIT_MASK(cpu_id());
+
+	batch->pending = targets;
+
+	uint32_t cpu;
+	for_each_cpu_in_mask(cpu, targets) {
+		send_shootdown(cpu, batch);
+	}
+
+	// Remote CPUs invalidate in parallel with us.
+	flush_batch_local(batch);
+}
+
+void tlb_shootdown_wait(struct tlb_batch *batch)
+{
+	while (!tlb_shootdown_done(batch)) {
+		tlb_shootdown_process();
+		hint_spinwait();
+	}
+}
+
+void tlb_shootdown_process(void)
+{
+	uint32_t cpu = cpu_id();
+	struct tlb_mailbox *mailbox = &mailboxes[cpu];
+	struct tlb_batch *batches[TLB_MAILBOX_SIZE];
+
+	uint64_t flags = irq_save();
+	spinlock_acquire(&mailbox->lock);
+	uint32_t count = mailbox->count;
+	for (uint32_t i = 0; i < count; i++) {
+		batches[i] = mailbox->batches[i];
+	}
+	mailbox->count = 0;
+	spinlock_release(&mailbox->lock);
+	irq_restore(flags);
+
+	// Once we clear our pending bit the initiator may discard the batch.
+	for (uint32_t i = 0; i < count; i++) {
+		flush_batch_local(batches[i]);
+		cpumask_clear(&batches[i]->pending, cpu);
+	}
+}
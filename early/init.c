@@ -2,7 +2,12 @@
 
 void early_init(void)
 {
+	percpu_early_init();
+	boot_trace_start();
+
 	early_serial_init_poll();
+	boot_trace_phase("early_serial_init_poll");
 	early_video_init();
+	boot_trace_phase("early_video_init");
 	early_mem_init();
 }
@@ -266,12 +266,22 @@ static uint64_t alloc_span_bitmaps(struct early_page_alloc_span *span)
 		early_scratch_page_alloc();
 	}
 
+	// The summary bitmap tracks one bit per alloc bitmap word.
+	uint64_t num_words = bitmap_calc_words(num_pages);
+	uint64_t full_bitmap_pages = bytes_to_pages(bitmap_calc_size(num_words));
+	span->full_bitmap = phys_to_virt_ptr(early_scratch_page_alloc());
+	for (int i = 1; i < (int)full_bitmap_pages; i++) {
+		early_scratch_page_alloc();
+	}
+
 	bitmap_init(span->alloc_bitmap, num_pages);
 	bitmap_init(span->ephemeral_bitmap, num_pages);
 	bitmap_init(span->pagetable_bitmap, num_pages);
 	bitmap_init(span->physblock_bitmap, num_pages);
+	bitmap_init(span->full_bitmap, num_words);
+	span->next_offset = 0;
 
-	return bitmap_pages * 4;
+	return bitmap_pages * 4 + full_bitmap_pages;
 }
 
 // Find the early page allocator span that contains a specified physical
@@ -312,35 +322,60 @@ static inline physaddr_t span_offset_to_pa(struct early_page_alloc_span *span,
 	return pa;
 }
 
-// Mark a page allocated and update stats accordingly in the early page
-// allocator.
-static void mark_page_allocated(struct early_page_alloc_span *span,
-				uint64_t offset, enum early_alloc_type type)
+// Determine whether every page tracked by the specified alloc bitmap word is
+// allocated. Out-of-range bits in the final word are always clear so we mask
+// them out.
+static bool alloc_word_full(struct early_page_alloc_span *span, uint64_t word)
 {
-	bitmap_set(span->alloc_bitmap, offset);
-	alloc_state->num_allocated_pages++;
-	span->num_allocated_pages++;
+	uint64_t num_pages = span->num_pages - word * 64;
+	uint64_t mask = num_pages >= 64 ? ~0UL : BIT_MASK_BELOW(num_pages);
+
+	return (span->alloc_bitmap->data[word] & mask) == mask;
+}
+
+// Mark `num_pages` pages starting at `offset` allocated and update stats
+// accordingly in the early page allocator.
+static void mark_pages_allocated(struct early_page_alloc_span *span,
+				 uint64_t offset, uint64_t num_pages,
+				 enum early_alloc_type type)
+{
+	bitmap_set_range(span->alloc_bitmap, offset, num_pages);
+	uint64_t last_word = (offset + num_pages - 1) / 64;
+	for (uint64_t word = offset / 64; word <= last_word; word++) {
+		if (alloc_word_full(span, word))
+			bitmap_set(span->full_bitmap, word);
+	}
+	alloc_state->num_allocated_pages += num_pages;
+	span->num_allocated_pages += num_pages;
 
 	switch (type) {
 	case EARLY_ALLOC_NORMAL:
 		break;
 	case EARLY_ALLOC_EPHEMERAL:
-		bitmap_set(span->ephemeral_bitmap, offset);
-		alloc_state->num_ephemeral_pages++;
+		bitmap_set_range(span->ephemeral_bitmap, offset, num_pages);
+		alloc_state->num_ephemeral_pages += num_pages;
 		break;
 	case EARLY_ALLOC_PAGETABLE:
-		bitmap_set(span->pagetable_bitmap, offset);
-		alloc_state->num_pagetable_pages++;
+		bitmap_set_range(span->pagetable_bitmap, offset, num_pages);
+		alloc_state->num_pagetable_pages += num_pages;
 		break;
 	case EARLY_ALLOC_PHYSBLOCK:
-		bitmap_set(span->physblock_bitmap, offset);
-		alloc_state->num_physblock_pages++;
+		bitmap_set_range(span->physblock_bitmap, offset, num_pages);
+		alloc_state->num_physblock_pages += num_pages;
 		break;
 	default:
 		early_panic("Impossible!");
 	}
 }
 
+// Mark a page allocated and update stats accordingly in the early page
+// allocator.
+static void mark_page_allocated(struct early_page_alloc_span *span,
+				uint64_t offset, enum early_alloc_type type)
+{
+	mark_pages_allocated(span, offset, 1, type);
+}
+
 // Allocate at the specific physical address in the early page allocator or
 // panic if already allocated. This will only ever be called single threaded so
 // we don't have to worry about sychronisation.
@@ -360,6 +395,24 @@ static void alloc_at(physaddr_t pa, enum early_alloc_type type)
 	mark_page_allocated(span, offset, type);
 }
 
+// Find a free page in the span, or -1 if it is full. We search from the next-fit
+// cursor using the summary bitmap to skip full words, so allocation does not
+// become quadratic in the number of allocated pages.
+static int64_t find_free_page(struct early_page_alloc_span *span)
+{
+	if (span->num_allocated_pages == span->num_pages)
+		return -1;
+
+	int64_t word = bitmap_find_next_clear(span->full_bitmap,
+					      span->next_offset / 64);
+	if (word == -1)
+		early_panic("Span has free pages but none after cursor?");
+
+	// A word which is not full always has an in-range clear bit.
+	uint64_t bits = span->alloc_bitmap->data[word];
+	return word * 64 + find_first_clear_bit(bits);
+}
+
 // Allocate a page from the early page allocator.
 static physaddr_t alloc(enum early_alloc_type type)
 {
@@ -370,11 +423,12 @@ static physaddr_t alloc(enum early_alloc_type type)
 	for (int i = 0; i < (int)alloc_state->num_spans; i++) {
 		struct early_page_alloc_span *span = &alloc_state->spans[i];
 
-		int64_t offset = bitmap_first_clear(span->alloc_bitmap);
+		int64_t offset = find_free_page(span);
 		if (offset == -1)
 			continue;
 
 		mark_page_allocated(span, offset, type);
+		span->next_offset = offset + 1;
 		return span_offset_to_pa(span, offset);
 	}
 
@@ -397,28 +451,27 @@ physaddr_t early_page_alloc(void)
 	return alloc(EARLY_ALLOC_NORMAL);
 }
 
-physaddr_t early_pages_alloc(int pages)
+physaddr_t early_pages_alloc(uint64_t pages)
 {
-	if (pages > (int)sizeof(uint64_t))
-		early_panic(
-			"Can only allocate up to %d pages using the early allocator, attempting to allocate %d",
-			(int)sizeof(uint64_t), pages);
-
 	for (int i = 0; i < (int)alloc_state->num_spans; i++) {
 		struct early_page_alloc_span *span = &alloc_state->spans[i];
-		int offset =
-			bitmap_zero_string_longer_than(span->alloc_bitmap, pages);
+		if (span->num_pages - span->num_allocated_pages < pages)
+			continue;
+
+		// No page before the next-fit cursor is free so we can start
+		// searching from there.
+		int64_t offset = bitmap_zero_run(span->alloc_bitmap,
+						 span->next_offset, pages);
 		if (offset == -1)
 			continue;
 
-		// Mark all pages allocated.
-		for (int j = offset; j < offset + pages; j++) {
-			mark_page_allocated(span, j, EARLY_ALLOC_NORMAL);
-		}
+		mark_pages_allocated(span, offset, pages, EARLY_ALLOC_NORMAL);
+		if ((uint64_t)offset == span->next_offset)
+			span->next_offset += pages;
 		return span_offset_to_pa(span, offset);
 	}
 
-	early_panic("Unable to allocate %d physically contiguous pages", pages);
+	early_panic("Unable to allocate %lu physically contiguous pages", pages);
 }
 
 physaddr_t early_page_alloc_ephemeral(void)
@@ -440,6 +493,41 @@ physaddr_t early_physblock_page_alloc(void)
 	return pa;
 }
 
+bool early_physblock_pages_alloc_aligned(uint64_t num_pages,
+					 physaddr_t *pa_out)
+{
+	for (int i = 0; i < (int)alloc_state->num_spans; i++) {
+		struct early_page_alloc_span *span = &alloc_state->spans[i];
+		uint64_t start_pfn = phys_to_pfn(span->start).x;
+		uint64_t offset = ALIGN_UP(start_pfn, num_pages) - start_pfn;
+
+		while (offset + num_pages <= span->num_pages) {
+			uint64_t end = offset + num_pages;
+			int64_t j = bitmap_find_next_set(span->alloc_bitmap,
+							 offset);
+
+			// Resume from the next aligned offset past the
+			// allocated page.
+			if (j != -1 && (uint64_t)j < end) {
+				offset = ALIGN_UP(start_pfn + j + 1, num_pages) -
+					 start_pfn;
+				continue;
+			}
+
+			mark_pages_allocated(span, offset, num_pages,
+					     EARLY_ALLOC_PHYSBLOCK);
+			for (uint64_t k = offset; k < end; k++) {
+				zero_page(span_offset_to_pa(span, k));
+			}
+
+			*pa_out = span_offset_to_pa(span, offset);
+			return true;
+		}
+	}
+
+	return false;
+}
+
 void early_page_free(physaddr_t pa)
 {
 	struct early_page_alloc_span *span = find_span(pa);
@@ -452,6 +540,10 @@ void early_page_free(physaddr_t pa)
 		early_panic("Attempt to free unallocated PA %lx", pa.x);
 
 	bitmap_clear(span->alloc_bitmap, offset);
+	if (bitmap_is_set(span->full_bitmap, offset / 64))
+		bitmap_clear(span->full_bitmap, offset / 64);
+	if (offset < span->next_offset)
+		span->next_offset = offset;
 	alloc_state->num_allocated_pages--;
 	span->num_allocated_pages--;
 
@@ -583,6 +675,40 @@ void early_map_direct(struct early_boot_info *info, pgdaddr_t pgd)
 	}
 }
 
+// Determine the number of pages to map for the kernel ELF section
+// `sect_header`. If the section is loaded, read-only and begins on a 2 MiB
+// boundary (see kernel/kernel-2mib.ld), we extend its mapping to the next 2 MiB
+// boundary where the remainder is only file padding, so it is mapped entirely
+// using 2 MiB pages.
+static uint64_t kernel_elf_section_pages(struct elf_header *header,
+					 struct elf_section_header *sect_header)
+{
+	uint64_t num_pages = bytes_to_pages(sect_header->size);
+	uint64_t start = sect_header->addr;
+	uint64_t end = ALIGN_UP(start + sect_header->size, PAGE_SIZE_2MIB);
+
+	if (sect_header->type != ELF_SHT_PROGBITS ||
+	    IS_MASK_SET(sect_header->flags, ELF_SHF_WRITE) ||
+	    !IS_ALIGNED(start, PAGE_SIZE_2MIB))
+		return num_pages;
+
+	// The padding must have been loaded along with the rest of the image.
+	if (end - KERNEL_ELF_ADDRESS >
+	    early_get_boot_info()->kernel_elf_size_bytes)
+		return num_pages;
+
+	// No other section may share the final 2 MiB page.
+	struct elf_section_header *sect_headers = (void *)header + header->shoff;
+	for (int i = 0; i < (int)header->shnum; i++) {
+		uint64_t addr = sect_headers[i].addr;
+
+		if (addr > start && addr < end)
+			return num_pages;
+	}
+
+	return bytes_to_pages(end - start);
+}
+
 void early_map_kernel_elf(struct elf_header *header, physaddr_t elf_pa,
 			  pgdaddr_t pgd)
 {
@@ -636,7 +762,8 @@ void early_map_kernel_elf(struct elf_header *header, physaddr_t elf_pa,
 			flags |= MAP_CODE;
 
 		// Do actual mapping.
-		_map_page_range(pgd, va, pa, bytes_to_pages(sect_header->size),
+		_map_page_range(pgd, va, pa,
+				kernel_elf_section_pages(header, sect_header),
 				flags, &early_allocators);
 	}
 
@@ -697,10 +824,44 @@ static void early_remap_page_tables(struct early_boot_info *info)
 
 	set_pgd(pgd);
 	kernel_root_pgd = pgd;
+	address_space_init(&kernel_address_space, pgd);
+}
+
+// Allocate zeroed memory to back the mem map from `va`, using the largest page
+// size no larger than `*max_pages` pages for which `va` is aligned, the range
+// up to `end_va` is large enough and aligned physically contiguous memory is
+// available. Sets `*num_pages` to the number of pages allocated. Lowers
+// `*max_pages` on failure so we do not repeatedly search for memory we know
+// is unavailable.
+static physaddr_t alloc_mem_map_chunk(virtaddr_t va, virtaddr_t end_va,
+				      uint64_t *max_pages, uint64_t *num_pages)
+{
+	static const uint64_t sizes[] = {NUM_PAGES_PMD, NUM_PAGES_PTD};
+	uint64_t remaining = bytes_to_pages(end_va.x - va.x);
+
+	for (int i = 0; i < (int)ARRAY_COUNT(sizes); i++) {
+		uint64_t size = sizes[i];
+		physaddr_t pa;
+
+		if (size > *max_pages || !IS_ALIGNED(va.x, size * PAGE_SIZE) ||
+		    remaining < size)
+			continue;
+
+		if (early_physblock_pages_alloc_aligned(size, &pa)) {
+			*num_pages = size;
+			return pa;
+		}
+		*max_pages = size - 1;
+	}
+
+	*num_pages = 1;
+	return early_physblock_page_alloc();
 }
 
 // Allocate and map struct physblock objects representing `num_pages` pages from
-// `start`.
+// `start`. We back the mem map with 2 MiB or 1 GiB pages where it covers them
+// so physblock lookups incur fewer TLB misses, and map physically contiguous
+// runs of backing memory at once.
 static void alloc_map_physblock(physaddr_t start, uint64_t num_pages)
 {
 	// We have to map the page _containing_ the first VA in the range up to
@@ -711,13 +872,35 @@ static void alloc_map_physblock(physaddr_t start, uint64_t num_pages)
 	virtaddr_t start_va = {ALIGN(start_addr, PAGE_SIZE)};
 	virtaddr_t end_va = {ALIGN_UP(end_addr, PAGE_SIZE)};
 
-	for (virtaddr_t va = start_va; va.x < end_va.x; va = virt_next_page(va)) {
-		// We initialise all physblocks to zero.
-		physaddr_t pa = early_physblock_page_alloc();
+	uint64_t max_pages = NUM_PAGES_PMD;
+	virtaddr_t run_va = start_va;
+	physaddr_t run_pa = {0};
+	uint64_t run_pages = 0;
+
+	for (virtaddr_t va = start_va; va.x < end_va.x;) {
+		uint64_t chunk_pages;
+		physaddr_t pa =
+			alloc_mem_map_chunk(va, end_va, &max_pages, &chunk_pages);
+
+		// Map the run so far if this chunk does not extend it.
+		if (run_pages > 0 &&
+		    pa.x != phys_offset_pages(run_pa, run_pages).x) {
+			_map_page_range(kernel_root_pgd, run_va, run_pa,
+					run_pages, MAP_KERNEL, &early_allocators);
+			run_pages = 0;
+		}
 
-		_map_page_range(kernel_root_pgd, va, pa, 1, MAP_KERNEL,
-				&early_allocators);
+		if (run_pages == 0) {
+			run_va = va;
+			run_pa = pa;
+		}
+		run_pages += chunk_pages;
+		va = virt_offset_pages(va, chunk_pages);
 	}
+
+	if (run_pages > 0)
+		_map_page_range(kernel_root_pgd, run_va, run_pa, run_pages,
+				MAP_KERNEL, &early_allocators);
 }
 
 // Determine the physical address of memory referenced by an offset into an
@@ -729,6 +912,20 @@ static physaddr_t span_to_phys(struct early_page_alloc_span *span, uint64_t i)
 	return pa;
 }
 
+// Count the number of present entries in the page table at `pa`.
+static uint16_t count_present_entries(physaddr_t pa)
+{
+	uint64_t *entries = phys_to_virt_ptr(pa);
+	uint16_t count = 0;
+
+	for (int i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+		if (IS_BIT_SET(entries[i], PAGE_FLAG_PRESENT_BIT))
+			count++;
+	}
+
+	return count;
+}
+
 // Initialise the physblock for the early page allocated span. Assumes
 // physblocks allocated and mapped.
 static void init_physblock_span(struct early_page_alloc_span *span)
@@ -754,6 +951,8 @@ static void init_physblock_span(struct early_page_alloc_span *span)
 
 		if (bitmap_is_set(span->pagetable_bitmap, i)) {
 			block->type = PHYSBLOCK_PAGETABLE;
+			block->pagetable.num_entries = count_present_entries(pa);
+			block->pagetable.lock = empty_spinlock();
 		} else if (bitmap_is_set(span->physblock_bitmap, i)) {
 			block->type = PHYSBLOCK_PHYSBLOCK;
 		} else {
@@ -818,14 +1017,25 @@ void early_mem_init(void)
 	struct early_boot_info *info = early_get_boot_info();
 
 	drop_direct0();
+	boot_trace_phase("drop_direct0");
 	early_sort_e820(info);
+	boot_trace_phase("early_sort_e820");
 	early_merge_e820(info);
+	boot_trace_phase("early_merge_e820");
 	early_normalise_e820(info);
+	boot_trace_phase("early_normalise_e820");
 	early_set_total_ram(info);
+	boot_trace_phase("early_set_total_ram");
 	early_scratch_alloc_init();
+	boot_trace_phase("early_scratch_alloc_init");
 	early_page_alloc_init(info);
+	boot_trace_phase("early_page_alloc_init");
 	early_remap_page_tables(info);
+	boot_trace_phase("early_remap_page_tables");
 	early_init_kernel_global();
+	boot_trace_phase("early_init_kernel_global");
 	early_init_phys_alloc_state();
+	boot_trace_phase("early_init_phys_alloc_state");
 	early_init_mem_map();
+	boot_trace_phase("early_init_mem_map");
 }
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "address_space.h"
+#include "list.h"
+#include "page.h"
+#include "spinlock.h"
+#include "types.h"
+
+// The access monitor tracks how frequently pages within a range of an address
+// space are accessed, in the manner of linux's DAMON. See
+// https://docs.kernel.org/mm/damon/design.html
+//
+// The range is divided into regions, each assumed to consist of pages accessed
+// at a similar frequency. Each sample checks the accessed flag of a single
+// randomly chosen page per region, so the cost of sampling is bounded by the
+// number of regions rather than the size of the range. At the end of each
+// aggregation interval adjacent regions of similar heat are merged and regions
+// are split so their boundaries adapt to the actual access pattern.
+
+// Represents a region [start, end) of the monitored range.
+struct access_region {
+	virtaddr_t start, end;
+	// The page whose accessed flag will be checked at the next sample.
+	virtaddr_t sample_va;
+	// Number of samples so far in this aggregation interval at which the
+	// sampled page had been accessed.
+	uint32_t num_accesses;
+	// Number of samples at which the region was found to be accessed in the
+	// last complete aggregation interval.
+	uint32_t heat;
+	struct list_node node;
+};
+
+// Represents access monitor tunables.
+struct access_monitor_params {
+	// The number of samples per aggregation interval, which is also the
+	// maximum heat a region can have.
+	uint32_t samples_per_aggregation;
+	// Bounds on the number of regions. The maximum bounds the cost of
+	// sampling.
+	uint32_t min_regions, max_regions;
+	// Adjacent regions whose heat differs by no more than this are merged.
+	uint32_t merge_threshold;
+};
+
+// Represents the state of an access monitor.
+struct access_monitor {
+	struct address_space *as;
+	struct access_monitor_params params;
+
+	// Regions ordered by address, protected by `lock`.
+	struct list regions;
+	uint32_t num_regions;
+	// Number of samples taken in the current aggregation interval.
+	uint32_t num_samples;
+	uint64_t num_aggregations;
+	uint64_t rand_state;
+
+	spinlock_t lock;
+};
+
+// Start monitoring [va, va + num_pages) in the specified address space, using
+// default tunables if `params` is NULL. The range must contain at least
+// `min_regions` pages.
+void access_monitor_init(struct access_monitor *mon, struct address_space *as,
+			 virtaddr_t va, uint64_t num_pages,
+			 struct access_monitor_params *params);
+
+// Stop monitoring and release all regions.
+void access_monitor_destroy(struct access_monitor *mon);
+
+// Take a sample, aggregating and adjusting regions at the end of each
+// aggregation interval. Intended to be invoked periodically.
+void access_monitor_sample(struct access_monitor *mon);
+
+// Obtain the heat of the region containing `va`, or 0 if not monitored.
+uint32_t access_monitor_heat(struct access_monitor *mon, virtaddr_t va);
+
+// Populate `num_pages[0, num_buckets)` with the number of monitored pages whose
+// heat falls within each of `num_buckets` equally sized buckets, coldest
+// first.
+void access_monitor_histogram(struct access_monitor *mon, uint64_t *num_pages,
+			      uint32_t num_buckets);
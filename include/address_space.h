@@ -0,0 +1,105 @@
+#pragma once
+
+#include "cpumask.h"
+#include "list.h"
+#include "page.h"
+#include "spinlock.h"
+#include "types.h"
+
+// Represents a region of an address space whose pages are only allocated and
+// mapped when first accessed.
+struct lazy_region {
+	virtaddr_t start;
+	uint64_t num_pages;
+	map_flags_t flags;
+	struct list_node node;
+};
+
+// Represents the cause of a page fault.
+typedef enum {
+	FAULT_PROTECTION = 1 << 0, // Otherwise the page was not present.
+	FAULT_WRITE = 1 << 1,      // Otherwise the access was a read.
+} fault_flags_t;
+
+// Represents a virtual address space, that is a hierarchy of page tables rooted
+// at a PGD, along with the state required to track TLB entries which reference
+// it.
+struct address_space {
+	pgdaddr_t pgd;
+	// Unique identifier for the address space, never reused. CPUs use this
+	// to determine whether they have TLB entries cached for it.
+	uint64_t ctx_id;
+	// Incremented each time TLB entries for this address space are
+	// invalidated. A CPU which last flushed an older generation must flush
+	// again before reusing any cached entries.
+	atomic64_t tlb_gen;
+	// CPUs which currently have this address space loaded.
+	cpumask_t active_cpus;
+	// Lazily backed regions, protected by `lazy_lock`.
+	struct list lazy_regions;
+	spinlock_t lazy_lock;
+};
+
+// The kernel address space, rooted at kernel_root_pgd.
+extern struct address_space kernel_address_space;
+
+// Page table allocators backed by the physical allocator. These track page
+// table occupancy so empty page tables are freed on unmap.
+extern struct page_allocators kernel_page_allocators;
+
+// Initialise an address space rooted at the specified PGD.
+void address_space_init(struct address_space *as, pgdaddr_t pgd);
+
+// Create a new address space with a newly allocated PGD sharing the kernel half
+// of the kernel address space.
+void address_space_create(struct address_space *as);
+
+// Create `dst` as a copy-on-write duplicate of `src`. Page tables mapping the
+// lower half of `src` are copied and writable pages are shared read-only
+// between the two, each being copied on first write by either. 2 MiB pages are
+// shared whole. Lazily backed regions are also duplicated. Returns the number
+// of page tables allocated.
+uint64_t address_space_clone(struct address_space *dst,
+			     struct address_space *src);
+
+// Map [va, va + num_pages) to [pa, pa + num_pages) in the specified address
+// space. Returns the number of page tables allocated.
+uint64_t address_space_map(struct address_space *as, virtaddr_t va,
+			   physaddr_t pa, int64_t num_pages, map_flags_t flags);
+
+// Unmap [va, va + num_pages) from the specified address space, flushing the
+// TLB on all CPUs which may reference it and freeing any page tables which
+// become empty as a result. Returns the number of page tables freed.
+uint64_t address_space_unmap(struct address_space *as, virtaddr_t va,
+			     int64_t num_pages);
+
+// Promote contiguous 4 KiB mappings within [va, va + num_pages) in the
+// specified address space to 2 MiB pages where possible, flushing the TLB and
+// freeing the PTDs which are replaced. Intended to be invoked periodically over
+// long-lived regions which were built up incrementally. Returns the number of
+// 2 MiB pages created.
+uint64_t address_space_collapse(struct address_space *as, virtaddr_t va,
+				int64_t num_pages);
+
+// Register a region [va, va + num_pages) of the specified address space whose
+// pages are allocated, zeroed and mapped with `flags` on first access. Where
+// the region entirely contains 2 MiB-aligned ranges, these are faulted in as 2
+// MiB pages.
+void address_space_add_lazy_region(struct address_space *as, virtaddr_t va,
+				   uint64_t num_pages, map_flags_t flags);
+
+// Unregister the lazily backed region starting at `va`. Pages already faulted in
+// remain mapped.
+void address_space_remove_lazy_region(struct address_space *as, virtaddr_t va);
+
+// Copy the kernel address space's PGD entry for the kernel half `va` into the
+// specified address space if it was added after the latter was created. Entries
+// are only copied on creation, so a fault on such a range is resolved this way.
+// Returns true if an entry was copied.
+bool address_space_sync_kernel(struct address_space *as, virtaddr_t va);
+
+// Handle a page fault at `va` in the specified address space, either faulting
+// in a lazily backed page or breaking copy-on-write. Returns false if the fault
+// could not be handled.
+bool address_space_fault(struct address_space *as, virtaddr_t va,
+			 fault_flags_t flags);
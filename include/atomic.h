@@ -6,11 +6,198 @@
 
 // Represents an atomic value.
 TYPE_WRAP(atomic_t, uint32_t);
+// Represents a 64-bit atomic value.
+TYPE_WRAP(atomic64_t, uint64_t);
 
 // Wrappers around built-in atomic functions. These use the C++ memory model
 // concepts e.g. 'relaxed', 'acquire', 'release' etc.
 // See https://en.cppreference.com/w/cpp/atomic/memory_order
-#define atomic_load_relaxed(_ptr) _atomic_load_relaxed(&(_ptr)->x)
+//
+// Each operation is provided with its memory order as a suffix. All operations
+// work on both atomic_t and atomic64_t.
+//
+// NOTE: We avoid the names used by C11 <stdatomic.h> and C++ <atomic> (e.g.
+// atomic_fetch_add()) as the userland tests include both.
+
+// Memory barriers. x86-64 only reorders stores after later loads, so the read
+// and write barriers need only prevent compiler reordering.
+#define smp_mb() memory_fence()
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+
+// Load.
+#define _atomic_load_order(_ptr, _order) __atomic_load_n(&(_ptr)->x, _order)
+#define atomic_load_relaxed(_ptr) _atomic_load_order(_ptr, __ATOMIC_RELAXED)
+#define atomic_load_acquire(_ptr) _atomic_load_order(_ptr, __ATOMIC_ACQUIRE)
+#define atomic_load_seq_cst(_ptr) _atomic_load_order(_ptr, __ATOMIC_SEQ_CST)
+
+// Store.
+#define _atomic_store_order(_ptr, _val, _order) \
+	__atomic_store_n(&(_ptr)->x, _val, _order)
+#define atomic_store_relaxed(_ptr, _val) \
+	_atomic_store_order(_ptr, _val, __ATOMIC_RELAXED)
+#define atomic_store_release(_ptr, _val) \
+	_atomic_store_order(_ptr, _val, __ATOMIC_RELEASE)
+#define atomic_store_seq_cst(_ptr, _val) \
+	_atomic_store_order(_ptr, _val, __ATOMIC_SEQ_CST)
+
+// Exchange, returning the previous value.
+#define _atomic_exchange_order(_ptr, _val, _order) \
+	__atomic_exchange_n(&(_ptr)->x, _val, _order)
+#define atomic_exchange_relaxed(_ptr, _val) \
+	_atomic_exchange_order(_ptr, _val, __ATOMIC_RELAXED)
 #define atomic_exchange_acquire(_ptr, _val) \
-	_atomic_exchange_acquire(&(_ptr)->x, _val)
-#define atomic_store_release(_ptr, _val) _atomic_store_release(&(_ptr)->x, _val)
+	_atomic_exchange_order(_ptr, _val, __ATOMIC_ACQUIRE)
+#define atomic_exchange_release(_ptr, _val) \
+	_atomic_exchange_order(_ptr, _val, __ATOMIC_RELEASE)
+#define atomic_exchange_seq_cst(_ptr, _val) \
+	_atomic_exchange_order(_ptr, _val, __ATOMIC_SEQ_CST)
+
+// Add, returning the previous value.
+#define _atomic_fetch_add_order(_ptr, _val, _order) \
+	__atomic_fetch_add(&(_ptr)->x, _val, _order)
+#define atomic_fetch_add_relaxed(_ptr, _val) \
+	_atomic_fetch_add_order(_ptr, _val, __ATOMIC_RELAXED)
+#define atomic_fetch_add_acquire(_ptr, _val) \
+	_atomic_fetch_add_order(_ptr, _val, __ATOMIC_ACQUIRE)
+#define atomic_fetch_add_release(_ptr, _val) \
+	_atomic_fetch_add_order(_ptr, _val, __ATOMIC_RELEASE)
+#define atomic_fetch_add_seq_cst(_ptr, _val) \
+	_atomic_fetch_add_order(_ptr, _val, __ATOMIC_SEQ_CST)
+
+// Subtract, returning the previous value.
+#define _atomic_fetch_sub_order(_ptr, _val, _order) \
+	__atomic_fetch_sub(&(_ptr)->x, _val, _order)
+#define atomic_fetch_sub_relaxed(_ptr, _val) \
+	_atomic_fetch_sub_order(_ptr, _val, __ATOMIC_RELAXED)
+#define atomic_fetch_sub_acquire(_ptr, _val) \
+	_atomic_fetch_sub_order(_ptr, _val, __ATOMIC_ACQUIRE)
+#define atomic_fetch_sub_release(_ptr, _val) \
+	_atomic_fetch_sub_order(_ptr, _val, __ATOMIC_RELEASE)
+#define atomic_fetch_sub_seq_cst(_ptr, _val) \
+	_atomic_fetch_sub_order(_ptr, _val, __ATOMIC_SEQ_CST)
+
+// Bitwise and, returning the previous value.
+#define _atomic_fetch_and_order(_ptr, _val, _order) \
+	__atomic_fetch_and(&(_ptr)->x, _val, _order)
+#define atomic_fetch_and_relaxed(_ptr, _val) \
+	_atomic_fetch_and_order(_ptr, _val, __ATOMIC_RELAXED)
+#define atomic_fetch_and_acquire(_ptr, _val) \
+	_atomic_fetch_and_order(_ptr, _val, __ATOMIC_ACQUIRE)
+#define atomic_fetch_and_release(_ptr, _val) \
+	_atomic_fetch_and_order(_ptr, _val, __ATOMIC_RELEASE)
+#define atomic_fetch_and_seq_cst(_ptr, _val) \
+	_atomic_fetch_and_order(_ptr, _val, __ATOMIC_SEQ_CST)
+
+// Bitwise or, returning the previous value.
+#define _atomic_fetch_or_order(_ptr, _val, _order) \
+	__atomic_fetch_or(&(_ptr)->x, _val, _order)
+#define atomic_fetch_or_relaxed(_ptr, _val) \
+	_atomic_fetch_or_order(_ptr, _val, __ATOMIC_RELAXED)
+#define atomic_fetch_or_acquire(_ptr, _val) \
+	_atomic_fetch_or_order(_ptr, _val, __ATOMIC_ACQUIRE)
+#define atomic_fetch_or_release(_ptr, _val) \
+	_atomic_fetch_or_order(_ptr, _val, __ATOMIC_RELEASE)
+#define atomic_fetch_or_seq_cst(_ptr, _val) \
+	_atomic_fetch_or_order(_ptr, _val, __ATOMIC_SEQ_CST)
+
+// Increment or decrement, returning true if the result is zero. Decrement and
+// test is typically used to drop a reference count, which requires release
+// semantics so prior accesses to the object happen before it is freed, and
+// acquire semantics so the freeing thread observes them.
+#define _atomic_add_and_test_order(_ptr, _val, _order) \
+	(__atomic_add_fetch(&(_ptr)->x, _val, _order) == 0)
+#define atomic_inc_and_test_relaxed(_ptr) \
+	_atomic_add_and_test_order(_ptr, 1, __ATOMIC_RELAXED)
+#define atomic_inc_and_test_acq_rel(_ptr) \
+	_atomic_add_and_test_order(_ptr, 1, __ATOMIC_ACQ_REL)
+#define atomic_inc_and_test_seq_cst(_ptr) \
+	_atomic_add_and_test_order(_ptr, 1, __ATOMIC_SEQ_CST)
+#define atomic_dec_and_test_relaxed(_ptr) \
+	_atomic_add_and_test_order(_ptr, -1, __ATOMIC_RELAXED)
+#define atomic_dec_and_test_acq_rel(_ptr) \
+	_atomic_add_and_test_order(_ptr, -1, __ATOMIC_ACQ_REL)
+#define atomic_dec_and_test_seq_cst(_ptr) \
+	_atomic_add_and_test_order(_ptr, -1, __ATOMIC_SEQ_CST)
+
+// Compare and exchange. If the value equals `*_old_ptr` replace it with `_new`
+// and return true, otherwise update `*_old_ptr` to the current value and return
+// false. The weak variants may fail spuriously, but can be cheaper when used in
+// a loop on some architectures.
+#define _atomic_try_cmpxchg_order(_ptr, _old_ptr, _new, _weak, _order, \
+				  _fail_order)                         \
+	__atomic_compare_exchange_n(&(_ptr)->x, _old_ptr, _new, _weak, \
+				    _order, _fail_order)
+#define atomic_try_cmpxchg_relaxed(_ptr, _old_ptr, _new)       \
+	_atomic_try_cmpxchg_order(_ptr, _old_ptr, _new, false, \
+				  __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define atomic_try_cmpxchg_acquire(_ptr, _old_ptr, _new)       \
+	_atomic_try_cmpxchg_order(_ptr, _old_ptr, _new, false, \
+				  __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)
+#define atomic_try_cmpxchg_release(_ptr, _old_ptr, _new)       \
+	_atomic_try_cmpxchg_order(_ptr, _old_ptr, _new, false, \
+				  __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#define atomic_try_cmpxchg_seq_cst(_ptr, _old_ptr, _new)       \
+	_atomic_try_cmpxchg_order(_ptr, _old_ptr, _new, false, \
+				  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+#define atomic_try_cmpxchg_weak_relaxed(_ptr, _old_ptr, _new) \
+	_atomic_try_cmpxchg_order(_ptr, _old_ptr, _new, true, \
+				  __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#define atomic_try_cmpxchg_weak_acquire(_ptr, _old_ptr, _new) \
+	_atomic_try_cmpxchg_order(_ptr, _old_ptr, _new, true, \
+				  __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)
+#define atomic_try_cmpxchg_weak_release(_ptr, _old_ptr, _new) \
+	_atomic_try_cmpxchg_order(_ptr, _old_ptr, _new, true, \
+				  __ATOMIC_RELEASE, __ATOMIC_RELAXED)
+#define atomic_try_cmpxchg_weak_seq_cst(_ptr, _old_ptr, _new) \
+	_atomic_try_cmpxchg_order(_ptr, _old_ptr, _new, true, \
+				  __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+// Compare and exchange, replacing the value with `_new` if it equals `_old`.
+// Returns the previous value, so succeeded if this equals `_old`.
+#define _atomic_cmpxchg_order(_ptr, _old, _new, _order, _fail_order)     \
+	({                                                               \
+		typeof((_ptr)->x) __old = (_old);                        \
+		__atomic_compare_exchange_n(&(_ptr)->x, &__old, _new,    \
+					    false, _order, _fail_order); \
+		__old;                                                   \
+	})
+#define atomic_cmpxchg_relaxed(_ptr, _old, _new)                  \
+	_atomic_cmpxchg_order(_ptr, _old, _new, __ATOMIC_RELAXED, \
+			      __ATOMIC_RELAXED)
+#define atomic_cmpxchg_acquire(_ptr, _old, _new)                  \
+	_atomic_cmpxchg_order(_ptr, _old, _new, __ATOMIC_ACQUIRE, \
+			      __ATOMIC_ACQUIRE)
+#define atomic_cmpxchg_release(_ptr, _old, _new)                  \
+	_atomic_cmpxchg_order(_ptr, _old, _new, __ATOMIC_RELEASE, \
+			      __ATOMIC_RELAXED)
+#define atomic_cmpxchg_seq_cst(_ptr, _old, _new)                  \
+	_atomic_cmpxchg_order(_ptr, _old, _new, __ATOMIC_SEQ_CST, \
+			      __ATOMIC_SEQ_CST)
+
+// Set or clear bit `_bit`, returning true if it was previously set.
+#define _atomic_bit_mask(_ptr, _bit) ((typeof((_ptr)->x))1 << (_bit))
+#define _atomic_test_and_set_bit_order(_ptr, _bit, _order)            \
+	((__atomic_fetch_or(&(_ptr)->x, _atomic_bit_mask(_ptr, _bit), \
+			    _order) &                                 \
+	  _atomic_bit_mask(_ptr, _bit)) != 0)
+#define _atomic_test_and_clear_bit_order(_ptr, _bit, _order)            \
+	((__atomic_fetch_and(&(_ptr)->x, ~_atomic_bit_mask(_ptr, _bit), \
+			     _order) &                                  \
+	  _atomic_bit_mask(_ptr, _bit)) != 0)
+#define atomic_test_and_set_bit_relaxed(_ptr, _bit) \
+	_atomic_test_and_set_bit_order(_ptr, _bit, __ATOMIC_RELAXED)
+#define atomic_test_and_set_bit_acquire(_ptr, _bit) \
+	_atomic_test_and_set_bit_order(_ptr, _bit, __ATOMIC_ACQUIRE)
+#define atomic_test_and_set_bit_release(_ptr, _bit) \
+	_atomic_test_and_set_bit_order(_ptr, _bit, __ATOMIC_RELEASE)
+#define atomic_test_and_set_bit_seq_cst(_ptr, _bit) \
+	_atomic_test_and_set_bit_order(_ptr, _bit, __ATOMIC_SEQ_CST)
+#define atomic_test_and_clear_bit_relaxed(_ptr, _bit) \
+	_atomic_test_and_clear_bit_order(_ptr, _bit, __ATOMIC_RELAXED)
+#define atomic_test_and_clear_bit_acquire(_ptr, _bit) \
+	_atomic_test_and_clear_bit_order(_ptr, _bit, __ATOMIC_ACQUIRE)
+#define atomic_test_and_clear_bit_release(_ptr, _bit) \
+	_atomic_test_and_clear_bit_order(_ptr, _bit, __ATOMIC_RELEASE)
+#define atomic_test_and_clear_bit_seq_cst(_ptr, _bit) \
+	_atomic_test_and_clear_bit_order(_ptr, _bit, __ATOMIC_SEQ_CST)
@@ -120,34 +120,185 @@ static inline int64_t bitmap_first_clear(struct bitmap *bitmap)
 	return ret >= bitmap->num_bits ? -1 : ret;
 }
 
-// Find first bit string consisting of `n` consecutive zero bits. Returns index
-// of this bitstring, or -1 if it cannot be found.
-// This is rather a rudimentary approach to this problem but good enough for the
-// primary intended use - finding x (where x easily < 64) consecutive free pages
-// in the early page allocator.
-static inline int bitmap_zero_string_longer_than(struct bitmap *bitmap, int n)
+// Part of the next bit implementation - find the first bit at or after `from`
+// which is set in the bitmap once each word is XOR'd with `invert`, or -1 if
+// there is none.
+static inline int64_t _bitmap_find_next(struct bitmap *bitmap, uint64_t from,
+					uint64_t invert)
 {
-	// TODO: Handle greater than 64 bits.
-	// TODO: Relatedly, allowing overlapping from one
-	//       64-bit word to another.
-
-	if (n > 64)
+	if (from >= bitmap->num_bits)
 		return -1;
 
-	int ret = -1;
+	// Ignore bits below `from` in the first word.
+	uint32_t i = from / 64;
+	uint64_t word = (bitmap->data[i] ^ invert) & ~BIT_MASK_BELOW(from % 64);
+	while (word == 0) {
+		if (++i == bitmap->num_words)
+			return -1;
+		word = bitmap->data[i] ^ invert;
+	}
+
+	// We keep out-of-range bits clear so we need to check to ensure we
+	// don't return an out-of-range index when searching for clear bits.
+	int64_t ret = i * 64 + count_trailing_zeros(word);
+	return ret >= bitmap->num_bits ? -1 : ret;
+}
+
+// Determine the index of the first set bit at or after `from`, or -1 if no
+// bits from that point on are set.
+static inline int64_t bitmap_find_next_set(struct bitmap *bitmap, uint64_t from)
+{
+	return _bitmap_find_next(bitmap, from, 0);
+}
+
+// Determine the index of the first clear bit at or after `from`, or -1 if all
+// bits from that point on are set.
+static inline int64_t bitmap_find_next_clear(struct bitmap *bitmap,
+					     uint64_t from)
+{
+	return _bitmap_find_next(bitmap, from, ~0UL);
+}
+
+// Iterates through each set bit in the bitmap pointed to by `_bitmap`,
+// instantiating a block scope variable called `_bit` containing its index.
+#define for_each_set_bit(_bitmap, _bit)                                     \
+	for (int64_t _bit = bitmap_find_next_set((_bitmap), 0); _bit != -1; \
+	     _bit = bitmap_find_next_set((_bitmap), _bit + 1))
+
+// Part of the range implementation - determine the masks for the first and last
+// words spanned by [start, start + n), where n > 0.
+static inline void _bitmap_range_masks(uint64_t start, uint64_t n,
+				       uint64_t *first_mask,
+				       uint64_t *last_mask)
+{
+	uint64_t end = start + n;
+
+	*first_mask = ~BIT_MASK_BELOW(start % 64);
+	*last_mask = end % 64 == 0 ? ~0UL : BIT_MASK_BELOW(end % 64);
+}
+
+// Set `n` bits starting at `start`, filling whole words at a time.
+static inline void bitmap_set_range(struct bitmap *bitmap, uint64_t start,
+				    uint64_t n)
+{
+	if (n == 0)
+		return;
+
+	uint64_t first_mask, last_mask;
+	_bitmap_range_masks(start, n, &first_mask, &last_mask);
+
+	uint64_t first = start / 64;
+	uint64_t last = (start + n - 1) / 64;
+	if (first == last) {
+		bitmap->data[first] |= first_mask & last_mask;
+		return;
+	}
+
+	bitmap->data[first] |= first_mask;
+	for (uint64_t i = first + 1; i < last; i++) {
+		bitmap->data[i] = ~0UL;
+	}
+	bitmap->data[last] |= last_mask;
+}
+
+// Clear `n` bits starting at `start`, clearing whole words at a time.
+static inline void bitmap_clear_range(struct bitmap *bitmap, uint64_t start,
+				      uint64_t n)
+{
+	if (n == 0)
+		return;
+
+	uint64_t first_mask, last_mask;
+	_bitmap_range_masks(start, n, &first_mask, &last_mask);
+
+	uint64_t first = start / 64;
+	uint64_t last = (start + n - 1) / 64;
+	if (first == last) {
+		bitmap->data[first] &= ~(first_mask & last_mask);
+		return;
+	}
+
+	bitmap->data[first] &= ~first_mask;
+	for (uint64_t i = first + 1; i < last; i++) {
+		bitmap->data[i] = 0;
+	}
+	bitmap->data[last] &= ~last_mask;
+}
+
+// Determine the number of set bits in the bitmap.
+static inline uint64_t bitmap_weight(struct bitmap *bitmap)
+{
+	uint64_t ret = 0;
 	for (uint32_t i = 0; i < bitmap->num_words; i++) {
+		ret += count_set_bits(bitmap->data[i]);
+	}
+
+	return ret;
+}
+
+// Find the first string of `n` consecutive zero bits at or after `from`,
+// returning the index of its first bit, or -1 if it cannot be found.
+//
+// Full words are skipped whole. At word boundaries we extend the current run by
+// the trailing zero bits of the word and start a new run from its leading zero
+// bits, so runs of any length spanning any number of words are found.
+static inline int64_t bitmap_zero_run(struct bitmap *bitmap, uint64_t from,
+				      uint64_t n)
+{
+	if (n == 0 || from >= bitmap->num_bits)
+		return -1;
+
+	int64_t ret = -1;
+	uint64_t run_start = from;
+	uint64_t run_len = 0;
+	for (uint32_t i = from / 64; i < bitmap->num_words; i++) {
 		uint64_t word = bitmap->data[i];
 
-		int index = find_bitstring_longer_than(~word, n);
-		if (index > 0) {
-			ret = i * 64 + index;
+		// Treat bits below `from` in the first word as set.
+		if (i == from / 64)
+			word |= BIT_MASK_BELOW(from % 64);
+
+		if (word == ~0UL) {
+			run_len = 0;
+			continue;
+		}
+
+		// Extend the current run by the trailing zero bits.
+		uint64_t trailing = count_trailing_zeros(word);
+		if (run_len == 0)
+			run_start = i * 64;
+		run_len += trailing;
+		if (run_len >= n) {
+			ret = run_start;
 			break;
 		}
+		if (word == 0)
+			continue;
+
+		// The run might lie entirely within this word.
+		if (n < 64) {
+			int index = find_bitstring_longer_than(~word, n);
+
+			if (index != -1) {
+				ret = i * 64 + index;
+				break;
+			}
+		}
+
+		// Start a new run from the leading zero bits.
+		run_len = count_leading_zeros(word);
+		run_start = i * 64 + 64 - run_len;
 	}
 
 	// We keep out-of-range bits clear so we need to check to ensure we
-	// don't return an out-of-range index. We can be out of range both at
-	// the start of the range or at the end.
-	int num_bits = bitmap->num_bits;
-	return ret >= num_bits || ret + n > num_bits ? -1 : ret;
+	// don't return a string extending beyond the end of the bitmap.
+	return ret == -1 || ret + n > bitmap->num_bits ? -1 : ret;
+}
+
+// Find first bit string consisting of `n` consecutive zero bits. Returns index
+// of this bitstring, or -1 if it cannot be found.
+static inline int64_t bitmap_zero_string_longer_than(struct bitmap *bitmap,
+						     uint64_t n)
+{
+	return bitmap_zero_run(bitmap, 0, n);
 }
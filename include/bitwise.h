@@ -21,3 +21,17 @@ static inline int find_bitstring_longer_than(uint64_t x, int n)
 	int ret = find_first_set_bit(x);
 	return ret < 0 ? -1 : ret - n + 1;
 }
+
+// Count the number of set bits in `x`.
+//
+// We can't rely on the popcnt instruction being available nor link against
+// libgcc's implementation, so this is adapted from figure 5-2 in Hacker's
+// Delight 2nd edition by H. S. Warren Jr, page 82.
+static inline uint64_t count_set_bits(uint64_t x)
+{
+	x = x - ((x >> 1) & 0x5555555555555555UL);
+	x = (x & 0x3333333333333333UL) + ((x >> 2) & 0x3333333333333333UL);
+	x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+
+	return (x * 0x0101010101010101UL) >> 56;
+}
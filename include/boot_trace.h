@@ -0,0 +1,40 @@
+#pragma once
+
+#include "types.h"
+
+// The boot tracer records the TSC at boot phase boundaries so we can determine
+// where boot time goes. Recording is cheap and needs no allocator or log, so
+// it can be used from the very start of early boot. Output is deferred until
+// the kernel log is available.
+
+// Maximum number of boot phases which can be traced, further phases are
+// dropped.
+#define BOOT_TRACE_MAX_PHASES (32)
+
+// Represents a single traced boot phase.
+struct boot_trace_phase {
+	const char *name;
+	// TSC at the end of the phase. The phase began at the end of the
+	// previous one, or at boot_trace_start() for the first.
+	uint64_t end_tsc;
+};
+
+// Record the TSC at which tracing begins, i.e. the start of the first phase.
+void boot_trace_start(void);
+
+// Record the end of the boot phase named `name`, which must be a string literal
+// or otherwise outlive the trace.
+void boot_trace_phase(const char *name);
+
+// Obtain traced phases in order, placing the TSC at which tracing began in
+// `*start_tsc` and the number of phases in `*num_phases`.
+const struct boot_trace_phase *boot_trace_phases(uint64_t *start_tsc,
+						 uint64_t *num_phases);
+
+// Output a per-phase breakdown of boot time to the kernel log.
+void boot_trace_log(void);
+
+// Output the trace to the kernel log in a machine-readable form, one line per
+// phase of the form `boot_trace: <index> <name> <cycles>`, so boot time can be
+// tracked across builds.
+void boot_trace_log_raw(void);
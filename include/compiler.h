@@ -9,8 +9,17 @@
 #define PRINTF(__string_idx, __first_check_idx) \
 	__attribute__((format(printf, (__string_idx), (__first_check_idx))))
 #define NORETURN __attribute__((noreturn))
+#define NOINLINE __attribute__((noinline))
+#define COLD __attribute__((cold))
 
+// Branch prediction hints.
+#define likely(_expr) __builtin_expect(!!(_expr), 1)
+#define unlikely(_expr) __builtin_expect(!!(_expr), 0)
+
+// C++ provides static_assert as a keyword.
+#ifndef __cplusplus
 #define static_assert _Static_assert
+#endif
 
 // Since parameters get put in registers we need help from the compiler to
 // sanely handle variadic arguments.
@@ -18,16 +27,32 @@
 #define va_end(_list) __builtin_va_end(_list)
 #define va_arg(_list, _type) __builtin_va_arg(_list, _type)
 
-// Wrappers around atomic functions.
+// Wrappers around atomic functions for plain memory which cannot be an
+// atomic_t/atomic64_t, namely page table entries (which are read and written
+// by hardware), published pointers such as RCU-protected and list pointers,
+// sub-word fields of lock words and queue nodes, and fields of lock-protected
+// structures which are read individually without the lock. Everything else
+// should use the API in atomic.h.
 #define _atomic_load_relaxed(_ptr) __atomic_load_n(_ptr, __ATOMIC_RELAXED)
-#define _atomic_exchange_acquire(_ptr, _val) \
-	__atomic_exchange_n(_ptr, _val, __ATOMIC_ACQUIRE)
+#define _atomic_load_acquire(_ptr) __atomic_load_n(_ptr, __ATOMIC_ACQUIRE)
+#define _atomic_store_relaxed(_ptr, _val) \
+	__atomic_store_n(_ptr, _val, __ATOMIC_RELAXED)
 #define _atomic_store_release(_ptr, _val) \
 	__atomic_store_n(_ptr, _val, __ATOMIC_RELEASE)
+#define _atomic_exchange(_ptr, _val) \
+	__atomic_exchange_n(_ptr, _val, __ATOMIC_SEQ_CST)
+#define _atomic_fetch_and(_ptr, _val) \
+	__atomic_fetch_and(_ptr, _val, __ATOMIC_SEQ_CST)
+#define _atomic_compare_exchange_release(_ptr, _expected_ptr, _val)   \
+	__atomic_compare_exchange_n(_ptr, _expected_ptr, _val, false, \
+				    __ATOMIC_RELEASE, __ATOMIC_RELAXED)
 
 // Emits a full memory fence.
 #define memory_fence() __sync_synchronize()
 
+// Prevents the compiler from reordering memory accesses across this point.
+#define barrier() asm volatile("" : : : "memory")
+
 // Hint to the CPU that we're spin-waiting.
 #define hint_spinwait() __builtin_ia32_pause()
 
@@ -44,6 +69,20 @@ static inline int64_t find_first_clear_bit(uint64_t x)
 	return find_first_set_bit(~x);
 }
 
+// Returns the number of trailing (least significant) zero bits in x, or 64 if
+// x is 0.
+static inline int64_t count_trailing_zeros(uint64_t x)
+{
+	return x == 0 ? 64 : __builtin_ctzl(x);
+}
+
+// Returns the number of leading (most significant) zero bits in x, or 64 if x
+// is 0.
+static inline int64_t count_leading_zeros(uint64_t x)
+{
+	return x == 0 ? 64 : __builtin_clzl(x);
+}
+
 // Determines the offset of `_member` within aggregate `_type`.
 #ifndef offsetof
 #define offsetof(_type, _member) __builtin_offsetof(_type, _member)
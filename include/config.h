@@ -12,6 +12,14 @@
 // image we can load.
 #define CONFIG_BOOTLOADER_BIOS
 
+// Output the boot trace in a machine-readable form as well as a human-readable
+// one, for tracking boot time across builds.
+//#define CONFIG_BOOT_TRACE_RAW
+
+// Instrument spinlocks to gather lock contention statistics, output at the end
+// of boot. See include/lockstat.h.
+//#define CONFIG_LOCKSTAT
+
 #if defined(CONFIG_BOOTLOADER_ATA_PIO) && defined(CONFIG_BOOTLOADER_BIOS)
 #error CONFIG_BOOTLOADER_ATA_PIO and CONFIG_BOOTLOADER_BIOS are mutually exclusive!
 #endif
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "atomic.h"
+#include "compiler.h"
+#include "macros.h"
+#include "types.h"
+
+// Represents a set of CPUs, one bit per CPU. Snapshots obtained via
+// cpumask_read() are private copies and may be manipulated directly.
+typedef struct {
+	atomic64_t bits;
+} cpumask_t;
+
+// Atomically add the specified CPU to the mask.
+static inline void cpumask_set(cpumask_t *mask, uint32_t cpu)
+{
+	atomic_fetch_or_seq_cst(&mask->bits, 1UL << cpu);
+}
+
+// Atomically remove the specified CPU from the mask.
+static inline void cpumask_clear(cpumask_t *mask, uint32_t cpu)
+{
+	atomic_fetch_and_seq_cst(&mask->bits, ~(1UL << cpu));
+}
+
+// Obtain a snapshot of the mask.
+static inline cpumask_t cpumask_read(cpumask_t *mask)
+{
+	cpumask_t ret = {{atomic_load_acquire(&mask->bits)}};
+	return ret;
+}
+
+// Determine whether the specified CPU is in the mask.
+static inline bool cpumask_test(cpumask_t *mask, uint32_t cpu)
+{
+	return IS_BIT_SET(cpumask_read(mask).bits.x, cpu);
+}
+
+// Determine whether the mask contains no CPUs.
+static inline bool cpumask_empty(cpumask_t *mask)
+{
+	return cpumask_read(mask).bits.x == 0;
+}
+
+// Determine the number of CPUs in the mask.
+static inline uint32_t cpumask_weight(cpumask_t *mask)
+{
+	uint32_t count = 0;
+	for (uint64_t bits = cpumask_read(mask).bits.x; bits != 0;
+	     bits &= bits - 1) {
+		count++;
+	}
+	return count;
+}
+
+// Iterate through each CPU in a mask snapshot `_mask`, assigning each to `_cpu`.
+#define for_each_cpu_in_mask(_cpu, _mask)                                \
+	for (uint64_t __bits = (_mask).bits.x;                           \
+	     __bits != 0 && ((_cpu) = find_first_set_bit(__bits), true); \
+	     __bits &= __bits - 1)
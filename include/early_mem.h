@@ -69,6 +69,13 @@ struct early_page_alloc_span {
 	struct bitmap *ephemeral_bitmap;
 	struct bitmap *pagetable_bitmap;
 	struct bitmap *physblock_bitmap;
+	// Summary bitmap with one bit per alloc_bitmap word, set if every page
+	// tracked by that word is allocated.
+	struct bitmap *full_bitmap;
+	// Next-fit cursor at which to start searching for a free page. Freeing
+	// moves it back so no page below it is ever free, meaning allocation
+	// still returns the lowest free page.
+	uint64_t next_offset;
 };
 
 // Represents the state of the early page allocator. All non-ephemeral allocated
@@ -165,17 +172,16 @@ void early_page_alloc_at(physaddr_t pa);
 physaddr_t early_page_alloc(void);
 
 // Allocate `pages` number of physically contiguous pages. They will NOT be
-// zeroed. Maximum number of pages is 64 due to limitations in the
-// implementation.
-physaddr_t early_pages_alloc(int pages);
+// zeroed.
+physaddr_t early_pages_alloc(uint64_t pages);
 
 // Allocate `pages` number of physically contiguous pages and zeroes them.
-static inline physaddr_t early_pages_alloc_zero(int pages)
+static inline physaddr_t early_pages_alloc_zero(uint64_t pages)
 {
 	physaddr_t pa = early_pages_alloc(pages);
 
 	physaddr_t curr = pa;
-	for (int i = 0; i < pages; i++, curr = phys_next_page(curr)) {
+	for (uint64_t i = 0; i < pages; i++, curr = phys_next_page(curr)) {
 		zero_page(curr);
 	}
 	return pa;
@@ -198,6 +204,12 @@ physaddr_t early_pagetable_alloc(void);
 // be zeroed.
 physaddr_t early_physblock_page_alloc(void);
 
+// Allocate `num_pages` physically contiguous pages aligned to `num_pages` pages
+// intended to be used for physblock metadata, placing the address in
+// `*pa_out`. They WILL be zeroed. Returns false if no such range is available.
+bool early_physblock_pages_alloc_aligned(uint64_t num_pages,
+					 physaddr_t *pa_out);
+
 // Allocates an ephemeral physical page from the early page allocator (will be
 // discared when switching to the full fat physical allocator). It will NOT be
 // zeroed.
@@ -218,7 +230,8 @@ struct early_page_alloc_state *early_get_page_alloc_state(void);
 // Map kernel ELF into memory using the specific ELF header (it is assumed the
 // pointer points to beginning of the ELF) mapping num_pages into memory and
 // being careful to map readonly sections as readonly, data sections as NX and
-// executable sections as non-NX.
+// executable sections as non-NX. Readonly sections placed on 2 MiB boundaries
+// (see kernel/kernel-2mib.ld) are mapped using 2 MiB pages.
 void early_map_kernel_elf(struct elf_header *header, physaddr_t pa,
 			  pgdaddr_t pgd);
 
@@ -2,7 +2,7 @@
 
 #include "log.h"
 #include "page.h"
-#include "spinlock.h"
+#include "seqlock.h"
 
 // Represents which stage the kernel is currently at and therefore what
 // facilities are available.
@@ -14,13 +14,14 @@ enum kernel_stage {
 	KERNEL_STAGE_5_LOADED = 5,
 };
 
-// Represents global kernel state.
+// Represents global kernel state. This is read far more often than it is
+// written, so is protected by a sequence lock.
 struct kernel_global {
 	enum kernel_stage stage;
 	bool log_echo; // Echo kernel ring buffer output?
 	log_flags_t log_level;
 
-	spinlock_t lock;
+	seqlock_t lock;
 };
 static_assert(sizeof(struct kernel_global) < PAGE_SIZE);
 
@@ -28,15 +29,35 @@ static_assert(sizeof(struct kernel_global) < PAGE_SIZE);
 // memory.
 void global_init(void *ptr);
 
-// Retrieve global kernel state, acquiring a spinlock on it.
-struct kernel_global *global_get_locked(void);
+// Retrieve global kernel state for reading. Fields must be read within a
+// read_seqbegin()/read_seqretry() section on `lock`, or individually using a
+// single atomic load where a consistent snapshot is not required.
+const struct kernel_global *global_get(void);
 
-// Retrieve the kernel stage from global state acquiring & releasing the global
-// state lock.
+// Retrieve global kernel state, acquiring its sequence lock for writing with
+// interrupts disabled as global state may be read from interrupt context. The
+// previous interrupt state is returned in `*irq_flags`.
+struct kernel_global *global_get_locked(uint64_t *irq_flags);
+
+// Release the global kernel state sequence lock acquired by
+// global_get_locked(), restoring the interrupt state it returned.
+static inline void global_release(struct kernel_global *global,
+				  uint64_t irq_flags)
+{
+	write_sequnlock_irqrestore(&global->lock, irq_flags);
+}
+
+// Retrieve the kernel stage from global state without taking any lock.
 static inline enum kernel_stage global_get_stage(void)
 {
-	struct kernel_global *global = global_get_locked();
-	enum kernel_stage stage = global->stage;
-	spinlock_release(&global->lock);
+	const struct kernel_global *global = global_get();
+	enum kernel_stage stage;
+	uint64_t seq;
+
+	do {
+		seq = read_seqbegin(&global->lock);
+		stage = global->stage;
+	} while (read_seqretry(&global->lock, seq));
+
 	return stage;
 }
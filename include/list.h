@@ -3,6 +3,7 @@
 #include "compiler.h"
 #include "consts.h"
 #include "macros.h"
+#include "rcu.h"
 #include "types.h"
 
 // This implementation obviously bears some resemblance to the linux linked list
@@ -93,6 +94,18 @@ static inline bool list_empty(struct list *list)
 	     _elem = list_node_element(_tmp, typeof(*_elem), _member),         \
 	    _tmp = _tmp->next)
 
+// Iterates through each element in an RCU-protected list pointed to by
+// `_list_ptr`, using element variable `_elem` with list_node member in each
+// element `_member`. The list may be modified concurrently by the list_*_rcu()
+// functions.
+// ASSUMES: We are in an RCU read-side critical section.
+#define for_each_list_element_rcu(_list_ptr, _elem, _member)                 \
+	for (_elem = list_node_element(rcu_dereference((_list_ptr)->first), \
+				       typeof(*_elem), _member);            \
+	     &_elem->_member != (struct list_node *)(_list_ptr);            \
+	     _elem = list_node_element(rcu_dereference(_elem->_member.next), \
+				       typeof(*_elem), _member))
+
 // Insert node `it` before `node`.
 static inline void list_node_insert_before(struct list_node *node,
 					   struct list_node *it)
@@ -160,3 +173,51 @@ static inline uint64_t list_count(struct list *list)
 
 	return ret;
 }
+
+// Insert node `it` after `node` in an RCU-protected list. `it` is fully linked
+// before it is published, so concurrent readers see either the old or the new
+// list.
+// ASSUMES: Updates to the list are serialised.
+static inline void list_node_insert_after_rcu(struct list_node *node,
+					      struct list_node *it)
+{
+	struct list_node *next = node->next;
+
+	it->prev = node;
+	it->next = next;
+	rcu_assign_pointer(node->next, it);
+	next->prev = it;
+}
+
+// Insert node `it` before `node` in an RCU-protected list.
+// ASSUMES: Updates to the list are serialised.
+static inline void list_node_insert_before_rcu(struct list_node *node,
+					       struct list_node *it)
+{
+	list_node_insert_after_rcu(node->prev, it);
+}
+
+// Remove node from an RCU-protected list. Unlike list_detach() the node's
+// pointers are left intact so concurrent readers positioned at it can continue
+// traversing the list. The node must not be reused or freed until a grace
+// period has elapsed, see synchronize_rcu() and call_rcu().
+// ASSUMES: Updates to the list are serialised.
+static inline void list_detach_rcu(struct list_node *node)
+{
+	_atomic_store_relaxed(&node->prev->next, node->next);
+	node->next->prev = node->prev;
+}
+
+// Insert node `it` at end of an RCU-protected list.
+// ASSUMES: Updates to the list are serialised.
+static inline void list_push_back_rcu(struct list *list, struct list_node *it)
+{
+	list_node_insert_before_rcu((struct list_node *)list, it);
+}
+
+// Insert node `it` at front of an RCU-protected list.
+// ASSUMES: Updates to the list are serialised.
+static inline void list_push_front_rcu(struct list *list, struct list_node *it)
+{
+	list_node_insert_after_rcu((struct list_node *)list, it);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "atomic.h"
+#include "compiler.h"
+#include "spinlock.h"
+#include "types.h"
+
+// Lock contention statistics, inspired by linux's lockstat. Enabled by
+// CONFIG_LOCKSTAT (see include/config.h), in which case spinlock_acquire() and
+// spinlock_release() are instrumented (see spinlock.h). When disabled nothing
+// is instrumented and these functions are simply never called.
+//
+// Statistics are kept per lock class. Each call site of spinlock_acquire()
+// has its own class named after the lock expression, and classes with the
+// same name and file are merged on output, so e.g. all acquisitions of
+// `&block->lock` via pfn_to_physblock_lock() are reported together.
+
+// The maximum number of distinct classes output by lockstat_log(), further
+// classes are dropped.
+#define LOCKSTAT_MAX_CLASSES (64)
+
+// The maximum number of instrumented locks a CPU can hold at once. Hold times
+// of further nested locks are not recorded.
+#define LOCKSTAT_MAX_HELD (16)
+
+// Represents statistics for a lock class. All cycle counts are TSC cycles.
+struct lockstat_class {
+	const char *name;
+	const char *file;
+
+	// Classes are linked into a global list on first acquisition.
+	struct lockstat_class *next;
+	atomic_t registered;
+
+	atomic64_t acquisitions;
+	// Acquisitions which found the lock held and had to wait.
+	atomic64_t contended;
+	atomic64_t wait_cycles;
+	atomic64_t max_wait_cycles;
+	atomic64_t hold_cycles;
+	atomic64_t max_hold_cycles;
+};
+
+// Static initialiser for a lock class.
+#define LOCKSTAT_CLASS_INIT(_name)          \
+	{                                   \
+		.name = _name, .file = __FILE__ \
+	}
+
+// Acquire `lock`, recording statistics against `class`.
+void lockstat_acquire(spinlock_t *lock, struct lockstat_class *class);
+
+// Record the hold time of `lock`, which is about to be released. Noop if it
+// was not acquired via lockstat_acquire().
+void lockstat_release(spinlock_t *lock);
+
+// Obtain the head of the list of classes acquired at least once, linked by
+// `next`. Classes are not merged.
+struct lockstat_class *lockstat_classes(void);
+
+// Output statistics to the kernel log, one line per merged class, in
+// descending order of total wait cycles.
+void lockstat_log(void);
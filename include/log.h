@@ -1,11 +1,19 @@
 #pragma once
 
+#include "atomic.h"
 #include "compiler.h"
-#include "spinlock.h"
+#include "cpu.h"
 #include "types.h"
 
-#define KERNEL_LOG_MAX_NUM_ENTRIES (1023)
-#define KERNEL_LOG_BUF_SIZE (500)
+// The kernel log consists of a ring buffer per CPU, each written only by its
+// own CPU without taking any lock, so logging does not contend across CPUs.
+// Each entry is stamped with a global sequence number and readers merge the
+// rings in sequence order, see kernel_log_read().
+
+// The number of entries in each CPU's ring buffer, must be a power of two.
+#define KERNEL_LOG_RING_NUM_ENTRIES (128)
+#define KERNEL_LOG_RING_MASK (KERNEL_LOG_RING_NUM_ENTRIES - 1)
+#define KERNEL_LOG_BUF_SIZE (492)
 
 // Flags describing kernel log flags, specifically log level of an entry.
 typedef enum {
@@ -22,25 +30,46 @@ static_assert(sizeof(log_flags_t) == sizeof(uint32_t));
 
 // Represents a kernel log entry. These are all fixed sized.
 struct kernel_log_entry {
+	// Global sequence number, starting at 1. 0 while the entry is being
+	// written.
+	atomic64_t seq;
+	// TSC at the time of logging.
 	uint64_t timestamp;
 	log_flags_t flags;
 	char buf[KERNEL_LOG_BUF_SIZE];
 };
 static_assert(sizeof(struct kernel_log_entry) == 512);
 
-// Represents kernel log entries contained within a ring buffer.
-struct kernel_log_state {
-	uint64_t num_entries;
-	uint64_t read_offset, write_offset;
-	spinlock_t lock;
-	struct kernel_log_entry entries[];
+// Represents a CPU's kernel log ring buffer. The head is kept separately so
+// the ring is a power of two in size and wastes nothing when allocated.
+struct kernel_log_ring {
+	struct kernel_log_entry entries[KERNEL_LOG_RING_NUM_ENTRIES];
+};
+static_assert((KERNEL_LOG_RING_NUM_ENTRIES & KERNEL_LOG_RING_MASK) == 0);
+
+// Represents the position of a reader in each CPU's ring buffer.
+struct kernel_log_reader {
+	uint64_t pos[MAX_CPUS];
 };
 
-// Initialise kernel log state.
+// Initialise kernel log state and this CPU's ring buffer. Prior to this, log
+// entries are only echoed.
 void kernel_log_init(void);
 
-// Retrieve kernel log state and acquire lock.
-struct kernel_log_state *kernel_log_get_state_lock(void);
+// Allocate the ring buffer of the CPU we are executing on, if not already
+// allocated. Must be called by each CPU as it is brought up, prior to which
+// entries it logs are only echoed.
+void kernel_log_init_cpu(void);
+
+// Initialise `reader` to read from the oldest entries still retained.
+void kernel_log_reader_init(struct kernel_log_reader *reader);
+
+// Copy the next entry into `entry`, returning false if there are none. Entries
+// are returned in sequence order, except that an entry still being written is
+// skipped until it is complete and so may be returned after entries with
+// higher sequence numbers. Entries overwritten before they are read are lost.
+bool kernel_log_read(struct kernel_log_reader *reader,
+		     struct kernel_log_entry *entry);
 
 // Add kernel log entry to kernel ring buffer.
 void PRINTF(2, 0) log_vprintf(log_flags_t flags, const char *fmt, va_list ap);
@@ -11,6 +11,7 @@
 #include "list.h"
 #include "mm_defs.h"
 #include "page.h"
+#include "seqlock.h"
 #include "spinlock.h"
 #include "types.h"
 
@@ -56,7 +57,18 @@ struct physblock {
 
 	physblock_type_t type;
 
-	struct list_node node;
+	union {
+		// Free blocks are linked into the free list for their order.
+		struct list_node node;
+		// Page table pages track the number of present entries they
+		// contain so they can be freed once empty. These and the page
+		// table entries are protected by the page table lock rather
+		// than `lock`.
+		struct {
+			uint16_t num_entries;
+			spinlock_t lock;
+		} pagetable;
+	};
 
 	uint32_t refcount;
 	spinlock_t lock; // All fields are protected by this lock.
@@ -96,7 +108,10 @@ struct phys_alloc_span {
 // Represents physical allocator state.
 struct phys_alloc_state {
 	struct list free_lists[MAX_ORDER + 1];
+	// Writers hold `lock` and update `stats_seq` so stats can be read
+	// without contending with allocations, see phys_get_stats().
 	struct phys_alloc_stats stats;
+	seqcount_t stats_seq;
 
 	spinlock_t lock;
 
@@ -194,6 +209,10 @@ void phys_alloc_init_state(void *ptr, struct early_page_alloc_state *early_state
 // Gets the physical allocator state, with a lock acquired.
 struct phys_alloc_state *phys_get_alloc_state_lock(void);
 
+// Take a consistent snapshot of physical allocator statistics without
+// acquiring the allocator lock.
+void phys_get_stats(struct phys_alloc_stats *stats);
+
 // Decrements reference count for specified physical page, if it reaches zero
 // the page is freed.
 void phys_free_pfn(pfn_t pfn);
@@ -205,6 +224,22 @@ static inline void phys_free(physaddr_t pa)
 	phys_free_pfn(phys_to_pfn(pa));
 }
 
+// Determine whether the physical page at `pa` belongs to an allocated
+// physblock, that is its lifetime is governed by its reference count.
+bool phys_is_refcounted(physaddr_t pa);
+
+// Increment the reference count of each physblock comprising
+// [pa, pa + num_pages).
+void phys_get_range(physaddr_t pa, uint64_t num_pages);
+
+// Decrement the reference count of each physblock comprising
+// [pa, pa + num_pages), freeing those which reach zero.
+void phys_put_range(physaddr_t pa, uint64_t num_pages);
+
+// Determine whether each physblock comprising [pa, pa + num_pages) has a single
+// reference.
+bool phys_range_exclusive(physaddr_t pa, uint64_t num_pages);
+
 // Actually initialise the full-fat physical memory allocator.
 void phys_alloc_init(void);
 
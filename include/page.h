@@ -153,6 +153,11 @@
 #define PAGE_FLAG_PSE X86_PAGE_FLAG_PSE
 #define PAGE_FLAG_GLOBAL X86_PAGE_FLAG_GLOBAL
 #define PAGE_FLAG_NX X86_PAGE_FLAG_NX
+// Software page flags:
+// Set on read-only data page entries shared by address space duplication, the
+// page is copied (or made writable if no longer shared) on write fault.
+#define PAGE_FLAG_COW_BIT X86_PAGE_FLAG_AVAIL_BIT
+#define PAGE_FLAG_COW X86_PAGE_FLAG_AVAIL
 // Aggregated page flags:
 #define PAGE_FLAG_DEFAULT (PAGE_FLAG_PRESENT | PAGE_FLAG_RW)
 #define PAGE_FLAG_KERNEL (PAGE_FLAG_DEFAULT | PAGE_FLAG_GLOBAL)
@@ -162,6 +167,9 @@
 
 // The number of page table entries for each page table.
 #define NUM_PAGE_TABLE_ENTRIES (512)
+// The first PGD index of the kernel half of the address space. PUDs referenced
+// from here on are shared between all address spaces.
+#define PGD_KERNEL_START_INDEX (NUM_PAGE_TABLE_ENTRIES / 2)
 
 // The number of pages mapped by each page table level.
 #define NUM_PAGES_PTD (512)		    //   2 MiB
@@ -195,6 +203,12 @@ struct page_allocators {
 	ptdaddr_t (*ptd)(void);
 	physaddr_t (*data)(void);
 
+	// Optional. If set, each page table's physblock tracks the number of
+	// present entries it contains and holds a lock protecting them,
+	// allowing concurrent page table walks, and tables which become empty
+	// on unmap are released via this function.
+	void (*free_pagetable)(physaddr_t pa);
+
 	void NORETURN (*panic)(const char *fmt, ...);
 };
 
@@ -653,6 +667,64 @@ uint64_t _map_page_range(pgdaddr_t pgd, virtaddr_t start_va, physaddr_t start_pa
 			 int64_t num_pages, map_flags_t flags,
 			 struct page_allocators *alloc);
 
+// Unmap a range of virtual addresses [start_va, start_va + num_pages) under PGD,
+// skipping any which are not mapped. If `alloc` tracks page table occupancy,
+// page tables which become empty are unlinked from their parent and chained
+// into `*freelist` for release via _free_pagetables() once the TLB has been
+// flushed. Returns the number of page tables chained.
+uint64_t _unmap_page_range(pgdaddr_t pgd, virtaddr_t start_va,
+			   int64_t num_pages, struct page_allocators *alloc,
+			   physaddr_t *freelist);
+
+// Release page tables chained by _unmap_page_range().
+void _free_pagetables(physaddr_t freelist, struct page_allocators *alloc);
+
+// Replace each PTD entirely contained within [start_va, start_va + num_pages)
+// under PGD that maps a 2 MiB-aligned physically contiguous range with uniform
+// flags by a single 2 MiB page, freeing the PTD. Each PTD is unmapped and
+// `flush` invoked with the 2 MiB-aligned VA and `ctx` to flush it from every
+// CPU before the 2 MiB page is installed, so the range must not be accessed by
+// the calling CPU meanwhile. `alloc` must track page table occupancy. Returns
+// the number of PTDs replaced.
+uint64_t _collapse_page_range(pgdaddr_t pgd, virtaddr_t start_va,
+			      int64_t num_pages, struct page_allocators *alloc,
+			      void (*flush)(virtaddr_t va, void *ctx),
+			      void *ctx);
+
+// Copy the kernel half PGD entry for VA from `kernel_pgd` into PGD if it is
+// present in the former but not the latter. Returns true if copied.
+bool _sync_kernel_pgde(pgdaddr_t pgd, pgdaddr_t kernel_pgd, virtaddr_t va,
+		       struct page_allocators *alloc);
+
+// Duplicate the page tables mapping the lower (non-kernel) half of the address
+// space rooted at `src_pgd` into `dst_pgd`, which must have no lower half
+// entries. Data pages backed by physblocks have their reference counts
+// incremented and, where writable, are made read-only and copy-on-write in both.
+// The caller must flush the TLB for `src_pgd`. `alloc` must track page table
+// occupancy. Returns the number of page tables allocated.
+uint64_t _clone_pagetables(pgdaddr_t dst_pgd, pgdaddr_t src_pgd,
+			   struct page_allocators *alloc);
+
+// Break copy-on-write for the data page mapping VA in PGD, copying it if it is
+// still shared or otherwise making it writable in place. Returns false if VA is
+// not mapped copy-on-write. If the page was copied, `*old_pa` is set to the
+// previously mapped page of `*num_pages` pages, the reference to which the
+// caller must drop once the TLB has been flushed, otherwise it is set to 0.
+bool _break_cow(pgdaddr_t pgd, virtaddr_t va, struct page_allocators *alloc,
+		physaddr_t *old_pa, uint64_t *num_pages);
+
+// Atomically clear the accessed flag of the data page entry mapping VA in PGD,
+// returning whether it was set. Returns false if VA is not mapped. The caller
+// must flush the TLB if it needs the CPU to observe the cleared flag.
+bool _test_and_clear_accessed(pgdaddr_t pgd, virtaddr_t va,
+			      struct page_allocators *alloc);
+
+// Walk page tables without locking to find the entry which maps VA in PGD,
+// which is placed in `*entry_out`. Returns the level of the page table
+// containing the entry. If VA is not mapped, the entry is the first non-present
+// one encountered.
+page_level_t _walk_virt(pgdaddr_t pgd, virtaddr_t va, uint64_t *entry_out);
+
 // Walk page tables to retrieve the raw arch page flags for the specified VA in
 // the specified PGD. Use `alloc` to panic.
 uint64_t _walk_virt_to_raw_flags(pgdaddr_t pgd, virtaddr_t va,
@@ -668,3 +740,46 @@ physaddr_t _walk_virt_to_phys(pgdaddr_t pgd, virtaddr_t va,
 // is set are merged with 4 KiB pages for the purposes of dumping ranges.
 void dump_mapped_pages(pgdaddr_t pgd, bool mask_huge_flag,
 		       int (*printf)(const char *fmt, ...));
+
+// Describes a run of virtually contiguous data pages of the same size with the
+// same flags. Records are kept compact so snapshots of whole address spaces can
+// be stored and compared cheaply.
+struct page_snapshot_record {
+	virtaddr_t start;
+	// Raw arch page flags excluding the accessed and dirty flags, which vary
+	// from run to run.
+	uint64_t raw_flags;
+	// Number of pages of the size indicated by `level`.
+	uint32_t num_pages;
+	// The level of the page table containing the entries - PUD for 1 GiB
+	// pages, PMD for 2 MiB pages and PTD for 4 KiB pages.
+	uint8_t level;
+	uint8_t reserved[3];
+};
+static_assert(sizeof(struct page_snapshot_record) == 24);
+
+// Tracks the position of a page table snapshot so it can be resumed.
+struct page_snapshot_iter {
+	pgdaddr_t pgd;
+	// The next VA to examine. This is NOT sign-extended.
+	virtaddr_t va;
+};
+
+// Start a snapshot of the page tables of the specified PGD.
+static inline void page_snapshot_init(struct page_snapshot_iter *iter,
+				      pgdaddr_t pgd)
+{
+	iter->pgd = pgd;
+	iter->va.x = 0;
+}
+
+// Place up to `max_records` (which must be non-zero) records describing the
+// mappings following the last record output into `records`, returning the
+// number placed there. Returns 0 once the snapshot is complete.
+//
+// Records are always maximal, so the output does not depend on `max_records`.
+// Like dump_mapped_pages() the walk is lockless so page tables must not be
+// freed concurrently.
+uint64_t page_snapshot_next(struct page_snapshot_iter *iter,
+			    struct page_snapshot_record *records,
+			    uint64_t max_records);
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "compiler.h"
+#include "types.h"
+
+// Quiescent-state-based read-copy-update (QSBR RCU), see
+// https://lwn.net/Articles/262464/ and
+// https://liburcu.org/ for the QSBR flavour.
+//
+// Readers traverse RCU-protected data without taking any lock or writing to any
+// shared memory. Updaters publish new versions of data with rcu_assign_pointer()
+// and may only free old versions once a grace period has elapsed, that is once
+// every online CPU has passed through a quiescent state - a point at which it
+// holds no references to RCU-protected data.
+//
+// Each CPU reports quiescent states by invoking rcu_quiescent_state(), which
+// must only be done outside of any read-side critical section. As a result
+// read-side critical sections cost nothing at all, but a CPU that fails to
+// report quiescent states will stall grace periods indefinitely.
+
+// Represents a callback to be invoked once a grace period has elapsed, usually
+// embedded in the object to be freed.
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+// Begin a read-side critical section. Under QSBR this only has to prevent the
+// compiler from moving accesses outside of the section.
+static inline void rcu_read_lock(void)
+{
+	barrier();
+}
+
+// End a read-side critical section.
+static inline void rcu_read_unlock(void)
+{
+	barrier();
+}
+
+// Read an RCU-protected pointer for dereferencing within a read-side critical
+// section.
+#define rcu_dereference(_ptr) _atomic_load_acquire(&(_ptr))
+
+// Publish a pointer to RCU-protected data, ordering initialisation of the data
+// before readers can observe the pointer.
+#define rcu_assign_pointer(_ptr, _val) _atomic_store_release(&(_ptr), _val)
+
+// Report that the current CPU is in a quiescent state and process any of its
+// callbacks whose grace period has elapsed.
+// ASSUMES: We are not in a read-side critical section.
+void rcu_quiescent_state(void);
+
+// Wait until a full grace period has elapsed, after which no read-side
+// critical section that began before the call can still be executing.
+// ASSUMES: We are not in a read-side critical section.
+void synchronize_rcu(void);
+
+// Arrange for `func` to be invoked with `head` once a grace period has elapsed.
+// Callbacks are batched so that a single grace period serves all callbacks
+// queued on a CPU since its last grace period started. Callbacks are invoked
+// from rcu_quiescent_state() on the CPU which queued them.
+// ASSUMES: We are not in interrupt context.
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head));
+
+// Determine the number of callbacks queued on the current CPU that have not
+// yet been invoked.
+uint64_t rcu_num_pending_callbacks(void);
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "atomic.h"
+#include "compiler.h"
+#include "types.h"
+
+// Bounded lock-free ring of pointers, along the lines of the DPDK rte_ring, see
+// https://doc.dpdk.org/guides/prog_guide/ring_lib.html
+//
+// The producer and consumer each have a head and a tail index. An enqueue
+// claims slots by advancing the producer head, fills them, then publishes them
+// by advancing the producer tail, and a dequeue does the same with the consumer
+// indices. Indices run freely and are masked to obtain a slot, so capacity must
+// be a power of two.
+//
+// Each side is either single-threaded (_sp/_sc suffix) or may be shared by
+// multiple threads (_mp/_mc suffix), so an SPSC ring uses the _sp and _sc
+// operations, an MPMC ring the _mp and _mc ones and an MPSC ring _mp and _sc.
+// A ring must only ever be used with one variant of each side.
+//
+// Batch operations transfer as many objects as possible up to the number
+// requested and return the number transferred.
+
+// Represents the head and tail indices of one side of a ring, occupying its own
+// cache line so producers and consumers do not contend on the same line.
+struct ring_headtail {
+	// Next index to claim.
+	atomic_t head;
+	// Everything before this index has been published to the other side.
+	atomic_t tail;
+} __attribute__((aligned(64)));
+
+// Represents a ring.
+struct ring {
+	struct ring_headtail prod;
+	struct ring_headtail cons;
+
+	// Written once on initialisation.
+	void **slots;
+	uint32_t capacity;
+	uint32_t mask;
+} __attribute__((aligned(64)));
+
+// Initialise `ring` to use `slots` as storage for `capacity` objects.
+// ASSUMES: `capacity` is a power of two and no larger than 2^31.
+static inline void ring_init(struct ring *ring, void **slots, uint32_t capacity)
+{
+	atomic_store_relaxed(&ring->prod.head, 0);
+	atomic_store_relaxed(&ring->prod.tail, 0);
+	atomic_store_relaxed(&ring->cons.head, 0);
+	atomic_store_relaxed(&ring->cons.tail, 0);
+
+	ring->slots = slots;
+	ring->capacity = capacity;
+	ring->mask = capacity - 1;
+}
+
+// Obtain the number of objects in the ring. Only a snapshot if other threads
+// are accessing the ring.
+static inline uint32_t ring_count(struct ring *ring)
+{
+	uint32_t cons_tail = atomic_load_acquire(&ring->cons.tail);
+	uint32_t prod_tail = atomic_load_acquire(&ring->prod.tail);
+
+	return prod_tail - cons_tail;
+}
+
+// Determine whether the ring is empty. Only a snapshot if other threads are
+// accessing the ring.
+static inline bool ring_empty(struct ring *ring)
+{
+	return ring_count(ring) == 0;
+}
+
+// Determine whether the ring is full. Only a snapshot if other threads are
+// accessing the ring.
+static inline bool ring_full(struct ring *ring)
+{
+	return ring_count(ring) >= ring->capacity;
+}
+
+// Part of the ring implementation - copy `n` objects into the ring starting at
+// index `start`.
+static inline void _ring_copy_in(struct ring *ring, uint32_t start,
+				 void *const *objs, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		ring->slots[(start + i) & ring->mask] = objs[i];
+	}
+}
+
+// Part of the ring implementation - copy `n` objects out of the ring starting
+// at index `start`.
+static inline void _ring_copy_out(struct ring *ring, uint32_t start,
+				  void **objs, uint32_t n)
+{
+	for (uint32_t i = 0; i < n; i++) {
+		objs[i] = ring->slots[(start + i) & ring->mask];
+	}
+}
+
+// Part of the ring implementation - publish the slots in [`start`, `end`) to
+// the other side. Concurrent claimants of earlier slots must publish first, so
+// wait our turn. We acquire their release of the tail so our release carries
+// their slot accesses along with ours to the other side.
+static inline void _ring_publish_mt(struct ring_headtail *ht, uint32_t start,
+				    uint32_t end)
+{
+	while (atomic_load_acquire(&ht->tail) != start) {
+		hint_spinwait();
+	}
+	atomic_store_release(&ht->tail, end);
+}
+
+// Enqueue up to `n` objects from a single producer, returning the number
+// enqueued.
+static inline uint32_t ring_enqueue_batch_sp(struct ring *ring,
+					     void *const *objs, uint32_t n)
+{
+	uint32_t head = atomic_load_relaxed(&ring->prod.head);
+	// Acquire so consumers have finished reading the slots we reuse.
+	uint32_t free = ring->capacity + atomic_load_acquire(&ring->cons.tail) -
+			head;
+
+	if (n > free)
+		n = free;
+	if (n == 0)
+		return 0;
+
+	atomic_store_relaxed(&ring->prod.head, head + n);
+	_ring_copy_in(ring, head, objs, n);
+	atomic_store_release(&ring->prod.tail, head + n);
+
+	return n;
+}
+
+// Enqueue up to `n` objects from one of multiple producers, returning the
+// number enqueued.
+static inline uint32_t ring_enqueue_batch_mp(struct ring *ring,
+					     void *const *objs, uint32_t n)
+{
+	uint32_t head = atomic_load_relaxed(&ring->prod.head);
+	uint32_t next;
+
+	do {
+		// If `head` is stale this may overestimate the free space, but
+		// then claiming the slots fails and we retry.
+		uint32_t free = ring->capacity +
+				atomic_load_acquire(&ring->cons.tail) - head;
+
+		if (n > free)
+			n = free;
+		if (n == 0)
+			return 0;
+
+		next = head + n;
+	} while (!atomic_try_cmpxchg_weak_relaxed(&ring->prod.head, &head,
+						  next));
+
+	_ring_copy_in(ring, head, objs, n);
+	_ring_publish_mt(&ring->prod, head, next);
+
+	return n;
+}
+
+// Dequeue up to `n` objects into `objs` from a single consumer, returning the
+// number dequeued.
+static inline uint32_t ring_dequeue_batch_sc(struct ring *ring, void **objs,
+					     uint32_t n)
+{
+	uint32_t head = atomic_load_relaxed(&ring->cons.head);
+	// Acquire so the producer's writes to the slots are visible.
+	uint32_t entries = atomic_load_acquire(&ring->prod.tail) - head;
+
+	if (n > entries)
+		n = entries;
+	if (n == 0)
+		return 0;
+
+	atomic_store_relaxed(&ring->cons.head, head + n);
+	_ring_copy_out(ring, head, objs, n);
+	atomic_store_release(&ring->cons.tail, head + n);
+
+	return n;
+}
+
+// Dequeue up to `n` objects into `objs` from one of multiple consumers,
+// returning the number dequeued.
+static inline uint32_t ring_dequeue_batch_mc(struct ring *ring, void **objs,
+					     uint32_t n)
+{
+	uint32_t head = atomic_load_relaxed(&ring->cons.head);
+	uint32_t next;
+
+	do {
+		// As for ring_enqueue_batch_mp(), a stale `head` is caught by
+		// the compare-exchange.
+		uint32_t entries = atomic_load_acquire(&ring->prod.tail) - head;
+
+		if (n > entries)
+			n = entries;
+		if (n == 0)
+			return 0;
+
+		next = head + n;
+	} while (!atomic_try_cmpxchg_weak_relaxed(&ring->cons.head, &head,
+						  next));
+
+	_ring_copy_out(ring, head, objs, n);
+	_ring_publish_mt(&ring->cons, head, next);
+
+	return n;
+}
+
+// Enqueue a single object from a single producer, returning false if the ring
+// is full.
+static inline bool ring_enqueue_sp(struct ring *ring, void *obj)
+{
+	return ring_enqueue_batch_sp(ring, &obj, 1) == 1;
+}
+
+// Enqueue a single object from one of multiple producers, returning false if
+// the ring is full.
+static inline bool ring_enqueue_mp(struct ring *ring, void *obj)
+{
+	return ring_enqueue_batch_mp(ring, &obj, 1) == 1;
+}
+
+// Dequeue a single object into `*obj` from a single consumer, returning false
+// if the ring is empty.
+static inline bool ring_dequeue_sc(struct ring *ring, void **obj)
+{
+	return ring_dequeue_batch_sc(ring, obj, 1) == 1;
+}
+
+// Dequeue a single object into `*obj` from one of multiple consumers, returning
+// false if the ring is empty.
+static inline bool ring_dequeue_mc(struct ring *ring, void **obj)
+{
+	return ring_dequeue_batch_mc(ring, obj, 1) == 1;
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "atomic.h"
+#include "compiler.h"
+#include "macros.h"
+#include "types.h"
+
+// Reader-writer spinlock. Any number of readers may hold the lock at once, or a
+// single writer.
+//
+// The lock is a single word containing a writer locked bit, a count of waiting
+// writers and a count of readers. A writer which cannot immediately acquire the
+// lock counts itself as waiting until it does, and no further readers may
+// acquire the lock while any writer is waiting, so a steady stream of readers
+// cannot starve writers. Writers are therefore preferred over readers, though
+// not over one another.
+//
+// As a consequence a reader must never acquire the lock while already holding
+// it, nor from an interrupt handler which may have interrupted a holder on the
+// same CPU. If a writer is waiting the nested acquisition waits for the writer,
+// which waits for the outer reader, and so deadlocks.
+
+#define RWLOCK_WRITER_LOCKED (1)
+#define RWLOCK_WRITER_WAITING_SHIFT (1)
+#define RWLOCK_WRITER_WAITING (1U << RWLOCK_WRITER_WAITING_SHIFT)
+#define RWLOCK_WRITER_WAITING_MASK (0x7fffU << RWLOCK_WRITER_WAITING_SHIFT)
+#define RWLOCK_WRITER_MASK (RWLOCK_WRITER_LOCKED | RWLOCK_WRITER_WAITING_MASK)
+#define RWLOCK_READER_SHIFT (16)
+#define RWLOCK_READER (1U << RWLOCK_READER_SHIFT)
+
+// Represents a reader-writer spinlock object.
+typedef struct {
+	atomic_t val;
+} rwlock_t;
+
+// Simple mechanism for assigning an empty unlocked reader-writer lock.
+static inline rwlock_t empty_rwlock(void)
+{
+	return (rwlock_t){{0}};
+}
+
+// Determine the number of readers holding the lock. Only useful for assertions.
+static inline uint32_t rwlock_num_readers(rwlock_t *lock)
+{
+	return atomic_load_relaxed(&lock->val) >> RWLOCK_READER_SHIFT;
+}
+
+// Determine the number of writers waiting for the lock. Only useful for
+// assertions.
+static inline uint32_t rwlock_num_waiting_writers(rwlock_t *lock)
+{
+	return (atomic_load_relaxed(&lock->val) & RWLOCK_WRITER_WAITING_MASK) >>
+	       RWLOCK_WRITER_WAITING_SHIFT;
+}
+
+// Determine whether a writer holds the lock. Only useful for assertions.
+static inline bool rwlock_is_write_locked(rwlock_t *lock)
+{
+	return IS_MASK_SET(atomic_load_relaxed(&lock->val),
+			   RWLOCK_WRITER_LOCKED);
+}
+
+// Attempt to acquire a reader-writer lock for reading without waiting,
+// returning true if acquired. Fails if a writer holds or is waiting for the
+// lock.
+static inline bool rwlock_try_read_acquire(rwlock_t *lock)
+{
+	uint32_t val = atomic_load_relaxed(&lock->val);
+
+	while ((val & RWLOCK_WRITER_MASK) == 0) {
+		if (atomic_try_cmpxchg_acquire(&lock->val, &val,
+					       val + RWLOCK_READER))
+			return true;
+	}
+
+	return false;
+}
+
+// Acquire a reader-writer lock for reading.
+static inline void rwlock_read_acquire(rwlock_t *lock)
+{
+	while (!rwlock_try_read_acquire(lock)) {
+		// Wait for writers without writing to the lock.
+		while (atomic_load_relaxed(&lock->val) & RWLOCK_WRITER_MASK) {
+			hint_spinwait();
+		}
+	}
+}
+
+// Release a reader-writer lock held for reading.
+static inline void rwlock_read_release(rwlock_t *lock)
+{
+	atomic_fetch_sub_release(&lock->val, RWLOCK_READER);
+}
+
+// Attempt to acquire a reader-writer lock for writing without waiting,
+// returning true if acquired.
+static inline bool rwlock_try_write_acquire(rwlock_t *lock)
+{
+	uint32_t val = atomic_load_relaxed(&lock->val);
+
+	// We may take the lock if it is held by nobody, regardless of whether
+	// other writers are waiting.
+	while ((val & ~RWLOCK_WRITER_WAITING_MASK) == 0) {
+		if (atomic_try_cmpxchg_acquire(&lock->val, &val,
+					       val | RWLOCK_WRITER_LOCKED))
+			return true;
+	}
+
+	return false;
+}
+
+// Acquire a reader-writer lock for writing.
+static inline void rwlock_write_acquire(rwlock_t *lock)
+{
+	if (rwlock_try_write_acquire(lock))
+		return;
+
+	// Block new readers while we wait for existing ones to drain. We
+	// remain counted until we acquire the lock, so readers stay blocked
+	// until every waiting writer has had the lock.
+	uint32_t val = atomic_fetch_add_relaxed(&lock->val,
+						RWLOCK_WRITER_WAITING) +
+		       RWLOCK_WRITER_WAITING;
+
+	for (;;) {
+		if ((val & ~RWLOCK_WRITER_WAITING_MASK) == 0) {
+			if (atomic_try_cmpxchg_acquire(
+				    &lock->val, &val,
+				    (val - RWLOCK_WRITER_WAITING) |
+					    RWLOCK_WRITER_LOCKED))
+				return;
+			continue;
+		}
+
+		hint_spinwait();
+		val = atomic_load_relaxed(&lock->val);
+	}
+}
+
+// Release a reader-writer lock held for writing.
+static inline void rwlock_write_release(rwlock_t *lock)
+{
+	// Leave the waiting count intact so waiting writers retain preference.
+	atomic_fetch_and_release(&lock->val, ~RWLOCK_WRITER_LOCKED);
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "asm.h"
+#include "atomic.h"
+#include "compiler.h"
+#include "spinlock.h"
+#include "types.h"
+
+// Sequence counters and locks, in the manner of linux's seqcount_t/seqlock_t,
+// see https://docs.kernel.org/locking/seqlock.html
+//
+// Writers increment the sequence number before and after each update, so it is
+// odd while an update is in progress. Readers take a snapshot of the protected
+// data between reading the sequence number and checking it is unchanged, and
+// simply retry if it did change. Readers therefore never write to shared cache
+// lines, making these ideal for data which is read frequently and rarely
+// written.
+//
+// Readers may observe torn data inside the read section and so must not act on
+// it (e.g. dereference pointers read from it) until the read is known to be
+// consistent.
+//
+// A reader spins while a write is in progress, so a reader which interrupts a
+// writer on the same CPU never completes. If a sequence lock may be read from
+// interrupt context its writers must use write_seqlock_irqsave().
+
+// Represents a sequence counter. Writers must be serialised by other means.
+typedef struct {
+	atomic64_t sequence;
+} seqcount_t;
+
+// Represents a sequence counter whose writers are serialised by a spinlock.
+typedef struct {
+	seqcount_t seqcount;
+	spinlock_t lock;
+} seqlock_t;
+
+// Simple mechanism for assigning an empty sequence counter.
+static inline seqcount_t empty_seqcount(void)
+{
+	return (seqcount_t){0};
+}
+
+// Simple mechanism for assigning an empty unlocked sequence lock.
+static inline seqlock_t empty_seqlock(void)
+{
+	return (seqlock_t){empty_seqcount(), empty_spinlock()};
+}
+
+// Begin a read section, returning the sequence number to pass to
+// read_seqcount_retry(). Waits for any in-progress write to complete.
+static inline uint64_t read_seqcount_begin(const seqcount_t *seqcount)
+{
+	uint64_t sequence;
+
+	while ((sequence = atomic_load_acquire(&seqcount->sequence)) & 1) {
+		hint_spinwait();
+	}
+
+	return sequence;
+}
+
+// End a read section, returning true if a write occurred since `sequence` was
+// obtained, in which case the read must be retried.
+static inline bool read_seqcount_retry(const seqcount_t *seqcount,
+				       uint64_t sequence)
+{
+	// Order the reads of protected data before the re-read of the
+	// sequence number.
+	smp_rmb();
+	return atomic_load_relaxed(&seqcount->sequence) != sequence;
+}
+
+// Begin a write section.
+// ASSUMES: Writers are serialised.
+static inline void write_seqcount_begin(seqcount_t *seqcount)
+{
+	atomic_store_relaxed(&seqcount->sequence,
+			     atomic_load_relaxed(&seqcount->sequence) + 1);
+	// Order the sequence number update before writes to protected data.
+	smp_wmb();
+}
+
+// End a write section.
+// ASSUMES: Writers are serialised.
+static inline void write_seqcount_end(seqcount_t *seqcount)
+{
+	atomic_store_release(&seqcount->sequence,
+			     atomic_load_relaxed(&seqcount->sequence) + 1);
+}
+
+// Begin a read section on a sequence lock, see read_seqcount_begin().
+static inline uint64_t read_seqbegin(const seqlock_t *seqlock)
+{
+	return read_seqcount_begin(&seqlock->seqcount);
+}
+
+// End a read section on a sequence lock, see read_seqcount_retry().
+static inline bool read_seqretry(const seqlock_t *seqlock, uint64_t sequence)
+{
+	return read_seqcount_retry(&seqlock->seqcount, sequence);
+}
+
+// Acquire a sequence lock for writing.
+static inline void write_seqlock(seqlock_t *seqlock)
+{
+	spinlock_acquire(&seqlock->lock);
+	write_seqcount_begin(&seqlock->seqcount);
+}
+
+// Release a sequence lock held for writing.
+static inline void write_sequnlock(seqlock_t *seqlock)
+{
+	write_seqcount_end(&seqlock->seqcount);
+	spinlock_release(&seqlock->lock);
+}
+
+// Acquire a sequence lock for writing with interrupts disabled, returning the
+// previous interrupt state to pass to write_sequnlock_irqrestore().
+static inline uint64_t write_seqlock_irqsave(seqlock_t *seqlock)
+{
+	uint64_t irq_flags = irq_save();
+
+	write_seqlock(seqlock);
+	return irq_flags;
+}
+
+// Release a sequence lock acquired by write_seqlock_irqsave(), restoring the
+// interrupt state it returned.
+static inline void write_sequnlock_irqrestore(seqlock_t *seqlock,
+					      uint64_t irq_flags)
+{
+	write_sequnlock(seqlock);
+	irq_restore(irq_flags);
+}
@@ -2,21 +2,32 @@
 
 // General convenience header for zeptux kernel functionality.
 
+#include "access_monitor.h"
+#include "address_space.h"
 #include "asm.h"
 #include "bitmap.h"
 #include "bitwise.h"
+#include "boot_trace.h"
+#include "cpu.h"
 #include "elf.h"
 #include "format.h"
 #include "global.h"
 #include "interrupt.h"
 #include "list.h"
+#include "lockstat.h"
 #include "log.h"
 #include "macros.h"
 #include "mm.h"
 #include "page.h"
+#include "percpu.h"
 #include "panic.h"
 #include "range.h"
+#include "rcu.h"
+#include "ring.h"
+#include "rwlock.h"
+#include "seqlock.h"
 #include "spinlock.h"
 #include "string.h"
+#include "tlb.h"
 #include "types.h"
 #include "ver.h"
@@ -0,0 +1,71 @@
+#include "zeptux.h"
+
+static struct boot_trace_state {
+	uint64_t start_tsc;
+	uint64_t num_phases;
+	struct boot_trace_phase phases[BOOT_TRACE_MAX_PHASES];
+} state;
+
+void boot_trace_start(void)
+{
+	state.start_tsc = rdtsc();
+	state.num_phases = 0;
+}
+
+void boot_trace_phase(const char *name)
+{
+	uint64_t tsc = rdtsc();
+
+	if (state.num_phases == BOOT_TRACE_MAX_PHASES)
+		return;
+
+	struct boot_trace_phase *phase = &state.phases[state.num_phases++];
+	phase->name = name;
+	phase->end_tsc = tsc;
+}
+
+const struct boot_trace_phase *boot_trace_phases(uint64_t *start_tsc,
+						 uint64_t *num_phases)
+{
+	*start_tsc = state.start_tsc;
+	*num_phases = state.num_phases;
+	return state.phases;
+}
+
+// Determine the number of cycles spent in the phase at `index`.
+static uint64_t phase_cycles(uint64_t index)
+{
+	uint64_t start = index == 0 ? state.start_tsc
+				    : state.phases[index - 1].end_tsc;
+
+	return state.phases[index].end_tsc - start;
+}
+
+void boot_trace_log(void)
+{
+	if (state.num_phases == 0)
+		return;
+
+	uint64_t total = state.phases[state.num_phases - 1].end_tsc -
+			 state.start_tsc;
+
+	log_info("boot trace (%lu phases, %lu cycles):", state.num_phases,
+		 total);
+	for (uint64_t i = 0; i < state.num_phases; i++) {
+		uint64_t cycles = phase_cycles(i);
+		// Percentage to 1 decimal place.
+		uint64_t permille = total == 0 ? 0 : cycles * 1000 / total;
+
+		log_info("%24s %14lu %3lu.%lu%%", state.phases[i].name, cycles,
+			 permille / 10, permille % 10);
+	}
+	log_info("");
+}
+
+void boot_trace_log_raw(void)
+{
+	for (uint64_t i = 0; i < state.num_phases; i++) {
+		log_info("boot_trace: %lu %s %lu", i, state.phases[i].name,
+			 phase_cycles(i));
+	}
+}
@@ -8,10 +8,16 @@ void global_init(void *ptr)
 	global->stage = KERNEL_STAGE_1_EARLY;
 	global->log_echo = true; // Default to true.
 	global->log_level = KERNEL_LOG_DEBUG;
+	global->lock = empty_seqlock();
 }
 
-struct kernel_global *global_get_locked(void)
+const struct kernel_global *global_get(void)
 {
-	spinlock_acquire(&global->lock);
+	return global;
+}
+
+struct kernel_global *global_get_locked(uint64_t *irq_flags)
+{
+	*irq_flags = write_seqlock_irqsave(&global->lock);
 	return global;
 }
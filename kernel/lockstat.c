@@ -0,0 +1,200 @@
+#include "zeptux.h"
+
+// Represents an instrumented lock held by this CPU.
+struct lockstat_held {
+	spinlock_t *lock;
+	struct lockstat_class *class;
+	uint64_t acquired_tsc;
+};
+
+// Represents the instrumented locks held by this CPU, most recently acquired
+// last. Interrupt handlers push and pop their own entries above ours.
+struct lockstat_held_stack {
+	struct lockstat_held entries[LOCKSTAT_MAX_HELD];
+	uint32_t count;
+};
+
+static DEFINE_PER_CPU(struct lockstat_held_stack, held_stack);
+
+// Classes acquired at least once, pushed locklessly on first acquisition.
+static struct lockstat_class *classes;
+
+// Link `class` into the class list if not already present.
+static void register_class(struct lockstat_class *class)
+{
+	if (atomic_load_relaxed(&class->registered) ||
+	    atomic_exchange_relaxed(&class->registered, 1))
+		return;
+
+	struct lockstat_class *head = _atomic_load_relaxed(&classes);
+	do {
+		class->next = head;
+	} while (!_atomic_compare_exchange_release(&classes, &head, class));
+}
+
+// Atomically raise `*max` to `val` if larger.
+static void update_max(atomic64_t *max, uint64_t val)
+{
+	uint64_t curr = atomic_load_relaxed(max);
+	while (val > curr && !atomic_try_cmpxchg_weak_relaxed(max, &curr, val))
+		;
+}
+
+void lockstat_acquire(spinlock_t *lock, struct lockstat_class *class)
+{
+	register_class(class);
+
+	if (likely(spinlock_try_acquire(lock))) {
+		atomic_fetch_add_relaxed(&class->acquisitions, 1);
+	} else {
+		uint64_t start = rdtsc();
+		_spinlock_acquire_slow(lock);
+		uint64_t wait = rdtsc() - start;
+
+		atomic_fetch_add_relaxed(&class->acquisitions, 1);
+		atomic_fetch_add_relaxed(&class->contended, 1);
+		atomic_fetch_add_relaxed(&class->wait_cycles, wait);
+		update_max(&class->max_wait_cycles, wait);
+	}
+
+	// Claim our slot before filling it so a nested interrupt handler
+	// cannot overwrite it.
+	struct lockstat_held_stack *stack = this_cpu_ptr(held_stack);
+	uint32_t index = stack->count++;
+	if (index >= LOCKSTAT_MAX_HELD)
+		return;
+
+	struct lockstat_held *held = &stack->entries[index];
+	held->lock = lock;
+	held->class = class;
+	held->acquired_tsc = rdtsc();
+}
+
+void lockstat_release(spinlock_t *lock)
+{
+	uint64_t now = rdtsc();
+	struct lockstat_held_stack *stack = this_cpu_ptr(held_stack);
+	uint32_t top = stack->count < LOCKSTAT_MAX_HELD ? stack->count
+						       : LOCKSTAT_MAX_HELD;
+
+	// Locks may be released out of order, so search from the most recently
+	// acquired.
+	for (int64_t i = (int64_t)top - 1; i >= 0; i--) {
+		struct lockstat_held *held = &stack->entries[i];
+
+		if (held->lock != lock)
+			continue;
+
+		uint64_t hold = now - held->acquired_tsc;
+		atomic_fetch_add_relaxed(&held->class->hold_cycles, hold);
+		update_max(&held->class->max_hold_cycles, hold);
+
+		for (uint32_t j = i + 1; j < top; j++) {
+			stack->entries[j - 1] = stack->entries[j];
+		}
+		stack->count--;
+		return;
+	}
+
+	// Locks nested beyond LOCKSTAT_MAX_HELD deep were not recorded, but
+	// still occupy the stack.
+	if (stack->count > LOCKSTAT_MAX_HELD)
+		stack->count--;
+}
+
+struct lockstat_class *lockstat_classes(void)
+{
+	return _atomic_load_acquire(&classes);
+}
+
+// Represents the merged statistics for all classes sharing a name and file.
+struct lockstat_merged {
+	const char *name;
+	const char *file;
+	uint64_t acquisitions, contended;
+	uint64_t wait_cycles, max_wait_cycles;
+	uint64_t hold_cycles, max_hold_cycles;
+};
+
+// Merge `class` into `merged`, which contains `*count` entries, adding a new
+// entry if none matches. Returns false if there is no room to do so.
+static bool merge_class(struct lockstat_merged *merged, uint64_t *count,
+			struct lockstat_class *class)
+{
+	struct lockstat_merged *entry = NULL;
+
+	for (uint64_t i = 0; i < *count; i++) {
+		if (strcmp(merged[i].name, class->name) == 0 &&
+		    strcmp(merged[i].file, class->file) == 0) {
+			entry = &merged[i];
+			break;
+		}
+	}
+
+	if (entry == NULL) {
+		if (*count == LOCKSTAT_MAX_CLASSES)
+			return false;
+
+		entry = &merged[(*count)++];
+		*entry = (struct lockstat_merged){
+			.name = class->name,
+			.file = class->file,
+		};
+	}
+
+	entry->acquisitions += atomic_load_relaxed(&class->acquisitions);
+	entry->contended += atomic_load_relaxed(&class->contended);
+	entry->wait_cycles += atomic_load_relaxed(&class->wait_cycles);
+	uint64_t max_wait = atomic_load_relaxed(&class->max_wait_cycles);
+	if (max_wait > entry->max_wait_cycles)
+		entry->max_wait_cycles = max_wait;
+	entry->hold_cycles += atomic_load_relaxed(&class->hold_cycles);
+	uint64_t max_hold = atomic_load_relaxed(&class->max_hold_cycles);
+	if (max_hold > entry->max_hold_cycles)
+		entry->max_hold_cycles = max_hold;
+
+	return true;
+}
+
+void lockstat_log(void)
+{
+	// Logging acquires locks so may register classes as we iterate, but
+	// these are pushed ahead of the head we start from so are not seen.
+	// Static to keep it off the stack, so not reentrant.
+	static struct lockstat_merged merged[LOCKSTAT_MAX_CLASSES];
+	uint64_t count = 0;
+	uint64_t num_dropped = 0;
+
+	for (struct lockstat_class *class = lockstat_classes(); class != NULL;
+	     class = class->next) {
+		if (!merge_class(merged, &count, class))
+			num_dropped++;
+	}
+
+	// Insertion sort by descending total wait time, there are few entries.
+	for (uint64_t i = 1; i < count; i++) {
+		struct lockstat_merged entry = merged[i];
+		uint64_t j = i;
+
+		for (; j > 0 && merged[j - 1].wait_cycles < entry.wait_cycles;
+		     j--) {
+			merged[j] = merged[j - 1];
+		}
+		merged[j] = entry;
+	}
+
+	log_info("lockstat (%lu classes, cycles):", count);
+	log_info("%28s %10s %10s %14s %12s %14s %12s  %s", "class", "acq",
+		 "contended", "wait", "max wait", "hold", "max hold", "file");
+	for (uint64_t i = 0; i < count; i++) {
+		struct lockstat_merged *entry = &merged[i];
+
+		log_info("%28s %10lu %10lu %14lu %12lu %14lu %12lu  %s",
+			 entry->name, entry->acquisitions, entry->contended,
+			 entry->wait_cycles, entry->max_wait_cycles,
+			 entry->hold_cycles, entry->max_hold_cycles,
+			 entry->file);
+	}
+	if (num_dropped > 0)
+		log_info("lockstat: %lu classes dropped", num_dropped);
+}
@@ -1,40 +1,68 @@
 #include "early_io.h"
 #include "zeptux.h"
 
-static struct kernel_log_state *state;
+// Each CPU's ring buffer, NULL until kernel_log_init_cpu().
+static DEFINE_PER_CPU(struct kernel_log_ring *, log_ring);
+
+// The number of entries each CPU has ever claimed in its ring buffer, the next
+// is written at `log_head` modulo KERNEL_LOG_RING_NUM_ENTRIES.
+static DEFINE_PER_CPU(atomic64_t, log_head);
+
+// The CPUs which have a ring buffer.
+static cpumask_t log_cpus;
+
+// The sequence number most recently assigned to an entry.
+static atomic64_t log_seq;
+
+void kernel_log_init_cpu(void)
+{
+	if (this_cpu_read(log_ring) != NULL)
+		return;
+
+	struct kernel_log_ring *ring =
+		kzalloc(sizeof(struct kernel_log_ring), KMALLOC_KERNEL);
+
+	// Readers only look at CPUs in `log_cpus` so must see the ring first.
+	_atomic_store_release(this_cpu_ptr(log_ring), ring);
+	cpumask_set(&log_cpus, cpu_id());
+}
 
 void kernel_log_init(void)
 {
-	uint64_t bytes =
-		sizeof(struct kernel_log_state) +
-		KERNEL_LOG_MAX_NUM_ENTRIES * sizeof(struct kernel_log_entry);
-	state = kzalloc(bytes, KMALLOC_KERNEL);
+	kernel_log_init_cpu();
 
-	struct kernel_global *global = global_get_locked();
+	uint64_t irq_flags;
+	struct kernel_global *global = global_get_locked(&irq_flags);
 	global->stage = KERNEL_STAGE_2_HAS_RING_BUFFER;
-	spinlock_release(&global->lock);
+	global_release(global, irq_flags);
 }
 
-// Get pointer to next write kernel log entry.
-// ASSUMES: `state->lock` held.
-static struct kernel_log_entry *next_write_entry(void)
+// Claim the next entry in `ring`, marking it as being written, and assign it
+// the next sequence number, returned in `*seq`.
+// ASSUMES: `ring` belongs to this CPU.
+static struct kernel_log_entry *claim_entry(struct kernel_log_ring *ring,
+					    uint64_t *seq)
 {
-	// If we have entries < max, need to increment entry count and write offset.
-	if (state->num_entries < KERNEL_LOG_MAX_NUM_ENTRIES) {
-		state->num_entries++;
-		return &state->entries[state->write_offset++];
-	}
+	// Keep interrupt handlers from logging in between claiming the entry
+	// and assigning its sequence number so each ring is in sequence order.
+	uint64_t irq_flags = irq_save();
 
-	// Otherwise, read and write offset move in lockstep.
+	atomic64_t *headp = this_cpu_ptr(log_head);
+	uint64_t head = atomic_load_relaxed(headp);
+	struct kernel_log_entry *entry =
+		&ring->entries[head & KERNEL_LOG_RING_MASK];
 
-	struct kernel_log_entry *ret = &state->entries[state->write_offset];
+	// Readers which observe the new head must see the entry as being
+	// written, and must not see our writes to it before that.
+	atomic_store_relaxed(&entry->seq, 0);
+	atomic_store_release(headp, head + 1);
+	smp_wmb();
 
-	state->write_offset =
-		(state->write_offset + 1) % KERNEL_LOG_MAX_NUM_ENTRIES;
-	state->read_offset =
-		(state->read_offset + 1) % KERNEL_LOG_MAX_NUM_ENTRIES;
+	*seq = atomic_fetch_add_relaxed(&log_seq, 1) + 1;
 
-	return ret;
+	irq_restore(irq_flags);
+
+	return entry;
 }
 
 // Echo log output if kernel configured to do so.
@@ -53,48 +81,67 @@ static void maybe_echo_log(struct kernel_global *global, log_flags_t flags,
 		panic("Unsupported kernel stage %d", global->stage);
 	}
 
+	const char *prefix = "";
 	switch (flags & KERNEL_LOG_MASK) {
 	case KERNEL_LOG_TRACE:
-		early_printf("TRACE: ");
+		prefix = "TRACE: ";
 		break;
 	case KERNEL_LOG_DEBUG:
-		early_printf("DEBUG: ");
+		prefix = "DEBUG: ";
 		break;
 	case KERNEL_LOG_INFO:
-		early_printf("INFO:  ");
+		prefix = "INFO:  ";
 		break;
 	case KERNEL_LOG_WARN:
-		early_printf("WARN:  ");
+		prefix = "WARN:  ";
 		break;
 	case KERNEL_LOG_ERROR:
-		early_printf("ERROR: ");
+		prefix = "ERROR: ";
 		break;
 	case KERNEL_LOG_CRITICAL:
-		early_printf("CRIT:  ");
+		prefix = "CRIT:  ";
 		break;
 	}
 
-	early_printf("%s\n", buf);
+	// Output the line at once so lines logged from interrupt handlers are
+	// less likely to be interleaved with it.
+	early_printf("%s%s\n", prefix, buf);
 }
 
 void log_vprintf(log_flags_t flags, const char *fmt, va_list ap)
 {
-	spinlock_acquire(&state->lock);
-	struct kernel_global *global = global_get_locked();
+	// Snapshot the global state we need. The fields are independent, so
+	// read each with a single load rather than waiting out a concurrent
+	// writer in a sequence lock read section.
+	const struct kernel_global *global = global_get();
+	struct kernel_global snapshot;
+	snapshot.stage = _atomic_load_relaxed(&global->stage);
+	snapshot.log_echo = _atomic_load_relaxed(&global->log_echo);
+	snapshot.log_level = _atomic_load_relaxed(&global->log_level);
 
 	// Do we need to log?
-	if ((flags & KERNEL_LOG_MASK) < (global->log_level & KERNEL_LOG_MASK))
-		goto done;
+	if ((flags & KERNEL_LOG_MASK) < (snapshot.log_level & KERNEL_LOG_MASK))
+		return;
+
+	struct kernel_log_ring *ring = this_cpu_read(log_ring);
+	// Before kernel_log_init() there is nowhere to record the entry.
+	if (ring == NULL) {
+		char buf[KERNEL_LOG_BUF_SIZE];
+
+		vsnprintf(buf, KERNEL_LOG_BUF_SIZE, fmt, ap);
+		maybe_echo_log(&snapshot, flags, buf);
+		return;
+	}
 
-	struct kernel_log_entry *entry = next_write_entry();
-	// TODO: Add support for timestamps.
+	uint64_t entry_seq;
+	struct kernel_log_entry *entry = claim_entry(ring, &entry_seq);
+	entry->timestamp = rdtsc();
 	entry->flags = flags;
 	vsnprintf(entry->buf, KERNEL_LOG_BUF_SIZE, fmt, ap);
-	maybe_echo_log(global, flags, entry->buf);
+	// Publish the entry to readers.
+	atomic_store_release(&entry->seq, entry_seq);
 
-done:
-	spinlock_release(&global->lock);
-	spinlock_release(&state->lock);
+	maybe_echo_log(&snapshot, flags, entry->buf);
 }
 
 void log_printf(log_flags_t flags, const char *fmt, ...)
@@ -105,3 +152,93 @@ void log_printf(log_flags_t flags, const char *fmt, ...)
 	log_vprintf(flags, fmt, list);
 	va_end(list);
 }
+
+// Determine the number of entries `cpu` has ever claimed in its ring buffer.
+static uint64_t read_head(uint32_t cpu)
+{
+	return atomic_load_acquire(per_cpu_ptr(log_head, cpu));
+}
+
+void kernel_log_reader_init(struct kernel_log_reader *reader)
+{
+	// Positions are advanced to the oldest retained entry on read.
+	for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+		reader->pos[cpu] = 0;
+	}
+}
+
+// Copy the entry at position `pos` of `cpu`'s ring buffer `ring` into `entry`,
+// returning false if it is being written or was overwritten while we copied it.
+static bool copy_entry(struct kernel_log_ring *ring, uint32_t cpu, uint64_t pos,
+		       struct kernel_log_entry *entry)
+{
+	struct kernel_log_entry *src =
+		&ring->entries[pos & KERNEL_LOG_RING_MASK];
+	uint64_t seq = atomic_load_acquire(&src->seq);
+	if (seq == 0)
+		return false;
+
+	entry->timestamp = src->timestamp;
+	entry->flags = src->flags;
+	memcpy(entry->buf, src->buf, KERNEL_LOG_BUF_SIZE);
+
+	// As for a seqlock reader, the entry is consistent only if the sequence
+	// number is unchanged. If the entry was claimed for a later position
+	// before we started, the head will have moved past us.
+	smp_rmb();
+	if (atomic_load_relaxed(&src->seq) != seq)
+		return false;
+	if (read_head(cpu) - pos > KERNEL_LOG_RING_NUM_ENTRIES)
+		return false;
+
+	entry->seq.x = seq;
+	return true;
+}
+
+bool kernel_log_read(struct kernel_log_reader *reader,
+		     struct kernel_log_entry *entry)
+{
+	while (true) {
+		struct kernel_log_ring *next_ring = NULL;
+		uint32_t next_cpu = 0;
+		uint64_t next_seq = 0;
+		uint32_t cpu;
+
+		// Each ring is in sequence order, so the next entry is the
+		// oldest unread entry with the lowest sequence number.
+		for_each_cpu_in_mask(cpu, cpumask_read(&log_cpus)) {
+			struct kernel_log_ring *ring =
+				_atomic_load_acquire(per_cpu_ptr(log_ring, cpu));
+			uint64_t head = read_head(cpu);
+			uint64_t *pos = &reader->pos[cpu];
+
+			// Skip entries which have been overwritten.
+			if (head - *pos > KERNEL_LOG_RING_NUM_ENTRIES)
+				*pos = head - KERNEL_LOG_RING_NUM_ENTRIES;
+			if (*pos == head)
+				continue;
+
+			struct kernel_log_entry *src =
+				&ring->entries[*pos & KERNEL_LOG_RING_MASK];
+			uint64_t seq = atomic_load_relaxed(&src->seq);
+			if (seq == 0)
+				continue;
+
+			if (next_ring == NULL || seq < next_seq) {
+				next_ring = ring;
+				next_cpu = cpu;
+				next_seq = seq;
+			}
+		}
+
+		if (next_ring == NULL)
+			return false;
+
+		// If the entry changed under us, look again.
+		if (copy_entry(next_ring, next_cpu, reader->pos[next_cpu],
+			       entry)) {
+			reader->pos[next_cpu]++;
+			return true;
+		}
+	}
+}
@@ -1,3 +1,4 @@
+#include "config.h"
 #include "zeptux_early.h"
 
 struct version_tuplet zeptux_ver = {.maj = 0, .min = 0, .rev = 0};
@@ -11,6 +12,7 @@ static void prelude(void)
 	log_info("kernel ELF size = %u",
 		 early_get_boot_info()->kernel_elf_size_bytes);
 	log_info("      APIC base = 0x%lx", early_get_boot_info()->apic_base.x);
+	log_info("           PCID = %s", tlb_pcid_enabled() ? "on" : "off");
 	log_info("");
 
 	struct early_boot_info *info = early_get_boot_info();
@@ -42,40 +44,54 @@ static void prelude(void)
 		 info->total_avail_ram_bytes);
 	log_info("");
 
-	struct phys_alloc_state *state = phys_get_alloc_state_lock();
-	struct phys_alloc_stats *stats = &state->stats;
+	struct phys_alloc_stats stats;
+	phys_get_stats(&stats);
 
 	log_info("phys_alloc: total=%lu, pg=%lu, pb=%lu, rest=%lu",
-		 stats->num_4k_pages, stats->num_pagetable_pages,
-		 stats->num_physblock_pages,
-		 stats->num_4k_pages - stats->num_free_4k_pages -
-			 stats->num_pagetable_pages - stats->num_physblock_pages);
+		 stats.num_4k_pages, stats.num_pagetable_pages,
+		 stats.num_physblock_pages,
+		 stats.num_4k_pages - stats.num_free_4k_pages -
+			 stats.num_pagetable_pages - stats.num_physblock_pages);
 
 	char orders_buf[150];
 	const char array_start_str[] = "            [ ";
 	int offset = snprintf(orders_buf, sizeof(orders_buf), array_start_str);
 
 	for (int i = 0; i < MAX_ORDER; i++) {
-		struct phys_alloc_order_stats *order_stats = &stats->order[i];
+		struct phys_alloc_order_stats *order_stats = &stats.order[i];
 
 		offset += snprintf(&orders_buf[offset],
 				   sizeof(orders_buf) - offset, "%lu, ",
 				   order_stats->num_free_pages);
 	}
-	log_info("%s%lu ]", orders_buf, stats->order[MAX_ORDER].num_free_pages);
-	spinlock_release(&state->lock);
+	log_info("%s%lu ]", orders_buf, stats.order[MAX_ORDER].num_free_pages);
 }
 
 void main(void)
 {
 	early_init();
 	phys_alloc_init();
+	boot_trace_phase("phys_alloc_init");
+	percpu_init();
+	boot_trace_phase("percpu_init");
 	kernel_log_init();
+	boot_trace_phase("kernel_log_init");
 	interrupt_init();
+	boot_trace_phase("interrupt_init");
+	tlb_init();
+	boot_trace_phase("tlb_init");
 
 	prelude();
-
-	// We never exit.
+	boot_trace_log();
+#ifdef CONFIG_BOOT_TRACE_RAW
+	boot_trace_log_raw();
+#endif
+#ifdef CONFIG_LOCKSTAT
+	lockstat_log();
+#endif
+
+	// We never exit. The idle loop holds no references to RCU-protected
+	// data so is always a quiescent state.
 	while (true)
-		;
+		rcu_quiescent_state();
 }
@@ -0,0 +1,137 @@
+#include "zeptux.h"
+
+// Represents per-CPU RCU state.
+struct rcu_cpu_data {
+	// The grace period sequence number observed at this CPU's most recent
+	// quiescent state. Every grace period up to and including this one has
+	// seen this CPU pass through a quiescent state.
+	atomic64_t qs_seq;
+
+	// Callbacks queued since the waiting batch was formed.
+	struct rcu_head *next_first, *next_last;
+	// Callbacks waiting for grace period `wait_seq` to elapse.
+	struct rcu_head *wait_first;
+	uint64_t wait_seq;
+
+	uint64_t num_pending;
+} __attribute__((aligned(64)));
+
+static DEFINE_PER_CPU(struct rcu_cpu_data, rcu_cpu_data);
+
+// The most recently started grace period.
+static atomic64_t gp_seq;
+
+// Start a new grace period, returning its sequence number.
+static uint64_t start_gp(void)
+{
+	return atomic_fetch_add_seq_cst(&gp_seq, 1) + 1;
+}
+
+// Determine whether grace period `seq` has elapsed, i.e. whether every online
+// CPU has reported a quiescent state since it started.
+static bool gp_completed(uint64_t seq)
+{
+	cpumask_t online = cpumask_read(&cpu_online_mask);
+	uint32_t cpu;
+
+	for_each_cpu_in_mask(cpu, online) {
+		struct rcu_cpu_data *data = &per_cpu(rcu_cpu_data, cpu);
+
+		if (atomic_load_acquire(&data->qs_seq) < seq)
+			return false;
+	}
+
+	return true;
+}
+
+// Record that this CPU has passed through a quiescent state.
+static void report_qs(struct rcu_cpu_data *data)
+{
+	// Our prior accesses to RCU-protected data must be complete before any
+	// updater can observe our quiescent state.
+	smp_mb();
+	atomic_store_release(&data->qs_seq, atomic_load_relaxed(&gp_seq));
+}
+
+// Invoke the callbacks in the waiting batch.
+static void invoke_callbacks(struct rcu_cpu_data *data)
+{
+	struct rcu_head *head = data->wait_first;
+
+	// Callbacks may queue further callbacks, so detach the batch first.
+	data->wait_first = NULL;
+	while (head != NULL) {
+		struct rcu_head *next = head->next;
+
+		head->func(head);
+		data->num_pending--;
+		head = next;
+	}
+}
+
+// Invoke the waiting batch of callbacks if its grace period has elapsed, and
+// start a grace period for newly queued callbacks if there is no waiting batch.
+// ASSUMES: We are in a quiescent state.
+static void advance_callbacks(struct rcu_cpu_data *data)
+{
+	if (data->wait_first != NULL && gp_completed(data->wait_seq))
+		invoke_callbacks(data);
+
+	if (data->wait_first != NULL || data->next_first == NULL)
+		return;
+
+	data->wait_first = data->next_first;
+	data->next_first = NULL;
+	data->next_last = NULL;
+	data->wait_seq = start_gp();
+
+	// We are quiescent so immediately report for the grace period we just
+	// started, which may be all that is required for it to elapse.
+	report_qs(data);
+	if (gp_completed(data->wait_seq))
+		invoke_callbacks(data);
+}
+
+void rcu_quiescent_state(void)
+{
+	struct rcu_cpu_data *data = this_cpu_ptr(rcu_cpu_data);
+
+	report_qs(data);
+	advance_callbacks(data);
+}
+
+void synchronize_rcu(void)
+{
+	struct rcu_cpu_data *data = this_cpu_ptr(rcu_cpu_data);
+	uint64_t seq = start_gp();
+
+	// We remain quiescent while waiting, so keep reporting as much so other
+	// CPUs waiting on later grace periods are not held up by us.
+	report_qs(data);
+	while (!gp_completed(seq)) {
+		hint_spinwait();
+		report_qs(data);
+	}
+
+	advance_callbacks(data);
+}
+
+void call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *head))
+{
+	struct rcu_cpu_data *data = this_cpu_ptr(rcu_cpu_data);
+
+	head->next = NULL;
+	head->func = func;
+
+	if (data->next_last != NULL)
+		data->next_last->next = head;
+	else
+		data->next_first = head;
+	data->next_last = head;
+	data->num_pending++;
+}
+
+uint64_t rcu_num_pending_callbacks(void)
+{
+	return this_cpu_ptr(rcu_cpu_data)->num_pending;
+}
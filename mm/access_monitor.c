@@ -0,0 +1,246 @@
+#include "zeptux.h"
+
+// Default tunables. With the monitor sampled every 5ms these correspond to
+// DAMON's defaults of a 100ms aggregation interval and 10 to 1000 regions.
+static const struct access_monitor_params default_params = {
+	.samples_per_aggregation = 20,
+	.min_regions = 10,
+	.max_regions = 1000,
+	.merge_threshold = 2,
+};
+
+// Obtain the next pseudo-random number from the monitor's xorshift64* state.
+static uint64_t next_rand(struct access_monitor *mon)
+{
+	uint64_t x = mon->rand_state;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	mon->rand_state = x;
+
+	return x * 0x2545f4914f6cdd1dUL;
+}
+
+// Determine the number of pages spanned by a region.
+static uint64_t region_num_pages(struct access_region *region)
+{
+	return bytes_to_pages(region->end.x - region->start.x);
+}
+
+// Pick a new random page to sample in the region and clear its accessed flag
+// so we can determine whether it is accessed before the next sample.
+//
+// As with DAMON we do not flush the TLB, so accesses via TLB entries cached
+// before the flag was cleared may be missed. We accept this inaccuracy rather
+// than interrupt every CPU using the address space on each sample.
+static void prepare_sample(struct access_monitor *mon,
+			   struct access_region *region)
+{
+	uint64_t offset = next_rand(mon) % region_num_pages(region);
+
+	region->sample_va = virt_offset_pages(region->start, offset);
+	_test_and_clear_accessed(mon->as->pgd, region->sample_va,
+				 &kernel_page_allocators);
+}
+
+// Allocate a region [start, end) and insert it after `prev`, or at the front of
+// the region list if NULL.
+// ASSUMES: `mon->lock` is held or the monitor is not yet visible.
+static struct access_region *insert_region(struct access_monitor *mon,
+					   struct access_region *prev,
+					   virtaddr_t start, virtaddr_t end)
+{
+	struct access_region *region =
+		kzalloc(sizeof(struct access_region), KMALLOC_KERNEL);
+
+	region->start = start;
+	region->end = end;
+	if (prev != NULL)
+		list_node_insert_after(&prev->node, &region->node);
+	else
+		list_push_front(&mon->regions, &region->node);
+	mon->num_regions++;
+
+	prepare_sample(mon, region);
+	return region;
+}
+
+void access_monitor_init(struct access_monitor *mon, struct address_space *as,
+			 virtaddr_t va, uint64_t num_pages,
+			 struct access_monitor_params *params)
+{
+	mon->as = as;
+	mon->params = params != NULL ? *params : default_params;
+	list_init(&mon->regions);
+	mon->num_regions = 0;
+	mon->num_samples = 0;
+	mon->num_aggregations = 0;
+	// Any non-zero seed will do.
+	mon->rand_state = rdtsc() | 1;
+	mon->lock = empty_spinlock();
+
+	if (num_pages < mon->params.min_regions)
+		panic("Cannot monitor %lu pages with %u regions", num_pages,
+		      mon->params.min_regions);
+
+	// Divide the range evenly into the minimum number of regions.
+	virtaddr_t start = {ALIGN(va.x, PAGE_SIZE)};
+	struct access_region *prev = NULL;
+	for (uint32_t i = 0; i < mon->params.min_regions; i++) {
+		uint64_t end_page = num_pages * (i + 1) / mon->params.min_regions;
+		virtaddr_t end = virt_offset_pages(va, end_page);
+
+		prev = insert_region(mon, prev, start, end);
+		start = end;
+	}
+}
+
+void access_monitor_destroy(struct access_monitor *mon)
+{
+	struct access_region *region;
+	struct list_node *tmp;
+
+	spinlock_acquire(&mon->lock);
+	for_each_list_element_safe (&mon->regions, region, tmp, node) {
+		list_detach(&region->node);
+		kfree(region);
+	}
+	mon->num_regions = 0;
+	spinlock_release(&mon->lock);
+}
+
+// Merge adjacent regions whose heat is similar, weighting the resulting heat by
+// size.
+// ASSUMES: `mon->lock` is held.
+static void merge_regions(struct access_monitor *mon)
+{
+	struct access_region *region;
+	struct list_node *tmp;
+	struct access_region *prev = NULL;
+
+	for_each_list_element_safe (&mon->regions, region, tmp, node) {
+		if (mon->num_regions <= mon->params.min_regions)
+			return;
+
+		uint32_t diff = prev == NULL ? 0
+				: prev->heat > region->heat
+					? prev->heat - region->heat
+					: region->heat - prev->heat;
+		if (prev == NULL || prev->end.x != region->start.x ||
+		    diff > mon->params.merge_threshold) {
+			prev = region;
+			continue;
+		}
+
+		uint64_t prev_pages = region_num_pages(prev);
+		uint64_t pages = region_num_pages(region);
+		prev->heat = (prev->heat * prev_pages + region->heat * pages) /
+			     (prev_pages + pages);
+		prev->end = region->end;
+
+		list_detach(&region->node);
+		kfree(region);
+		mon->num_regions--;
+	}
+}
+
+// Split each region at a random page boundary, provided doing so does not
+// exceed the maximum number of regions.
+// ASSUMES: `mon->lock` is held.
+static void split_regions(struct access_monitor *mon)
+{
+	if (mon->num_regions * 2 > mon->params.max_regions)
+		return;
+
+	struct access_region *region;
+	struct list_node *tmp;
+
+	for_each_list_element_safe (&mon->regions, region, tmp, node) {
+		uint64_t num_pages = region_num_pages(region);
+		if (num_pages < 2)
+			continue;
+
+		uint64_t offset = 1 + next_rand(mon) % (num_pages - 1);
+		virtaddr_t mid = virt_offset_pages(region->start, offset);
+		struct access_region *split =
+			insert_region(mon, region, mid, region->end);
+
+		split->heat = region->heat;
+		region->end = mid;
+		// Our sample page may now lie in the new region.
+		prepare_sample(mon, region);
+	}
+}
+
+// Complete the current aggregation interval, recording the heat of each region
+// and adjusting the regions.
+// ASSUMES: `mon->lock` is held.
+static void aggregate(struct access_monitor *mon)
+{
+	for_each_list_element (&mon->regions, region, struct access_region,
+			       node) {
+		region->heat = region->num_accesses;
+		region->num_accesses = 0;
+	}
+
+	merge_regions(mon);
+	split_regions(mon);
+
+	mon->num_samples = 0;
+	mon->num_aggregations++;
+}
+
+void access_monitor_sample(struct access_monitor *mon)
+{
+	spinlock_acquire(&mon->lock);
+
+	for_each_list_element (&mon->regions, region, struct access_region,
+			       node) {
+		if (_test_and_clear_accessed(mon->as->pgd, region->sample_va,
+					     &kernel_page_allocators))
+			region->num_accesses++;
+
+		prepare_sample(mon, region);
+	}
+
+	if (++mon->num_samples == mon->params.samples_per_aggregation)
+		aggregate(mon);
+
+	spinlock_release(&mon->lock);
+}
+
+uint32_t access_monitor_heat(struct access_monitor *mon, virtaddr_t va)
+{
+	uint32_t ret = 0;
+
+	spinlock_acquire(&mon->lock);
+	for_each_list_element (&mon->regions, region, struct access_region,
+			       node) {
+		if (va.x >= region->start.x && va.x < region->end.x) {
+			ret = region->heat;
+			break;
+		}
+	}
+	spinlock_release(&mon->lock);
+
+	return ret;
+}
+
+void access_monitor_histogram(struct access_monitor *mon, uint64_t *num_pages,
+			      uint32_t num_buckets)
+{
+	for (uint32_t i = 0; i < num_buckets; i++) {
+		num_pages[i] = 0;
+	}
+
+	spinlock_acquire(&mon->lock);
+	uint64_t num_heats = mon->params.samples_per_aggregation + 1;
+	for_each_list_element (&mon->regions, region, struct access_region,
+			       node) {
+		uint64_t bucket = region->heat * num_buckets / num_heats;
+
+		num_pages[bucket] += region_num_pages(region);
+	}
+	spinlock_release(&mon->lock);
+}
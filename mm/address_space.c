@@ -0,0 +1,316 @@
+#include "zeptux.h"
+
+struct address_space kernel_address_space;
+
+// The next address space context ID to assign. 0 is never assigned so it can
+// be used to indicate no address space.
+static atomic64_t next_ctx_id = {1};
+
+// Allocate a zeroed page table page from the physical allocator with no present
+// entries recorded.
+static physaddr_t kernel_alloc_pagetable(void)
+{
+	physaddr_t pa = phys_alloc(0, ALLOC_PAGETABLE);
+
+	zero_page(pa);
+	return pa;
+}
+
+// Generate kernel page table allocation functions for each page level.
+#define GEN_PAGE_ALLOC(pagelevel)                                     \
+	static pagelevel##addr_t kernel_alloc_##pagelevel(void)       \
+	{                                                             \
+		pagelevel##addr_t ret = {kernel_alloc_pagetable().x}; \
+		return ret;                                           \
+	}
+GEN_PAGE_ALLOC(pud);
+GEN_PAGE_ALLOC(pmd);
+GEN_PAGE_ALLOC(ptd);
+#undef GEN_PAGE_ALLOC
+
+// Allocate a zeroed data page from the physical allocator.
+static physaddr_t kernel_alloc_data(void)
+{
+	physaddr_t pa = phys_alloc_one();
+
+	zero_page(pa);
+	return pa;
+}
+
+struct page_allocators kernel_page_allocators = {
+	.pud = kernel_alloc_pud,
+	.pmd = kernel_alloc_pmd,
+	.ptd = kernel_alloc_ptd,
+	.data = kernel_alloc_data,
+
+	.free_pagetable = phys_free,
+
+	.panic = panic,
+};
+
+void address_space_init(struct address_space *as, pgdaddr_t pgd)
+{
+	as->pgd = pgd;
+	as->ctx_id = atomic_fetch_add_relaxed(&next_ctx_id, 1);
+	atomic_store_relaxed(&as->tlb_gen, 0);
+	atomic_store_relaxed(&as->active_cpus.bits, 0);
+	list_init(&as->lazy_regions);
+	as->lazy_lock = empty_spinlock();
+}
+
+void address_space_create(struct address_space *as)
+{
+	physaddr_t pa = kernel_alloc_pagetable();
+	pgdaddr_t pgd = {pa.x};
+	pgdaddr_t kernel_pgd = kernel_address_space.pgd;
+	uint16_t num_entries = 0;
+
+	for (int i = PGD_KERNEL_START_INDEX; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+		pgde_t pgde = *pgde_at(kernel_pgd, i);
+
+		*pgde_at(pgd, i) = pgde;
+		if (pgde_present(pgde))
+			num_entries++;
+	}
+
+	// The PGD is not yet visible to anybody else so need not be locked.
+	_pfn_to_physblock_raw(phys_to_pfn(pa))->pagetable.num_entries =
+		num_entries;
+
+	address_space_init(as, pgd);
+}
+
+uint64_t address_space_clone(struct address_space *dst,
+			     struct address_space *src)
+{
+	address_space_create(dst);
+
+	uint64_t num_allocated = _clone_pagetables(dst->pgd, src->pgd,
+						   &kernel_page_allocators);
+
+	// Writable pages in the source have been made read-only, so any CPU
+	// using it must flush before these become copy-on-write.
+	struct tlb_batch batch;
+	tlb_batch_init(&batch, src);
+	batch.flush_all = true;
+	tlb_shootdown(&batch);
+
+	spinlock_acquire(&src->lazy_lock);
+	for_each_list_element (&src->lazy_regions, region, struct lazy_region,
+			       node) {
+		address_space_add_lazy_region(dst, region->start,
+					      region->num_pages, region->flags);
+	}
+	spinlock_release(&src->lazy_lock);
+
+	return num_allocated;
+}
+
+uint64_t address_space_map(struct address_space *as, virtaddr_t va,
+			   physaddr_t pa, int64_t num_pages, map_flags_t flags)
+{
+	return _map_page_range(as->pgd, va, pa, num_pages, flags,
+			       &kernel_page_allocators);
+}
+
+uint64_t address_space_unmap(struct address_space *as, virtaddr_t va,
+			     int64_t num_pages)
+{
+	physaddr_t freelist = {0};
+	uint64_t num_freed = _unmap_page_range(as->pgd, va, num_pages,
+					       &kernel_page_allocators,
+					       &freelist);
+
+	// Page tables we have unlinked may still be referenced by cached
+	// paging-structure entries on any CPU using this address space, so
+	// they can only be freed once every such CPU has flushed.
+	struct tlb_batch batch;
+	tlb_batch_init(&batch, as);
+	tlb_batch_add(&batch, va, num_pages);
+	tlb_shootdown(&batch);
+
+	_free_pagetables(freelist, &kernel_page_allocators);
+	return num_freed;
+}
+
+// Flush the 2 MiB range at `va` from every CPU using the address space `ctx`,
+// as required by _collapse_page_range().
+static void collapse_flush(virtaddr_t va, void *ctx)
+{
+	struct tlb_batch batch;
+
+	tlb_batch_init(&batch, ctx);
+	tlb_batch_add(&batch, va, NUM_PAGES_PTD);
+	tlb_shootdown(&batch);
+}
+
+uint64_t address_space_collapse(struct address_space *as, virtaddr_t va,
+				int64_t num_pages)
+{
+	return _collapse_page_range(as->pgd, va, num_pages,
+				    &kernel_page_allocators, collapse_flush,
+				    as);
+}
+
+void address_space_add_lazy_region(struct address_space *as, virtaddr_t va,
+				   uint64_t num_pages, map_flags_t flags)
+{
+	struct lazy_region *region =
+		kmalloc(sizeof(struct lazy_region), KMALLOC_KERNEL);
+
+	region->start.x = ALIGN(va.x, PAGE_SIZE);
+	region->num_pages = num_pages;
+	region->flags = flags;
+
+	spinlock_acquire(&as->lazy_lock);
+	list_push_back(&as->lazy_regions, &region->node);
+	spinlock_release(&as->lazy_lock);
+}
+
+void address_space_remove_lazy_region(struct address_space *as, virtaddr_t va)
+{
+	struct lazy_region *region;
+	struct list_node *tmp;
+
+	spinlock_acquire(&as->lazy_lock);
+	for_each_list_element_safe (&as->lazy_regions, region, tmp, node) {
+		if (region->start.x != ALIGN(va.x, PAGE_SIZE))
+			continue;
+
+		list_detach(&region->node);
+		kfree(region);
+		break;
+	}
+	spinlock_release(&as->lazy_lock);
+}
+
+// Find the lazily backed region containing `va`, or NULL if none does.
+// ASSUMES: `as->lazy_lock` is held.
+static struct lazy_region *find_lazy_region_locked(struct address_space *as,
+						   virtaddr_t va)
+{
+	for_each_list_element (&as->lazy_regions, region, struct lazy_region,
+			       node) {
+		uint64_t end = region->start.x + region->num_pages * PAGE_SIZE;
+
+		if (va.x >= region->start.x && va.x < end)
+			return region;
+	}
+
+	return NULL;
+}
+
+// Determine whether the 2 MiB-aligned range containing `va` lies entirely
+// within the region.
+static bool lazy_region_contains_2mib(struct lazy_region *region,
+				      virtaddr_t va)
+{
+	uint64_t start = ALIGN(va.x, PAGE_SIZE_2MIB);
+	uint64_t end = region->start.x + region->num_pages * PAGE_SIZE;
+
+	return start >= region->start.x && start + PAGE_SIZE_2MIB <= end;
+}
+
+bool address_space_sync_kernel(struct address_space *as, virtaddr_t va)
+{
+	if (as == &kernel_address_space)
+		return false;
+
+	// Non-present entries are never cached, so no TLB flush is required.
+	return _sync_kernel_pgde(as->pgd, kernel_address_space.pgd, va,
+				 &kernel_page_allocators);
+}
+
+// Allocate, zero and map the page containing `va` in the specified region.
+// ASSUMES: `as->lazy_lock` is held.
+static void fault_in_locked(struct address_space *as,
+			    struct lazy_region *region, virtaddr_t va)
+{
+	uint64_t entry;
+	page_level_t level = _walk_virt(as->pgd, va, &entry);
+
+	// Another CPU may have faulted the page in before we acquired the lock,
+	// and the range may since have begun to be collapsed.
+	if (entry != 0)
+		return;
+
+	// If no PTD is yet present we can fault in a 2 MiB page.
+	if (level != PTD && lazy_region_contains_2mib(region, va)) {
+		virtaddr_t start = {ALIGN(va.x, PAGE_SIZE_2MIB)};
+		physaddr_t pa = phys_alloc(PMD_SHIFT - PAGE_SHIFT, ALLOC_KERNEL);
+
+		physaddr_t curr = pa;
+		for (uint64_t i = 0; i < NUM_PAGES_PTD; i++) {
+			zero_page(curr);
+			curr = phys_next_page(curr);
+		}
+
+		address_space_map(as, start, pa, NUM_PAGES_PTD, region->flags);
+		return;
+	}
+
+	virtaddr_t start = {ALIGN(va.x, PAGE_SIZE)};
+	physaddr_t pa = kernel_page_allocators.data();
+	address_space_map(as, start, pa, 1, region->flags);
+}
+
+// Handle a write to a present read-only page by breaking copy-on-write if the
+// page is mapped as such. Returns false if it is not.
+static bool fault_cow(struct address_space *as, virtaddr_t va)
+{
+	physaddr_t old_pa;
+	uint64_t num_pages;
+
+	if (!_break_cow(as->pgd, va, &kernel_page_allocators, &old_pa,
+			&num_pages))
+		return false;
+
+	if (old_pa.x == 0)
+		return true;
+
+	// Other CPUs may still be accessing the previously shared page via
+	// stale TLB entries, so only drop our reference once they have flushed.
+	virtaddr_t start = {ALIGN(va.x, num_pages * PAGE_SIZE)};
+	struct tlb_batch batch;
+	tlb_batch_init(&batch, as);
+	tlb_batch_add(&batch, start, num_pages);
+	tlb_shootdown(&batch);
+
+	phys_put_range(old_pa, num_pages);
+	return true;
+}
+
+bool address_space_fault(struct address_space *as, virtaddr_t va,
+			 fault_flags_t flags)
+{
+	uint64_t entry;
+
+	// Protection faults are never the result of a page not yet having been
+	// faulted in, but writes may be to a copy-on-write page.
+	if (IS_MASK_SET(flags, FAULT_PROTECTION)) {
+		if (IS_MASK_SET(flags, FAULT_WRITE) && fault_cow(as, va))
+			return true;
+
+		// The page may have been unmapped since the fault, e.g. by a
+		// collapse of its range, in which case we retry the access.
+		_walk_virt(as->pgd, va, &entry);
+		return !IS_BIT_SET(entry, PAGE_FLAG_PRESENT_BIT);
+	}
+
+	// The range may be mid-collapse, which leaves a non-present but
+	// non-zero PMD entry, or have been mapped since we faulted. Either way
+	// the access simply needs to be retried. Faults are handled with
+	// interrupts disabled, so page tables cannot be freed under these walks.
+	_walk_virt(as->pgd, va, &entry);
+	if (entry != 0)
+		return true;
+
+	spinlock_acquire(&as->lazy_lock);
+
+	struct lazy_region *region = find_lazy_region_locked(as, va);
+	if (region != NULL)
+		fault_in_locked(as, region, va);
+
+	spinlock_release(&as->lazy_lock);
+	return region != NULL;
+}
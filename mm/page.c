@@ -1,5 +1,57 @@
 #include "zeptux.h"
 
+// Page table locking:
+//
+// Where `alloc` tracks page table occupancy (see struct page_allocators), each
+// page table page carries a spinlock in its physblock protecting its entries
+// and entry count. Walks which modify page tables lock each level
+// hand-over-hand starting from the PGD, which is never freed, so that
+// independent regions of the same address space can be mapped and unmapped
+// concurrently. A page table is only unlinked from its parent with both locked
+// and once it has no present entries.
+//
+// Read-side walks (e.g. _walk_virt_to_phys()) take no locks and read each entry
+// exactly once. Unlinked page tables are only freed after a TLB shootdown which
+// cannot complete while a CPU using the address space has interrupts disabled,
+// so lockless walkers must run with interrupts disabled on such a CPU if page
+// tables might concurrently be freed.
+//
+// For the same reason, page table locks must never be held across a TLB
+// shootdown, as another CPU may be spinning on them with interrupts disabled.
+// _collapse_page_range() therefore leaves a placeholder PMDE while it flushes
+// the PTD it is replacing, see pmde_collapsing(). Mapping and unmapping wait for
+// the collapse to complete so must not encounter such a range with interrupts
+// disabled.
+
+// Read a page table entry exactly once.
+#define read_entry(_entry_ptr) \
+	((typeof(*(_entry_ptr))){_atomic_load_relaxed(&(_entry_ptr)->x)})
+
+// Clear `clear` and set `set` in the live page table entry `*entry`, returning
+// the updated entry. The CPU may set the accessed and dirty flags in the entry
+// until it is flushed from every TLB, so we must update it atomically lest we
+// lose them.
+static uint64_t update_entry(uint64_t *entry, uint64_t clear, uint64_t set)
+{
+	uint64_t old = _atomic_load_relaxed(entry);
+	uint64_t new;
+
+	// On failure `old` is updated to the current value.
+	do {
+		new = (old & ~clear) | set;
+	} while (!_atomic_compare_exchange_release(entry, &old, new));
+
+	return new;
+}
+
+// Determine whether the PMDE is a placeholder left while the PTD it referenced
+// is flushed before being replaced by a 2 MiB page, see collapse_next(). It is
+// not present but, unlike an unmapped entry, non-zero.
+static bool pmde_collapsing(pmde_t pmde)
+{
+	return !pmde_present(pmde) && pmde.x != 0;
+}
+
 // Represents page mapping state, updated as we proceed through the mapping
 // process.
 struct page_map_state {
@@ -14,9 +66,86 @@ struct page_map_state {
 	struct page_allocators *alloc;
 };
 
+// Determine whether page tables allocated by `alloc` are described by
+// physblocks tracking their occupancy and holding their locks.
+static bool pagetable_tracked(struct page_allocators *alloc)
+{
+	return alloc->free_pagetable != NULL;
+}
+
+// Obtain the physblock describing the page table at physical address
+// `table_pa`. Page tables are order 0 so never tail pages.
+static struct physblock *pagetable_to_physblock(uint64_t table_pa)
+{
+	physaddr_t pa = {table_pa};
+	return _pfn_to_physblock_raw(phys_to_pfn(pa));
+}
+
+// Acquire the lock on the page table at `table_pa` if `alloc` tracks page
+// tables.
+static void pagetable_lock(uint64_t table_pa, struct page_allocators *alloc)
+{
+	if (!pagetable_tracked(alloc))
+		return;
+
+	struct physblock *block = pagetable_to_physblock(table_pa);
+	spinlock_acquire(&block->pagetable.lock);
+}
+
+// Release the lock on the page table at `table_pa` if `alloc` tracks page
+// tables.
+static void pagetable_unlock(uint64_t table_pa, struct page_allocators *alloc)
+{
+	if (!pagetable_tracked(alloc))
+		return;
+
+	struct physblock *block = pagetable_to_physblock(table_pa);
+	spinlock_release(&block->pagetable.lock);
+}
+
+// Add `delta` to the number of present entries tracked for the page table at
+// physical address `table_pa`, returning the updated count or -1 if `alloc`
+// does not track page tables. Panics on underflow via `alloc`.
+// ASSUMES: Page table lock is held.
+static int pagetable_add_entries(uint64_t table_pa, int delta,
+				 struct page_allocators *alloc)
+{
+	if (!pagetable_tracked(alloc))
+		return -1;
+
+	struct physblock *block = pagetable_to_physblock(table_pa);
+	int num_entries = (int)block->pagetable.num_entries + delta;
+	if (num_entries < 0 || num_entries > NUM_PAGE_TABLE_ENTRIES)
+		alloc->panic("Page table 0x%lx entry count %d out of range",
+			     table_pa, num_entries);
+	block->pagetable.num_entries = num_entries;
+
+	return num_entries;
+}
+
+// Determine whether the range being mapped can be mapped at the current
+// position by a single page of `size` bytes comprising `num_pages` 4 KiB pages.
+static bool map_can_use_page_size(struct page_map_state *state, uint64_t size,
+				  uint64_t num_pages)
+{
+	return IS_ALIGNED(state->va.x, size) && IS_ALIGNED(state->pa.x, size) &&
+	       state->num_remaining_pages >= (int64_t)num_pages;
+}
+
+// Advance mapping state by `num_pages` pages.
+static void map_advance(struct page_map_state *state, uint64_t num_pages)
+{
+	state->pa = phys_offset_pages(state->pa, num_pages);
+	state->va = virt_offset_pages(state->va, num_pages);
+	state->num_remaining_pages -= num_pages;
+}
+
 // Map page tables entries at the PTD level for the specified map range.
+// ASSUMES: PTD lock is held.
 static void _map_page_range_ptd(ptdaddr_t ptd, struct page_map_state *state)
 {
+	int num_assigned = 0;
+
 	while (state->num_remaining_pages > 0) {
 		uint64_t index = virt_ptde_index(state->va);
 		ptde_t ptde = *ptde_at(ptd, index);
@@ -31,125 +160,132 @@ static void _map_page_range_ptd(ptdaddr_t ptd, struct page_map_state *state)
 		}
 
 		assign_data(ptd, index, state->pa, state->flags);
+		num_assigned++;
 
 	next:
-		state->pa = phys_offset_pages(state->pa, 1);
-		state->va = virt_offset_pages(state->va, 1);
-		state->num_remaining_pages--;
+		map_advance(state, 1);
 
 		// If we just assigned the last entry in the page table, we need
 		// a new PMDE.
 		if (index == NUM_PAGE_TABLE_ENTRIES - 1)
 			break;
 	}
+
+	if (num_assigned > 0)
+		pagetable_add_entries(ptd.x, num_assigned, state->alloc);
 }
 
-// Map page tables entries at the PMD level, trying to use 2 MiB pages if
-// possible for the specified map range.
-static void _map_page_range_pmd(pmdaddr_t pmd, struct page_map_state *state)
+// Map the next part of the range, either up to the end of the PTD containing the
+// current VA or a single 2 MiB/1 GiB page where possible, walking from the PGD
+// and allocating page tables as required.
+static void map_next(pgdaddr_t pgd, struct page_map_state *state)
 {
-	while (state->num_remaining_pages > 0) {
-		uint64_t index = virt_pmde_index(state->va);
-		pmde_t pmde = *pmde_at(pmd, index);
-		bool present = pmde_present(pmde);
-
-		ptdaddr_t ptd;
-		if (!present && IS_ALIGNED(state->va.x, PAGE_SIZE_2MIB) &&
-		    IS_ALIGNED(state->pa.x, PAGE_SIZE_2MIB) &&
-		    state->num_remaining_pages >= (int64_t)NUM_PAGES_PTD) {
-			// PTD not mapped, we can map as 2 MiB page.
-			assign_data_2mib(pmd, index, state->pa, state->flags);
-
-			// Move to next PMDE.
-			state->pa = phys_offset_pages(state->pa, NUM_PAGES_PTD);
-			state->va = virt_offset_pages(state->va, NUM_PAGES_PTD);
-			state->num_remaining_pages -= NUM_PAGES_PTD;
-			goto next;
-		} else if (present && pmde_2mib(pmde)) {
-			// 2 MiB data page already mapped, overlapping mappings
-			// are not permitted so panic.
-			state->alloc->panic(
-				"Unable to map VA 0x%lx at PA 0x%lx as 2 MiB PMDE already maps to 0x%lx",
-				state->va.x, state->pa.x, pmde_data_2mib(pmde).x);
-		} else if (!present) {
-			// PTD not mapped so we have to allocate.
-			ptd = state->alloc->ptd();
-			state->num_pagetables_allocated++;
-			assign_ptd(pmd, index, ptd);
-		} else {
-			// PTD mapped.
-			ptd = pmde_ptd(pmde);
-		}
-
-		_map_page_range_ptd(ptd, state);
-		if (state->num_remaining_pages <= 0)
-			break;
-
-		if (!IS_ALIGNED(state->va.x, PAGE_SIZE_2MIB))
-			state->alloc->panic(
-				"%lu pages unassigned under PMD for VA 0x%lx",
-				state->num_remaining_pages, state->va.x);
-
-	next:
-		// If we just assigned the last entry in the page table, we need
-		// a new PUDE.
-		if (index == NUM_PAGE_TABLE_ENTRIES - 1)
-			break;
+	struct page_allocators *alloc = state->alloc;
+
+	pagetable_lock(pgd.x, alloc);
+	uint64_t pgd_index = virt_pgde_index(state->va);
+	pgde_t pgde = *pgde_at(pgd, pgd_index);
+
+	pudaddr_t pud;
+	if (pgde_present(pgde)) {
+		pud = pgde_pud(pgde);
+	} else {
+		pud = alloc->pud();
+		state->num_pagetables_allocated++;
+		assign_pud(pgd, pgd_index, pud);
+		pagetable_add_entries(pgd.x, 1, alloc);
 	}
-}
+	pagetable_lock(pud.x, alloc);
+	pagetable_unlock(pgd.x, alloc);
+
+	uint64_t pud_index = virt_pude_index(state->va);
+	pude_t pude = *pude_at(pud, pud_index);
+	bool present = pude_present(pude);
+
+	pmdaddr_t pmd;
+	if (!present && map_can_use_page_size(state, PAGE_SIZE_1GIB,
+					      NUM_PAGES_PMD)) {
+		// PMD not mapped, we can map as 1 GiB page.
+		assign_data_1gib(pud, pud_index, state->pa, state->flags);
+		pagetable_add_entries(pud.x, 1, alloc);
+		pagetable_unlock(pud.x, alloc);
+
+		map_advance(state, NUM_PAGES_PMD);
+		return;
+	} else if (present && pude_1gib(pude) &&
+		   IS_MASK_SET(state->flags, MAP_SKIP_IF_MAPPED)) {
+		// 1 GiB data page already mapped, skip the rest of it.
+		pagetable_unlock(pud.x, alloc);
 
-// Map page tables entries at the PUD level, trying to use 1 GiB pages if
-// possible for the specified map range.
-static void _map_page_range_pud(pudaddr_t pud, struct page_map_state *state)
-{
-	while (state->num_remaining_pages > 0) {
-		uint64_t index = virt_pude_index(state->va);
-		pude_t pude = *pude_at(pud, index);
-		bool present = pude_present(pude);
-
-		pmdaddr_t pmd;
-		if (!present && IS_ALIGNED(state->va.x, PAGE_SIZE_1GIB) &&
-		    IS_ALIGNED(state->pa.x, PAGE_SIZE_1GIB) &&
-		    state->num_remaining_pages >= (int64_t)NUM_PAGES_PMD) {
-			// PMD not mapped, we can map as 1 GiB page.
-			assign_data_1gib(pud, index, state->pa, state->flags);
-
-			// Move to next PUDE.
-			state->pa = phys_offset_pages(state->pa, NUM_PAGES_PMD);
-			state->va = virt_offset_pages(state->va, NUM_PAGES_PMD);
-			state->num_remaining_pages -= NUM_PAGES_PMD;
-			goto next;
-		} else if (present && pude_1gib(pude)) {
-			// 1 GiB data page already mapped, overlapping mappings
-			// are not permitted so panic.
-			state->alloc->panic(
-				"Unable to map VA 0x%lx at PA 0x%lx as 1 GiB PUDE already maps to 0x%lx",
-				state->va.x, state->pa.x, pude_data_1gib(pude).x);
-		} else if (!present) {
-			// PMD not mapped so we have to allocate.
-			pmd = state->alloc->pmd();
-			state->num_pagetables_allocated++;
-			assign_pmd(pud, index, pmd);
-		} else {
-			// PMD mapped.
-			pmd = pude_pmd(pude);
-		}
+		map_advance(state, virt_pude_remaining_pages(state->va));
+		return;
+	} else if (present && pude_1gib(pude)) {
+		// 1 GiB data page already mapped, overlapping mappings
+		// are not permitted so panic.
+		alloc->panic(
+			"Unable to map VA 0x%lx at PA 0x%lx as 1 GiB PUDE already maps to 0x%lx",
+			state->va.x, state->pa.x, pude_data_1gib(pude).x);
+	} else if (!present) {
+		// PMD not mapped so we have to allocate.
+		pmd = alloc->pmd();
+		state->num_pagetables_allocated++;
+		assign_pmd(pud, pud_index, pmd);
+		pagetable_add_entries(pud.x, 1, alloc);
+	} else {
+		// PMD mapped.
+		pmd = pude_pmd(pude);
+	}
+	pagetable_lock(pmd.x, alloc);
+	pagetable_unlock(pud.x, alloc);
+
+	uint64_t pmd_index = virt_pmde_index(state->va);
+	pmde_t pmde = *pmde_at(pmd, pmd_index);
+	present = pmde_present(pmde);
+	if (pmde_collapsing(pmde)) {
+		// Wait for the collapse to complete and retry.
+		pagetable_unlock(pmd.x, alloc);
+		hint_spinwait();
+		return;
+	}
 
-		_map_page_range_pmd(pmd, state);
-		if (state->num_remaining_pages <= 0)
-			break;
+	ptdaddr_t ptd;
+	if (!present && map_can_use_page_size(state, PAGE_SIZE_2MIB,
+					      NUM_PAGES_PTD)) {
+		// PTD not mapped, we can map as 2 MiB page.
+		assign_data_2mib(pmd, pmd_index, state->pa, state->flags);
+		pagetable_add_entries(pmd.x, 1, alloc);
+		pagetable_unlock(pmd.x, alloc);
 
-		if (!IS_ALIGNED(state->va.x, PAGE_SIZE_1GIB))
-			state->alloc->panic(
-				"%lu pages unassigned under PUD for VA 0x%lx",
-				state->num_remaining_pages, state->va.x);
+		map_advance(state, NUM_PAGES_PTD);
+		return;
+	} else if (present && pmde_2mib(pmde) &&
+		   IS_MASK_SET(state->flags, MAP_SKIP_IF_MAPPED)) {
+		// 2 MiB data page already mapped, skip the rest of it.
+		pagetable_unlock(pmd.x, alloc);
 
-	next:
-		// If we just assigned the last entry in the page table, we need
-		// a new PGDE.
-		if (index == NUM_PAGE_TABLE_ENTRIES - 1)
-			break;
+		map_advance(state, virt_pmde_remaining_pages(state->va));
+		return;
+	} else if (present && pmde_2mib(pmde)) {
+		// 2 MiB data page already mapped, overlapping mappings
+		// are not permitted so panic.
+		alloc->panic(
+			"Unable to map VA 0x%lx at PA 0x%lx as 2 MiB PMDE already maps to 0x%lx",
+			state->va.x, state->pa.x, pmde_data_2mib(pmde).x);
+	} else if (!present) {
+		// PTD not mapped so we have to allocate.
+		ptd = alloc->ptd();
+		state->num_pagetables_allocated++;
+		assign_ptd(pmd, pmd_index, ptd);
+		pagetable_add_entries(pmd.x, 1, alloc);
+	} else {
+		// PTD mapped.
+		ptd = pmde_ptd(pmde);
 	}
+	pagetable_lock(ptd.x, alloc);
+	pagetable_unlock(pmd.x, alloc);
+
+	_map_page_range_ptd(ptd, state);
+	pagetable_unlock(ptd.x, alloc);
 }
 
 uint64_t _map_page_range(pgdaddr_t pgd, virtaddr_t start_va, physaddr_t start_pa,
@@ -167,69 +303,775 @@ uint64_t _map_page_range(pgdaddr_t pgd, virtaddr_t start_va, physaddr_t start_pa
 	};
 
 	while (state.num_remaining_pages > 0) {
-		uint64_t index = virt_pgde_index(state.va);
-		pgde_t pgde = *pgde_at(pgd, index);
+		map_next(pgd, &state);
+	}
 
-		pudaddr_t pud;
-		if (!pgde_present(pgde)) {
-			pud = state.alloc->pud();
-			state.num_pagetables_allocated++;
-			assign_pud(pgd, index, pud);
-		} else {
-			pud = pgde_pud(pgde);
+	return state.num_pagetables_allocated;
+}
+
+// Represents page unmapping state, updated as we proceed through the unmapping
+// process.
+struct page_unmap_state {
+	virtaddr_t va;
+	// Signed so we can advance > num pages + exit early.
+	int64_t num_remaining_pages;
+	// Page tables unlinked from their parent, chained through their first
+	// entry.
+	physaddr_t freelist;
+	uint64_t num_pagetables_freed;
+
+	// Immutable:
+	struct page_allocators *alloc;
+};
+
+// Advance unmapping state by `num_pages` pages.
+static void unmap_advance(struct page_unmap_state *state, uint64_t num_pages)
+{
+	state->va = virt_offset_pages(state->va, num_pages);
+	state->num_remaining_pages -= num_pages;
+}
+
+// Chain an unlinked page table to be freed once stale TLB entries which might
+// reference it are flushed. The link is stored in the first entry, which as a
+// page-aligned address does not have the present bit set so a concurrent walk
+// through a stale paging-structure cache entry sees nothing mapped.
+static void chain_pagetable(physaddr_t *freelist, uint64_t table_pa)
+{
+	physaddr_t pa = {table_pa};
+	uint64_t *ptr = phys_to_virt_ptr(pa);
+
+	*ptr = freelist->x;
+	*freelist = pa;
+}
+
+// Unmap page table entries at the PTD level for the specified unmap range.
+// Returns the number of entries cleared.
+// ASSUMES: PTD lock is held.
+static uint64_t _unmap_page_range_ptd(ptdaddr_t ptd,
+				      struct page_unmap_state *state)
+{
+	uint64_t num_cleared = 0;
+
+	while (state->num_remaining_pages > 0) {
+		uint64_t index = virt_ptde_index(state->va);
+		ptde_t *ptde = ptde_at(ptd, index);
+
+		if (ptde_present(*ptde)) {
+			ptde->x = 0;
+			num_cleared++;
 		}
-		_map_page_range_pud(pud, &state);
-		if (state.num_remaining_pages <= 0)
+
+		unmap_advance(state, 1);
+		if (index == NUM_PAGE_TABLE_ENTRIES - 1)
 			break;
+	}
+
+	return num_cleared;
+}
 
-		// If we have pages still to be mapped AND we are not aligned to
-		// the PGD then something has gone horribly wrong.
-		if (!IS_ALIGNED(state.va.x, PGD_SIZE))
-			state.alloc->panic(
-				"%lu pages unassigned under PGD for VA 0x%lx",
-				state.num_remaining_pages, state.va.x);
+// Unlink and chain any empty page tables on the path from the PGD to `va`,
+// from the bottom up. We lock the entire path so no other walk can be
+// traversing the page tables we unlink.
+static void unmap_reclaim(pgdaddr_t pgd, virtaddr_t va,
+			  struct page_unmap_state *state)
+{
+	struct page_allocators *alloc = state->alloc;
+	// The page tables on the path and the parent entries referencing them.
+	uint64_t tables[4] = {pgd.x};
+	uint64_t *entries[4] = {NULL};
+	int depth = 1;
+
+	pagetable_lock(pgd.x, alloc);
+
+	pgde_t *pgde = pgde_at(pgd, virt_pgde_index(va));
+	if (!pgde_present(*pgde))
+		goto reclaim;
+	pudaddr_t pud = pgde_pud(*pgde);
+	tables[depth] = pud.x;
+	entries[depth++] = &pgde->x;
+	pagetable_lock(pud.x, alloc);
+
+	pude_t *pude = pude_at(pud, virt_pude_index(va));
+	if (!pude_present(*pude) || pude_1gib(*pude))
+		goto reclaim;
+	pmdaddr_t pmd = pude_pmd(*pude);
+	tables[depth] = pmd.x;
+	entries[depth++] = &pude->x;
+	pagetable_lock(pmd.x, alloc);
+
+	pmde_t *pmde = pmde_at(pmd, virt_pmde_index(va));
+	if (!pmde_present(*pmde) || pmde_2mib(*pmde))
+		goto reclaim;
+	ptdaddr_t ptd = pmde_ptd(*pmde);
+	tables[depth] = ptd.x;
+	entries[depth++] = &pmde->x;
+	pagetable_lock(ptd.x, alloc);
+
+reclaim:
+	for (int i = depth - 1; i > 0; i--) {
+		// PUDs in the kernel half are shared by every address space so
+		// must never be freed. We never free the PGD itself.
+		if (i == 1 && virt_pgde_index(va) >= PGD_KERNEL_START_INDEX)
+			break;
+		if (pagetable_to_physblock(tables[i])->pagetable.num_entries > 0)
+			break;
+
+		*entries[i] = 0;
+		pagetable_add_entries(tables[i - 1], -1, alloc);
+		chain_pagetable(&state->freelist, tables[i]);
+		state->num_pagetables_freed++;
 	}
 
-	return state.num_pagetables_allocated;
+	for (int i = depth - 1; i >= 0; i--) {
+		pagetable_unlock(tables[i], alloc);
+	}
 }
 
-// Walks page table entries from specified PGD and obtains entry pointing at
-// data page. Outputs level obtained from in `level_out`.
-static uint64_t walk_to_data(pgdaddr_t pgd, virtaddr_t va,
-			     struct page_allocators *alloc,
-			     page_level_t *level_out)
+// Unmap the next part of the range, either up to the end of the PTD containing
+// the current VA, a single 2 MiB/1 GiB page or the next non-present region,
+// reclaiming page tables which become empty.
+static void unmap_next(pgdaddr_t pgd, struct page_unmap_state *state)
 {
+	struct page_allocators *alloc = state->alloc;
+	virtaddr_t va = state->va;
+	int num_entries = -1;
+
+	pagetable_lock(pgd.x, alloc);
 	pgde_t pgde = *pgde_at(pgd, virt_pgde_index(va));
-	if (!pgde_present(pgde))
-		alloc->panic("0x%lx: PGDE not present", va.x);
+	if (!pgde_present(pgde)) {
+		pagetable_unlock(pgd.x, alloc);
+		unmap_advance(state, virt_pgde_remaining_pages(va));
+		return;
+	}
+	pudaddr_t pud = pgde_pud(pgde);
+	pagetable_lock(pud.x, alloc);
+	pagetable_unlock(pgd.x, alloc);
+
+	pude_t *pude = pude_at(pud, virt_pude_index(va));
+	if (!pude_present(*pude)) {
+		pagetable_unlock(pud.x, alloc);
+		unmap_advance(state, virt_pude_remaining_pages(va));
+		return;
+	} else if (pude_1gib(*pude)) {
+		if (!IS_ALIGNED(va.x, PAGE_SIZE_1GIB) ||
+		    state->num_remaining_pages < (int64_t)NUM_PAGES_PMD)
+			alloc->panic(
+				"Cannot partially unmap 1 GiB page at VA 0x%lx",
+				va.x);
+
+		pude->x = 0;
+		num_entries = pagetable_add_entries(pud.x, -1, alloc);
+		pagetable_unlock(pud.x, alloc);
+		unmap_advance(state, NUM_PAGES_PMD);
+		goto reclaim;
+	}
+	pmdaddr_t pmd = pude_pmd(*pude);
+	pagetable_lock(pmd.x, alloc);
+	pagetable_unlock(pud.x, alloc);
+
+	pmde_t *pmde = pmde_at(pmd, virt_pmde_index(va));
+	if (pmde_collapsing(*pmde)) {
+		// Wait for the collapse to complete and retry.
+		pagetable_unlock(pmd.x, alloc);
+		hint_spinwait();
+		return;
+	} else if (!pmde_present(*pmde)) {
+		pagetable_unlock(pmd.x, alloc);
+		unmap_advance(state, virt_pmde_remaining_pages(va));
+		return;
+	} else if (pmde_2mib(*pmde)) {
+		if (!IS_ALIGNED(va.x, PAGE_SIZE_2MIB) ||
+		    state->num_remaining_pages < (int64_t)NUM_PAGES_PTD)
+			alloc->panic(
+				"Cannot partially unmap 2 MiB page at VA 0x%lx",
+				va.x);
+
+		pmde->x = 0;
+		num_entries = pagetable_add_entries(pmd.x, -1, alloc);
+		pagetable_unlock(pmd.x, alloc);
+		unmap_advance(state, NUM_PAGES_PTD);
+		goto reclaim;
+	}
+	ptdaddr_t ptd = pmde_ptd(*pmde);
+	pagetable_lock(ptd.x, alloc);
+	pagetable_unlock(pmd.x, alloc);
+
+	uint64_t num_cleared = _unmap_page_range_ptd(ptd, state);
+	if (num_cleared > 0)
+		num_entries = pagetable_add_entries(ptd.x, -(int)num_cleared,
+						    alloc);
+	pagetable_unlock(ptd.x, alloc);
+
+reclaim:
+	if (num_entries == 0)
+		unmap_reclaim(pgd, va, state);
+}
+
+uint64_t _unmap_page_range(pgdaddr_t pgd, virtaddr_t start_va,
+			   int64_t num_pages, struct page_allocators *alloc,
+			   physaddr_t *freelist)
+{
+	struct page_unmap_state state = {
+		.va = start_va,
+		.num_remaining_pages = num_pages,
+		.freelist = *freelist,
+		.num_pagetables_freed = 0,
+
+		.alloc = alloc,
+	};
+
+	while (state.num_remaining_pages > 0) {
+		unmap_next(pgd, &state);
+	}
+
+	*freelist = state.freelist;
+	return state.num_pagetables_freed;
+}
+
+void _free_pagetables(physaddr_t freelist, struct page_allocators *alloc)
+{
+	while (freelist.x != 0) {
+		uint64_t *ptr = phys_to_virt_ptr(freelist);
+		physaddr_t next = {*ptr};
+
+		// Page tables are expected to be zeroed on allocation.
+		*ptr = 0;
+		alloc->free_pagetable(freelist);
+		freelist = next;
+	}
+}
+
+// Determine whether the PTD can be replaced by a single 2 MiB page, that is
+// every entry is present and together they map a 2 MiB-aligned physically
+// contiguous range with identical flags. If so, returns the equivalent 2 MiB
+// PMDE without accessed/dirty flags, otherwise returns 0.
+static uint64_t ptd_to_2mib_pmde(ptdaddr_t ptd)
+{
+	// Accessed/dirty flags are set by the CPU per-page so are permitted to
+	// differ, they are gathered once the PTD can no longer be walked.
+	const uint64_t ad_mask = PAGE_FLAG_ACCESSED | PAGE_FLAG_DIRTY;
+
+	ptde_t first = read_entry(ptde_at(ptd, 0));
+	physaddr_t base = ptde_data(first);
+	uint64_t flags = ptde_raw_flags(first) & ~ad_mask;
+
+	// The PSE bit position denotes PAT in a PTDE, which is in a different
+	// position in a 2 MiB PMDE so we don't try to translate it.
+	if (!ptde_present(first) || !IS_ALIGNED(base.x, PAGE_SIZE_2MIB) ||
+	    IS_MASK_SET(flags, PAGE_FLAG_PSE))
+		return 0;
+
+	physaddr_t pa = base;
+	for (int i = 1; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+		ptde_t ptde = read_entry(ptde_at(ptd, i));
+
+		pa = phys_next_page(pa);
+		if (ptde_data(ptde).x != pa.x ||
+		    (ptde_raw_flags(ptde) & ~ad_mask) != flags)
+			return 0;
+	}
+
+	return base.x | flags | PAGE_FLAG_PSE;
+}
+
+// Clear every entry in the PTD, returning the union of their accessed and dirty
+// flags. The CPU sets these with an atomic update of the entry, so we exchange
+// each entry to be sure none is lost.
+static uint64_t clear_ptd_gather_ad(ptdaddr_t ptd)
+{
+	uint64_t ad_flags = 0;
+
+	for (int i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+		uint64_t prev = _atomic_exchange(&ptde_at(ptd, i)->x, 0);
+
+		ad_flags |= prev & (PAGE_FLAG_ACCESSED | PAGE_FLAG_DIRTY);
+	}
 
+	return ad_flags;
+}
+
+// Collapse the PTD mapping the 2 MiB-aligned `va` into a 2 MiB page if
+// possible, freeing it. Returns the VA from which to continue scanning and sets
+// `*collapsed` if the PTD was replaced.
+static virtaddr_t collapse_next(pgdaddr_t pgd, virtaddr_t va,
+				struct page_allocators *alloc,
+				void (*flush)(virtaddr_t va, void *ctx),
+				void *ctx, bool *collapsed)
+{
+	virtaddr_t next;
+
+	pagetable_lock(pgd.x, alloc);
+	pgde_t pgde = *pgde_at(pgd, virt_pgde_index(va));
+	if (!pgde_present(pgde)) {
+		pagetable_unlock(pgd.x, alloc);
+		return virt_next_pgde(va);
+	}
 	pudaddr_t pud = pgde_pud(pgde);
+	pagetable_lock(pud.x, alloc);
+	pagetable_unlock(pgd.x, alloc);
+
 	pude_t pude = *pude_at(pud, virt_pude_index(va));
-	if (!pude_present(pude))
-		alloc->panic("0x%lx: PUDE not present", va.x);
+	if (!pude_present(pude) || pude_1gib(pude)) {
+		pagetable_unlock(pud.x, alloc);
+		return virt_next_pude(va);
+	}
+	pmdaddr_t pmd = pude_pmd(pude);
+	pagetable_lock(pmd.x, alloc);
+	pagetable_unlock(pud.x, alloc);
+
+	next = virt_next_pmde(va);
+	pmde_t *pmde = pmde_at(pmd, virt_pmde_index(va));
+	if (!pmde_present(*pmde) || pmde_2mib(*pmde)) {
+		pagetable_unlock(pmd.x, alloc);
+		return next;
+	}
 
-	if (pude_1gib(pude)) {
-		*level_out = PUD;
-		return pude.x;
+	ptdaddr_t ptd = pmde_ptd(*pmde);
+	pagetable_lock(ptd.x, alloc);
+	uint64_t raw = ptd_to_2mib_pmde(ptd);
+	pagetable_unlock(ptd.x, alloc);
+	if (raw == 0) {
+		pagetable_unlock(pmd.x, alloc);
+		return next;
 	}
 
-	pmdaddr_t pmd = pude_pmd(pude);
-	pmde_t pmde = *pmde_at(pmd, virt_pmde_index(va));
-	if (!pmde_present(pmde))
-		alloc->panic("0x%lx: PMDE not present", va.x);
+	// A CPU must never be able to cache both the 4 KiB and 2 MiB
+	// translations for the range, so we unmap the PTD and flush before
+	// installing the 2 MiB page. Page table locks cannot be held across the
+	// flush, so we leave a placeholder which keeps other modifying walks
+	// out meanwhile. It also keeps the PMD, whose entry count is unchanged
+	// as we replace one entry with another, from being freed.
+	_atomic_store_release(&pmde->x, raw & ~PAGE_FLAG_PRESENT);
+	pagetable_unlock(pmd.x, alloc);
+
+	flush(va, ctx);
+
+	// No CPU can now reach the PTD, so its entries are final.
+	uint64_t ad_flags = clear_ptd_gather_ad(ptd);
+
+	// A clone may have made the placeholder copy-on-write meanwhile, so we
+	// install whatever it now holds.
+	pagetable_lock(pmd.x, alloc);
+	update_entry(&pmde->x, 0, PAGE_FLAG_PRESENT | ad_flags);
+	pagetable_unlock(pmd.x, alloc);
+
+	pagetable_lock(ptd.x, alloc);
+	pagetable_add_entries(ptd.x, -NUM_PAGE_TABLE_ENTRIES, alloc);
+	pagetable_unlock(ptd.x, alloc);
+
+	physaddr_t ptd_pa = {ptd.x};
+	alloc->free_pagetable(ptd_pa);
+	*collapsed = true;
+	return next;
+}
+
+uint64_t _collapse_page_range(pgdaddr_t pgd, virtaddr_t start_va,
+			      int64_t num_pages, struct page_allocators *alloc,
+			      void (*flush)(virtaddr_t va, void *ctx),
+			      void *ctx)
+{
+	if (!pagetable_tracked(alloc))
+		alloc->panic("Collapsing page range requires free_pagetable");
+
+	uint64_t num_collapsed = 0;
+	// Only PTDs which are entirely contained within the range are
+	// candidates.
+	virtaddr_t va = {ALIGN_UP(start_va.x, PAGE_SIZE_2MIB)};
+	uint64_t num_remaining = ALIGN(start_va.x + num_pages * PAGE_SIZE,
+				       PAGE_SIZE_2MIB) -
+				 va.x;
+
+	while ((int64_t)num_remaining > 0) {
+		bool collapsed = false;
+		virtaddr_t next = collapse_next(pgd, va, alloc, flush, ctx,
+						&collapsed);
+
+		if (collapsed)
+			num_collapsed++;
+
+		num_remaining -= next.x - va.x;
+		va = next;
+	}
+
+	return num_collapsed;
+}
+
+// Clone the present data page entry `*src_entry` mapping `num_pages` pages at
+// `pa`. If the page is reference counted we take a reference for the clone and,
+// if it is writable, make it read-only and copy-on-write in the source. Returns
+// the entry to place in the clone.
+static uint64_t clone_data_entry(uint64_t *src_entry, physaddr_t pa,
+				 uint64_t num_pages)
+{
+	uint64_t raw = _atomic_load_relaxed(src_entry);
+
+	// Pages not reference counted (e.g. device memory) are simply shared.
+	if (!phys_is_refcounted(pa))
+		return raw;
+
+	phys_get_range(pa, num_pages);
+	if (IS_MASK_SET(raw, PAGE_FLAG_RW))
+		raw = update_entry(src_entry, PAGE_FLAG_RW, PAGE_FLAG_COW);
+
+	return raw;
+}
+
+// Clone PTD entries from `src` into the newly allocated `dst`.
+// ASSUMES: `src` lock is held.
+static void clone_ptd(ptdaddr_t dst, ptdaddr_t src,
+		      struct page_allocators *alloc)
+{
+	int num_entries = 0;
+
+	for (int i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+		ptde_t *ptde = ptde_at(src, i);
+		if (!ptde_present(*ptde))
+			continue;
+
+		ptde_at(dst, i)->x = clone_data_entry(&ptde->x,
+						      ptde_data(*ptde), 1);
+		num_entries++;
+	}
+
+	pagetable_add_entries(dst.x, num_entries, alloc);
+}
+
+// Clone PMD entries from `src` into the newly allocated `dst`, allocating PTDs
+// as required. 2 MiB pages are shared as-is rather than split. Returns the
+// number of page tables allocated.
+// ASSUMES: `src` lock is held.
+static uint64_t clone_pmd(pmdaddr_t dst, pmdaddr_t src,
+			  struct page_allocators *alloc)
+{
+	uint64_t num_allocated = 0;
+	int num_entries = 0;
+
+	for (int i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+		pmde_t *pmde = pmde_at(src, i);
+		if (pmde_collapsing(*pmde)) {
+			// The PTD is being replaced by the 2 MiB page the
+			// placeholder describes, which we clone instead.
+			pmde_at(dst, i)->x =
+				clone_data_entry(&pmde->x, pmde_data_2mib(*pmde),
+						 NUM_PAGES_PTD) |
+				PAGE_FLAG_PRESENT;
+			num_entries++;
+			continue;
+		}
+		if (!pmde_present(*pmde))
+			continue;
+		num_entries++;
+
+		if (pmde_2mib(*pmde)) {
+			pmde_at(dst, i)->x = clone_data_entry(
+				&pmde->x, pmde_data_2mib(*pmde), NUM_PAGES_PTD);
+			continue;
+		}
+
+		ptdaddr_t src_ptd = pmde_ptd(*pmde);
+		ptdaddr_t ptd = alloc->ptd();
+		num_allocated++;
+
+		pagetable_lock(src_ptd.x, alloc);
+		clone_ptd(ptd, src_ptd, alloc);
+		pagetable_unlock(src_ptd.x, alloc);
+
+		assign_ptd(dst, i, ptd);
+	}
+
+	pagetable_add_entries(dst.x, num_entries, alloc);
+	return num_allocated;
+}
+
+// Clone PUD entries from `src` into the newly allocated `dst`, allocating PMDs
+// and PTDs as required. Returns the number of page tables allocated.
+// ASSUMES: `src` lock is held.
+static uint64_t clone_pud(pudaddr_t dst, pudaddr_t src,
+			  struct page_allocators *alloc)
+{
+	uint64_t num_allocated = 0;
+	int num_entries = 0;
+
+	for (int i = 0; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+		pude_t *pude = pude_at(src, i);
+		if (!pude_present(*pude))
+			continue;
+		num_entries++;
+
+		if (pude_1gib(*pude)) {
+			physaddr_t pa = pude_data_1gib(*pude);
+
+			// We cannot allocate a 1 GiB page to copy into.
+			if (IS_MASK_SET(pude->x, PAGE_FLAG_RW) &&
+			    phys_is_refcounted(pa))
+				alloc->panic(
+					"Cannot clone writable 1 GiB page at PA 0x%lx",
+					pa.x);
+
+			pude_at(dst, i)->x = clone_data_entry(&pude->x, pa,
+							      NUM_PAGES_PMD);
+			continue;
+		}
+
+		pmdaddr_t src_pmd = pude_pmd(*pude);
+		pmdaddr_t pmd = alloc->pmd();
+		num_allocated++;
+
+		pagetable_lock(src_pmd.x, alloc);
+		num_allocated += clone_pmd(pmd, src_pmd, alloc);
+		pagetable_unlock(src_pmd.x, alloc);
+
+		assign_pmd(dst, i, pmd);
+	}
+
+	pagetable_add_entries(dst.x, num_entries, alloc);
+	return num_allocated;
+}
+
+uint64_t _clone_pagetables(pgdaddr_t dst_pgd, pgdaddr_t src_pgd,
+			   struct page_allocators *alloc)
+{
+	if (!pagetable_tracked(alloc))
+		alloc->panic("Cloning page tables requires free_pagetable");
+
+	uint64_t num_allocated = 0;
+	int num_entries = 0;
+
+	// We hold each source page table's lock while cloning it, acquiring
+	// locks top-down, so the source cannot change beneath us. Nobody else
+	// can yet access the destination.
+	pagetable_lock(src_pgd.x, alloc);
+	for (int i = 0; i < PGD_KERNEL_START_INDEX; i++) {
+		pgde_t pgde = *pgde_at(src_pgd, i);
+		if (!pgde_present(pgde))
+			continue;
+		num_entries++;
+
+		pudaddr_t src_pud = pgde_pud(pgde);
+		pudaddr_t pud = alloc->pud();
+		num_allocated++;
+
+		pagetable_lock(src_pud.x, alloc);
+		num_allocated += clone_pud(pud, src_pud, alloc);
+		pagetable_unlock(src_pud.x, alloc);
+
+		assign_pud(dst_pgd, i, pud);
+	}
+	pagetable_unlock(src_pgd.x, alloc);
+
+	pagetable_add_entries(dst_pgd.x, num_entries, alloc);
+	return num_allocated;
+}
+
+// Break copy-on-write for the data page entry `*entry` mapping 2^order pages at
+// `pa`. See _break_cow().
+// ASSUMES: Lock is held on the page table containing `entry`.
+static bool break_cow_entry(uint64_t *entry, physaddr_t pa, uint8_t order,
+			    physaddr_t *old_pa)
+{
+	uint64_t raw = _atomic_load_relaxed(entry);
+	uint64_t num_pages = 1UL << order;
+
+	// Another CPU may have broken copy-on-write before we acquired the
+	// lock, in which case the fault was due to a stale TLB entry.
+	if (IS_MASK_SET(raw, PAGE_FLAG_RW))
+		return true;
+	if (!IS_MASK_SET(raw, PAGE_FLAG_COW))
+		return false;
+
+	// If we hold the only reference we can simply write to the page.
+	if (phys_range_exclusive(pa, num_pages)) {
+		update_entry(entry, PAGE_FLAG_COW, PAGE_FLAG_RW);
+		return true;
+	}
+
+	physaddr_t new_pa = phys_alloc(order, ALLOC_KERNEL);
+	memcpy(phys_to_virt_ptr(new_pa), phys_to_virt_ptr(pa),
+	       num_pages * PAGE_SIZE);
+
+	uint64_t pa_mask = order == 0 ? PAGE_TABLE_PHYS_ADDR_MASK
+				      : PAGE_TABLE_PHYS_ADDR_MASK_2MIB;
+	update_entry(entry, PAGE_FLAG_COW | pa_mask, PAGE_FLAG_RW | new_pa.x);
+	*old_pa = pa;
+	return true;
+}
+
+// Walk from the PGD locking hand-over-hand to the page table containing the
+// present data page entry mapping `va`, setting `*entry_out` to point at the
+// entry and `*table_pa_out` to the table, whose lock is held on return. Returns
+// the level of the table, or PGD with no lock held if `va` is not mapped.
+static page_level_t lock_data_entry(pgdaddr_t pgd, virtaddr_t va,
+				    struct page_allocators *alloc,
+				    uint64_t **entry_out, uint64_t *table_pa_out)
+{
+	pagetable_lock(pgd.x, alloc);
+	pgde_t pgde = *pgde_at(pgd, virt_pgde_index(va));
+	if (!pgde_present(pgde)) {
+		pagetable_unlock(pgd.x, alloc);
+		return PGD;
+	}
+	pudaddr_t pud = pgde_pud(pgde);
+	pagetable_lock(pud.x, alloc);
+	pagetable_unlock(pgd.x, alloc);
+
+	pude_t *pude = pude_at(pud, virt_pude_index(va));
+	if (!pude_present(*pude)) {
+		pagetable_unlock(pud.x, alloc);
+		return PGD;
+	} else if (pude_1gib(*pude)) {
+		*entry_out = &pude->x;
+		*table_pa_out = pud.x;
+		return PUD;
+	}
+	pmdaddr_t pmd = pude_pmd(*pude);
+	pagetable_lock(pmd.x, alloc);
+	pagetable_unlock(pud.x, alloc);
+
+	pmde_t *pmde = pmde_at(pmd, virt_pmde_index(va));
+	if (!pmde_present(*pmde)) {
+		pagetable_unlock(pmd.x, alloc);
+		return PGD;
+	} else if (pmde_2mib(*pmde)) {
+		*entry_out = &pmde->x;
+		*table_pa_out = pmd.x;
+		return PMD;
+	}
+	ptdaddr_t ptd = pmde_ptd(*pmde);
+	pagetable_lock(ptd.x, alloc);
+	pagetable_unlock(pmd.x, alloc);
+
+	ptde_t *ptde = ptde_at(ptd, virt_ptde_index(va));
+	if (!ptde_present(*ptde)) {
+		pagetable_unlock(ptd.x, alloc);
+		return PGD;
+	}
+	*entry_out = &ptde->x;
+	*table_pa_out = ptd.x;
+	return PTD;
+}
+
+bool _break_cow(pgdaddr_t pgd, virtaddr_t va, struct page_allocators *alloc,
+		physaddr_t *old_pa, uint64_t *num_pages)
+{
+	uint64_t *entry, table_pa;
+	bool ret = false;
+
+	old_pa->x = 0;
+	*num_pages = 0;
+
+	switch (lock_data_entry(pgd, va, alloc, &entry, &table_pa)) {
+	case PGD:
+		return false;
+	case PUD:
+		// 1 GiB pages are never made copy-on-write.
+		break;
+	case PMD:
+	{
+		pmde_t pmde = {*entry};
+		ret = break_cow_entry(entry, pmde_data_2mib(pmde),
+				      PMD_SHIFT - PAGE_SHIFT, old_pa);
+		*num_pages = NUM_PAGES_PTD;
+		break;
+	}
+	case PTD:
+	{
+		ptde_t ptde = {*entry};
+		ret = break_cow_entry(entry, ptde_data(ptde), 0, old_pa);
+		*num_pages = 1;
+		break;
+	}
+	}
+
+	pagetable_unlock(table_pa, alloc);
+	return ret;
+}
+
+bool _test_and_clear_accessed(pgdaddr_t pgd, virtaddr_t va,
+			      struct page_allocators *alloc)
+{
+	uint64_t *entry, table_pa;
+
+	if (lock_data_entry(pgd, va, alloc, &entry, &table_pa) == PGD)
+		return false;
+
+	// The CPU may concurrently set the accessed and dirty bits so we must
+	// clear atomically.
+	uint64_t prev = _atomic_fetch_and(entry, ~PAGE_FLAG_ACCESSED);
+	pagetable_unlock(table_pa, alloc);
+
+	return IS_MASK_SET(prev, PAGE_FLAG_ACCESSED);
+}
+
+bool _sync_kernel_pgde(pgdaddr_t pgd, pgdaddr_t kernel_pgd, virtaddr_t va,
+		       struct page_allocators *alloc)
+{
+	uint64_t index = virt_pgde_index(va);
+	pgde_t kernel_pgde = read_entry(pgde_at(kernel_pgd, index));
+
+	if (!pgde_present(kernel_pgde))
+		return false;
+
+	pagetable_lock(pgd.x, alloc);
+	pgde_t *pgde = pgde_at(pgd, index);
+	bool synced = !pgde_present(*pgde);
+	if (synced) {
+		// Kernel PUDs are never freed, so may be shared indefinitely.
+		pgde->x = kernel_pgde.x;
+		pagetable_add_entries(pgd.x, 1, alloc);
+	}
+	pagetable_unlock(pgd.x, alloc);
+
+	return synced;
+}
+
+page_level_t _walk_virt(pgdaddr_t pgd, virtaddr_t va, uint64_t *entry_out)
+{
+	pgde_t pgde = read_entry(pgde_at(pgd, virt_pgde_index(va)));
+	if (!pgde_present(pgde)) {
+		*entry_out = pgde.x;
+		return PGD;
+	}
+
+	pudaddr_t pud = pgde_pud(pgde);
+	pude_t pude = read_entry(pude_at(pud, virt_pude_index(va)));
+	if (!pude_present(pude) || pude_1gib(pude)) {
+		*entry_out = pude.x;
+		return PUD;
+	}
 
-	if (pmde_2mib(pmde)) {
-		*level_out = PMD;
-		return pmde.x;
+	pmdaddr_t pmd = pude_pmd(pude);
+	pmde_t pmde = read_entry(pmde_at(pmd, virt_pmde_index(va)));
+	if (!pmde_present(pmde) || pmde_2mib(pmde)) {
+		*entry_out = pmde.x;
+		return PMD;
 	}
 
 	ptdaddr_t ptd = pmde_ptd(pmde);
-	ptde_t ptde = *ptde_at(ptd, virt_ptde_index(va));
-	if (!ptde_present(ptde))
-		alloc->panic("0x%lx: PTDE not present", va.x);
+	ptde_t ptde = read_entry(ptde_at(ptd, virt_ptde_index(va)));
+	*entry_out = ptde.x;
+	return PTD;
+}
 
-	*level_out = PTD;
-	return ptde.x;
+// Walks page table entries from specified PGD and obtains entry pointing at
+// data page. Outputs level obtained from in `level_out`. Takes no locks.
+static uint64_t walk_to_data(pgdaddr_t pgd, virtaddr_t va,
+			     struct page_allocators *alloc,
+			     page_level_t *level_out)
+{
+	static const char *entry_names[] = {
+		[PGD] = "PGDE",
+		[PUD] = "PUDE",
+		[PMD] = "PMDE",
+		[PTD] = "PTDE",
+	};
+
+	uint64_t entry;
+	page_level_t level = _walk_virt(pgd, va, &entry);
+	if (!IS_BIT_SET(entry, PAGE_FLAG_PRESENT_BIT))
+		alloc->panic("0x%lx: %s not present", va.x, entry_names[level]);
+
+	*level_out = level;
+	return entry;
 }
 
 uint64_t _walk_virt_to_raw_flags(pgdaddr_t pgd, virtaddr_t va,
@@ -329,6 +1171,9 @@ static void dump_flags(struct page_dump_state *state)
 	if (IS_MASK_SET(flags, PAGE_FLAG_GLOBAL))
 		state->printf("Gl ");
 
+	if (IS_MASK_SET(flags, PAGE_FLAG_COW))
+		state->printf("Cw ");
+
 	if (!IS_MASK_SET(flags, PAGE_FLAG_NX))
 		state->printf("EX ");
 }
@@ -508,3 +1353,104 @@ void dump_mapped_pages(pgdaddr_t pgd, bool mask_huge_flag,
 	       state.num_pages_2mib, state.num_pages_1gib,
 	       bytes_to_human(total_bytes, buf, sizeof(buf)));
 }
+
+// Part of the page snapshot implementation - find the page table containing the
+// entry for `va` which is either non-present or maps a data page, placing a
+// pointer to the table in `*table_out` and returning its level. If an entry
+// referencing another page table is found this is the PGD.
+static page_level_t snapshot_table(pgdaddr_t pgd, virtaddr_t va,
+				   uint64_t **table_out)
+{
+	*table_out = &pgde_at(pgd, 0)->x;
+	pgde_t pgde = *pgde_at(pgd, virt_pgde_index(va));
+	if (!pgde_present(pgde))
+		return PGD;
+
+	pudaddr_t pud = pgde_pud(pgde);
+	*table_out = &pude_at(pud, 0)->x;
+	pude_t pude = *pude_at(pud, virt_pude_index(va));
+	if (!pude_present(pude) || pude_1gib(pude))
+		return PUD;
+
+	pmdaddr_t pmd = pude_pmd(pude);
+	*table_out = &pmde_at(pmd, 0)->x;
+	pmde_t pmde = *pmde_at(pmd, virt_pmde_index(va));
+	if (!pmde_present(pmde) || pmde_2mib(pmde))
+		return PMD;
+
+	*table_out = &ptde_at(pmde_ptd(pmde), 0)->x;
+	return PTD;
+}
+
+uint64_t page_snapshot_next(struct page_snapshot_iter *iter,
+			    struct page_snapshot_record *records,
+			    uint64_t max_records)
+{
+	static const uint64_t shifts[] = {
+		[PGD] = PGD_SHIFT,
+		[PUD] = PUD_SHIFT,
+		[PMD] = PMD_SHIFT,
+		[PTD] = PAGE_SHIFT,
+	};
+	const uint64_t ignore_flags = PAGE_FLAG_ACCESSED | PAGE_FLAG_DIRTY;
+	const uint64_t end = (uint64_t)NUM_PAGE_TABLE_ENTRIES << PGD_SHIFT;
+
+	struct page_snapshot_record *record = NULL;
+	uint64_t count = 0;
+
+	while (iter->va.x < end) {
+		uint64_t *table;
+		page_level_t level = snapshot_table(iter->pgd, iter->va, &table);
+		uint64_t shift = shifts[level];
+
+		// Scan the remainder of the table, descending again once we
+		// reach an entry which references another page table. Each
+		// entry we skip over covers the whole of its range so we skip
+		// non-present entries at upper levels in bulk.
+		uint64_t i = (iter->va.x >> shift) & PAGE_DIR_INDEX_MASK;
+		for (; i < NUM_PAGE_TABLE_ENTRIES; i++) {
+			uint64_t entry = table[i];
+
+			if (!IS_BIT_SET(entry, PAGE_FLAG_PRESENT_BIT)) {
+				record = NULL;
+				goto next;
+			}
+
+			bool data = level == PTD ||
+				    (level != PGD &&
+				     IS_BIT_SET(entry, PAGE_FLAG_PSE_BIT));
+			if (!data)
+				break;
+
+			uint64_t flags = entry & PAGE_TABLE_FLAG_MASK;
+			flags &= ~ignore_flags;
+			if (record == NULL || record->level != level ||
+			    record->raw_flags != flags ||
+			    record->num_pages == (uint32_t)~0U) {
+				// We only ever stop at the start of a record
+				// so records are never split between calls.
+				if (count == max_records)
+					return count;
+
+				record = &records[count++];
+				record->start = iter->va;
+				// Sign-extend VAs.
+				if (IS_BIT_SET(iter->va.x, PHYS_ADDR_BITS - 1))
+					record->start.x |=
+						BIT_MASK_ABOVE(PHYS_ADDR_BITS);
+				record->raw_flags = flags;
+				record->num_pages = 0;
+				record->level = level;
+				memset(record->reserved, 0,
+				       sizeof(record->reserved));
+			}
+			record->num_pages++;
+		next:
+			// Align as page tables may have changed since the
+			// previous call.
+			iter->va.x = ((iter->va.x >> shift) + 1) << shift;
+		}
+	}
+
+	return count;
+}
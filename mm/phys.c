@@ -35,6 +35,16 @@ struct phys_alloc_state *phys_get_alloc_state_lock(void)
 	return alloc_state;
 }
 
+void phys_get_stats(struct phys_alloc_stats *stats)
+{
+	uint64_t seq;
+
+	do {
+		seq = read_seqcount_begin(&alloc_state->stats_seq);
+		*stats = alloc_state->stats;
+	} while (read_seqcount_retry(&alloc_state->stats_seq, seq));
+}
+
 // Obtain the buddy physblock for a specified physblock if is within available
 // memory range, if not returns NULL.
 // ASSUMES: `block` has lock held.
@@ -92,8 +102,10 @@ static struct physblock *_join_physblocks_locked(struct physblock *head,
 
 	// General stats do not change, but order ones do!
 	struct phys_alloc_stats *stats = &alloc_state->stats;
+	write_seqcount_begin(&alloc_state->stats_seq);
 	stats->order[order - 1].num_free_pages -= 2;
 	stats->order[order].num_free_pages++;
+	write_seqcount_end(&alloc_state->stats_seq);
 
 	return head;
 }
@@ -147,9 +159,11 @@ static void free_physblock_locked(struct physblock *block)
 
 	struct phys_alloc_stats *stats = &alloc_state->stats;
 
-	switch ((block->type & PHYSBLOCK_TYPE_MASK)) {
-	case PHYSBLOCK_FREE:
+	if ((block->type & PHYSBLOCK_TYPE_MASK) == PHYSBLOCK_FREE)
 		goto compact;
+
+	write_seqcount_begin(&alloc_state->stats_seq);
+	switch ((block->type & PHYSBLOCK_TYPE_MASK)) {
 	case PHYSBLOCK_PAGETABLE:
 		stats->num_pagetable_pages--;
 		break;
@@ -159,11 +173,12 @@ static void free_physblock_locked(struct physblock *block)
 	default:
 		break;
 	}
+	stats->num_free_4k_pages += 1UL << order;
+	stats->order[order].num_free_pages++;
+	write_seqcount_end(&alloc_state->stats_seq);
 
 	block->type = PHYSBLOCK_FREE;
 	list_push_back(&alloc_state->free_lists[order], &block->node);
-	stats->num_free_4k_pages += 1UL << order;
-	stats->order[order].num_free_pages++;
 compact:
 	block = compact_free_blocks_locked(block);
 	spinlock_release(&alloc_state->lock);
@@ -183,7 +198,9 @@ static void phys_alloc_init_span(struct phys_alloc_span *span)
 
 	struct phys_alloc_stats *stats = &alloc_state->stats;
 
+	write_seqcount_begin(&alloc_state->stats_seq);
 	stats->num_4k_pages += span->num_pages;
+	write_seqcount_end(&alloc_state->stats_seq);
 
 	pfn_t pfn = {span->start_pfn.x};
 	for (uint64_t i = 0; i < span->num_pages; i++, pfn.x++) {
@@ -196,12 +213,14 @@ static void phys_alloc_init_span(struct phys_alloc_span *span)
 
 			free_physblock_locked(block);
 		} else {
+			write_seqcount_begin(&alloc_state->stats_seq);
 			if ((block->type & PHYSBLOCK_TYPE_MASK) ==
 			    PHYSBLOCK_PAGETABLE)
 				stats->num_pagetable_pages++;
 			else if ((block->type & PHYSBLOCK_TYPE_MASK) ==
 				 PHYSBLOCK_PHYSBLOCK)
 				stats->num_physblock_pages++;
+			write_seqcount_end(&alloc_state->stats_seq);
 
 			spinlock_release(&block->lock);
 		}
@@ -234,8 +253,10 @@ static void split_block_locked(struct physblock *block)
 	list_push_back(free_list, &block->node);
 	list_push_back(free_list, &buddy->node);
 
+	write_seqcount_begin(&alloc_state->stats_seq);
 	stats->order[new_order + 1].num_free_pages--;
 	stats->order[new_order].num_free_pages += 2;
+	write_seqcount_end(&alloc_state->stats_seq);
 
 	spinlock_release(&block->lock);
 }
@@ -287,6 +308,85 @@ void phys_free_pfn(pfn_t pfn)
 	free_physblock_locked(block);
 }
 
+bool phys_is_refcounted(physaddr_t pa)
+{
+	pfn_t pfn = phys_to_pfn(pa);
+
+	// Spans are never changed after initialisation so we need not hold the
+	// allocator lock.
+	if (pfn_to_span_locked(pfn) < 0)
+		return false;
+
+	struct physblock *block = pfn_to_physblock_lock(pfn);
+	physblock_type_t type = block->type & PHYSBLOCK_TYPE_MASK;
+	bool ret = type != PHYSBLOCK_UNMANAGED && type != PHYSBLOCK_FREE &&
+		   block->refcount > 0;
+	spinlock_release(&block->lock);
+
+	return ret;
+}
+
+// Invoke `fn` on each (head) physblock comprising [pa, pa + num_pages) with its
+// lock held. `fn` is responsible for releasing the lock. Returns false as soon
+// as `fn` does.
+static bool for_each_physblock_in_range(physaddr_t pa, uint64_t num_pages,
+					bool (*fn)(struct physblock *block))
+{
+	pfn_t pfn = phys_to_pfn(pa);
+	uint64_t end = pfn.x + num_pages;
+
+	while (pfn.x < end) {
+		struct physblock *block = pfn_to_physblock_lock(pfn);
+		pfn_t next = {physblock_to_pfn(block).x + (1UL << block->order)};
+
+		if (!fn(block))
+			return false;
+
+		pfn = next;
+	}
+
+	return true;
+}
+
+// Increment the reference count of a locked physblock and unlock it.
+static bool get_physblock_locked(struct physblock *block)
+{
+	block->refcount++;
+	spinlock_release(&block->lock);
+	return true;
+}
+
+// Drop a reference to a locked physblock, which unlocks it.
+static bool put_physblock_locked(struct physblock *block)
+{
+	free_physblock_locked(block);
+	return true;
+}
+
+// Determine whether a locked physblock has a single reference and unlock it.
+static bool physblock_exclusive_locked(struct physblock *block)
+{
+	bool ret = block->refcount == 1;
+	spinlock_release(&block->lock);
+	return ret;
+}
+
+void phys_get_range(physaddr_t pa, uint64_t num_pages)
+{
+	for_each_physblock_in_range(pa, num_pages, get_physblock_locked);
+}
+
+void phys_put_range(physaddr_t pa, uint64_t num_pages)
+{
+	for_each_physblock_in_range(pa, num_pages, put_physblock_locked);
+}
+
+bool phys_range_exclusive(physaddr_t pa, uint64_t num_pages)
+{
+	return for_each_physblock_in_range(pa, num_pages,
+					   physblock_exclusive_locked);
+}
+
 int pfn_to_span_locked(pfn_t pfn)
 {
 	for (int i = 0; i < (int)alloc_state->num_spans; i++) {
@@ -369,6 +469,7 @@ struct physblock *phys_alloc_block(uint8_t order, alloc_flags_t flags)
 	block->type = alloc_flags_to_physblock_type(flags);
 	block->refcount++;
 
+	write_seqcount_begin(&alloc_state->stats_seq);
 	stats->num_free_4k_pages -= num_4k_pages;
 	stats->order[order].num_free_pages--;
 
@@ -376,6 +477,8 @@ struct physblock *phys_alloc_block(uint8_t order, alloc_flags_t flags)
 	switch (flags & ALLOC_TYPE_MASK) {
 	case ALLOC_PAGETABLE:
 		stats->num_pagetable_pages++;
+		block->pagetable.num_entries = 0;
+		block->pagetable.lock = empty_spinlock();
 		break;
 	case ALLOC_PHYSBLOCK:
 		stats->num_physblock_pages++;
@@ -383,6 +486,7 @@ struct physblock *phys_alloc_block(uint8_t order, alloc_flags_t flags)
 	default:
 		break;
 	}
+	write_seqcount_end(&alloc_state->stats_seq);
 
 	spinlock_release(&block->lock);
 	spinlock_release(&alloc_state->lock);
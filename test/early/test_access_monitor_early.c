@@ -0,0 +1,82 @@
+#include "test_early.h"
+
+const char *test_access_monitor(void)
+{
+	struct address_space *as = &kernel_address_space;
+	struct access_monitor mon;
+	struct access_monitor_params params = {
+		.samples_per_aggregation = 4,
+		.min_regions = 2,
+		.max_regions = 16,
+		.merge_threshold = 1,
+	};
+
+	// Map 64 pages, of which we only ever access the first 32.
+	uint64_t num_pages = 64;
+	uint64_t num_hot_pages = num_pages / 2;
+	virtaddr_t start = {KERNEL_VMALLOC_ADDRESS};
+	virtaddr_t cold = virt_offset_pages(start, num_hot_pages);
+	virtaddr_t end = virt_offset_pages(start, num_pages);
+	physaddr_t pa = phys_alloc(6, ALLOC_KERNEL);
+	address_space_map(as, start, pa, num_pages, MAP_KERNEL);
+
+	access_monitor_init(&mon, as, start, num_pages, &params);
+	assert(mon.num_regions == 2, "Range not split into min regions?");
+
+	for (int i = 0; i < 12; i++) {
+		// Ensure the CPU walks the page tables and sets the accessed
+		// flag again.
+		tlb_flush_all(as);
+		for (uint64_t j = 0; j < num_hot_pages; j++) {
+			virtaddr_t va = virt_offset_pages(start, j);
+			volatile uint8_t *ptr = (volatile uint8_t *)va.x;
+
+			(void)*ptr;
+		}
+
+		access_monitor_sample(&mon);
+	}
+	assert(mon.num_aggregations == 3, "Unexpected aggregation count?");
+
+	assert(access_monitor_heat(&mon, start) == 4, "First page not hot?");
+	virtaddr_t last_hot = virt_offset_pages(start, num_hot_pages - 1);
+	assert(access_monitor_heat(&mon, last_hot) == 4,
+	       "Last hot page not hot?");
+	assert(access_monitor_heat(&mon, cold) == 0, "First cold page hot?");
+	virtaddr_t last_cold = virt_offset_pages(start, num_pages - 1);
+	assert(access_monitor_heat(&mon, last_cold) == 0,
+	       "Last cold page hot?");
+	assert(access_monitor_heat(&mon, end) == 0, "Unmonitored page hot?");
+
+	// Regions must be ordered, contiguous and cover the whole range.
+	virtaddr_t next = start;
+	uint32_t count = 0;
+	for_each_list_element (&mon.regions, region, struct access_region,
+			       node) {
+		assert(region->start.x == next.x, "Region not contiguous?");
+		assert(region->end.x > region->start.x, "Empty region?");
+		next = region->end;
+		count++;
+	}
+	assert(next.x == end.x, "Regions do not cover range?");
+	assert(count == mon.num_regions, "Region count mismatch?");
+	assert(count >= params.min_regions && count <= params.max_regions,
+	       "Region count out of bounds?");
+
+	uint64_t histogram[5];
+	access_monitor_histogram(&mon, histogram, ARRAY_COUNT(histogram));
+	assert(histogram[0] == num_pages - num_hot_pages,
+	       "Cold histogram bucket incorrect?");
+	assert(histogram[1] == 0 && histogram[2] == 0 && histogram[3] == 0,
+	       "Intermediate histogram bucket non-zero?");
+	assert(histogram[4] == num_hot_pages,
+	       "Hot histogram bucket incorrect?");
+
+	access_monitor_destroy(&mon);
+	assert(list_empty(&mon.regions), "Regions not released?");
+
+	address_space_unmap(as, start, num_pages);
+	phys_free(pa);
+
+	return NULL;
+}
@@ -0,0 +1,67 @@
+#include "test_early.h"
+
+// Determine whether `class` has been registered.
+static bool class_registered(struct lockstat_class *class)
+{
+	for (struct lockstat_class *curr = lockstat_classes(); curr != NULL;
+	     curr = curr->next) {
+		if (curr == class)
+			return true;
+	}
+
+	return false;
+}
+
+const char *test_lockstat(void)
+{
+	static struct lockstat_class class_a = LOCKSTAT_CLASS_INIT("test a");
+	static struct lockstat_class class_b = LOCKSTAT_CLASS_INIT("test b");
+	spinlock_t lock_a = empty_spinlock();
+	spinlock_t lock_b = empty_spinlock();
+
+	assert(!class_registered(&class_a), "Unused class registered?");
+
+	lockstat_acquire(&lock_a, &class_a);
+	assert(spinlock_is_locked(&lock_a), "Lock not acquired?");
+	assert(class_registered(&class_a), "Class not registered?");
+	assert(atomic_load_relaxed(&class_a.acquisitions) == 1,
+	       "Acquisition not counted?");
+	assert(atomic_load_relaxed(&class_a.contended) == 0,
+	       "Uncontended acquisition counted as contended?");
+	assert(atomic_load_relaxed(&class_a.wait_cycles) == 0,
+	       "Uncontended acquisition waited?");
+
+	// Release out of order.
+	lockstat_acquire(&lock_b, &class_b);
+	lockstat_release(&lock_a);
+	spinlock_release(&lock_a);
+	assert(atomic_load_relaxed(&class_a.hold_cycles) > 0,
+	       "Hold time not recorded?");
+	assert(atomic_load_relaxed(&class_a.max_hold_cycles) ==
+		       atomic_load_relaxed(&class_a.hold_cycles),
+	       "Max hold time incorrect?");
+	assert(atomic_load_relaxed(&class_b.hold_cycles) == 0,
+	       "Hold time recorded against wrong class?");
+
+	lockstat_release(&lock_b);
+	spinlock_release(&lock_b);
+	assert(atomic_load_relaxed(&class_b.hold_cycles) > 0,
+	       "Hold time not recorded after out of order release?");
+
+	// Releasing an uninstrumented lock must not disturb the held stack.
+	assert(spinlock_try_acquire(&lock_b), "Lock not acquired?");
+	lockstat_acquire(&lock_a, &class_a);
+	uint64_t hold = atomic_load_relaxed(&class_a.hold_cycles);
+	lockstat_release(&lock_b);
+	spinlock_release(&lock_b);
+	lockstat_release(&lock_a);
+	spinlock_release(&lock_a);
+	assert(atomic_load_relaxed(&class_a.acquisitions) == 2,
+	       "Reacquisition not counted?");
+	assert(atomic_load_relaxed(&class_a.hold_cycles) > hold,
+	       "Hold time lost after uninstrumented release?");
+
+	lockstat_log();
+
+	return NULL;
+}
@@ -0,0 +1,109 @@
+#include "test_early.h"
+
+// Set whether log entries are echoed, returning the previous setting.
+static bool set_log_echo(bool echo)
+{
+	uint64_t irq_flags;
+	struct kernel_global *global = global_get_locked(&irq_flags);
+	bool prev = global->log_echo;
+
+	global->log_echo = echo;
+	global_release(global, irq_flags);
+
+	return prev;
+}
+
+// Read the next entry, expecting it to contain `buf` and to directly follow
+// `*seq`, which is updated.
+static const char *expect_entry(struct kernel_log_reader *reader,
+				const char *buf, uint64_t *seq)
+{
+	struct kernel_log_entry entry;
+
+	assert(kernel_log_read(reader, &entry), "Entry not read?");
+	assert(strcmp(entry.buf, buf) == 0, "Incorrect entry?");
+	assert(entry.seq.x == *seq + 1, "Entries not in sequence?");
+	*seq = entry.seq.x;
+
+	return NULL;
+}
+
+static const char *test_log_entries(void)
+{
+	struct kernel_log_reader reader;
+	struct kernel_log_entry entry;
+	uint64_t seq = 0;
+
+	// Skip past anything logged before we started.
+	kernel_log_reader_init(&reader);
+	while (kernel_log_read(&reader, &entry))
+		seq = entry.seq.x;
+
+	log_info("test %d", 1);
+	assert(kernel_log_read(&reader, &entry), "Entry not read?");
+	assert(strcmp(entry.buf, "test 1") == 0, "Incorrect entry?");
+	assert(entry.flags == KERNEL_LOG_INFO, "Incorrect flags?");
+	assert(entry.seq.x > seq, "Sequence number not increasing?");
+	assert(entry.timestamp != 0, "No timestamp?");
+	seq = entry.seq.x;
+	assert(!kernel_log_read(&reader, &entry), "Unexpected entry?");
+
+	// Entries below the log level are not recorded.
+	log_trace("not recorded");
+	assert(!kernel_log_read(&reader, &entry), "Trace entry recorded?");
+
+	// Entries logged on a CPU without a ring buffer are not recorded. We
+	// masquerade as CPU 2 by switching to its per-CPU area.
+	percpu_init_cpu(2);
+	log_info("not recorded");
+	percpu_init_cpu(0);
+	assert(!kernel_log_read(&reader, &entry),
+	       "Entry recorded without ring buffer?");
+
+	// Entries logged on different CPUs are merged in sequence order.
+	percpu_init_cpu(1);
+	kernel_log_init_cpu();
+	log_info("a");
+	percpu_init_cpu(0);
+	log_info("b");
+	percpu_init_cpu(1);
+	log_info("c");
+	log_info("d");
+	percpu_init_cpu(0);
+	log_info("e");
+
+	const char *res;
+	const char *expected[] = {"a", "b", "c", "d", "e"};
+	for (uint64_t i = 0; i < ARRAY_COUNT(expected); i++) {
+		res = expect_entry(&reader, expected[i], &seq);
+		if (res != NULL)
+			return res;
+	}
+	assert(!kernel_log_read(&reader, &entry), "Unexpected entry?");
+
+	// Overwritten entries are skipped.
+	char buf[KERNEL_LOG_BUF_SIZE];
+	for (uint64_t i = 0; i < KERNEL_LOG_RING_NUM_ENTRIES + 10; i++) {
+		log_info("overflow %lu", i);
+	}
+	seq += 10;
+	for (uint64_t i = 10; i < KERNEL_LOG_RING_NUM_ENTRIES + 10; i++) {
+		snprintf(buf, KERNEL_LOG_BUF_SIZE, "overflow %lu", i);
+		res = expect_entry(&reader, buf, &seq);
+		if (res != NULL)
+			return res;
+	}
+	assert(!kernel_log_read(&reader, &entry), "Unexpected entry?");
+
+	return NULL;
+}
+
+const char *test_log(void)
+{
+	// Avoid flooding the output.
+	bool prev_echo = set_log_echo(false);
+	const char *res = test_log_entries();
+	set_log_echo(prev_echo);
+
+	return res;
+}
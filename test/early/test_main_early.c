@@ -16,6 +16,10 @@ void main(void)
 	if (res != NULL)
 		early_puts(res);
 
+	res = test_boot_trace();
+	if (res != NULL)
+		early_puts(res);
+
 	res = test_mem();
 	if (res != NULL)
 		early_puts(res);
@@ -32,6 +36,63 @@ void main(void)
 	if (res != NULL)
 		early_puts(res);
 
+	// Tests after this point rely on per-CPU areas and the kernel log being
+	// set up.
+	percpu_init();
+	kernel_log_init();
+
+	// Tests after this point rely on interrupt descriptors being
+	// initialised.
+	interrupt_init();
+
+	res = test_percpu();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_log();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_lockstat();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_tlb();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_tlb_shootdown();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_page_unmap();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_page_collapse();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_page_fault();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_page_cow();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_page_snapshot();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_access_monitor();
+	if (res != NULL)
+		early_puts(res);
+
+	res = test_rcu();
+	if (res != NULL)
+		early_puts(res);
+
 	early_puts("// zeptux EARLY test run complete");
 	exit_qemu();
 }
@@ -446,6 +446,40 @@ const char *assert_early_page_alloc_correct(void)
 	early_free_ptd(ptd);
 	assert(state->num_allocated_pages == num_alloc - 4, "PTD not freed");
 
+	// Contiguous allocations are not limited to a single bitmap word.
+	num_alloc = state->num_allocated_pages;
+	pa = early_pages_alloc(200);
+	assert(state->num_allocated_pages == num_alloc + 200,
+	       "Contiguous allocation not counted?");
+	physaddr_t curr = pa;
+	for (int i = 0; i < 200; i++, curr = phys_next_page(curr)) {
+		early_page_free(curr);
+	}
+	assert(state->num_allocated_pages == num_alloc,
+	       "Contiguous allocation not freed?");
+
+	// No page before the next-fit cursor may be free and the summary bitmap
+	// must reflect which alloc bitmap words are full.
+	for (int i = 0; i < (int)state->num_spans; i++) {
+		span = &state->spans[i];
+
+		bool full = true;
+		for (uint64_t j = 0; j < span->num_pages; j++) {
+			if (!bitmap_is_set(span->alloc_bitmap, j)) {
+				assert(j >= span->next_offset,
+				       "Free page before next-fit cursor?");
+				full = false;
+			}
+
+			if (j % 64 != 63 && j != span->num_pages - 1)
+				continue;
+
+			assert(bitmap_is_set(span->full_bitmap, j / 64) == full,
+			       "Summary bitmap incorrect?");
+			full = true;
+		}
+	}
+
 	return NULL;
 }
 
@@ -516,6 +550,34 @@ static const char *assert_early_map_direct_correct(struct early_boot_info *info)
 	return NULL;
 }
 
+// Count the number of leaf page table entries (i.e. TLB entries required) which
+// map [va, va + num_bytes) under the specified PGD.
+static uint64_t count_leaf_mappings(pgdaddr_t pgd, virtaddr_t va,
+				   uint64_t num_bytes)
+{
+	uint64_t end = va.x + num_bytes;
+	uint64_t count = 0;
+
+	while (va.x < end) {
+		uint64_t entry;
+
+		switch (_walk_virt(pgd, va, &entry)) {
+		case PUD:
+			va = virt_next_pude(va);
+			break;
+		case PMD:
+			va = virt_next_pmde(va);
+			break;
+		default:
+			va = virt_next_page(va);
+			break;
+		}
+		count++;
+	}
+
+	return count;
+}
+
 static const char *assert_early_map_kernel_elf_correct(void)
 {
 	// We will use the actual kernel ELF image to ensure that we map as
@@ -557,12 +619,158 @@ static const char *assert_early_map_kernel_elf_correct(void)
 		assert(_walk_virt_to_phys(pgd, va, &alloc).x ==
 			       KERNEL_ELF_ADDRESS_PHYS + sect_header->offset,
 		       "Misassigned ELF section PA");
+
+		// Read-only sections linked on 2 MiB boundaries (see
+		// kernel/kernel-2mib.ld) should be mapped using 2 MiB pages
+		// only.
+		uint64_t num_walks =
+			count_leaf_mappings(pgd, va, sect_header->size);
+		if (!IS_MASK_SET(sect_header->flags, ELF_SHF_WRITE) &&
+		    IS_ALIGNED(va.x, PAGE_SIZE_2MIB)) {
+			assert(IS_MASK_SET(flags, PAGE_FLAG_PSE),
+			       "2 MiB-aligned section not mapped with PSE?");
+			assert(num_walks == ALIGN_UP(sect_header->size,
+						     PAGE_SIZE_2MIB) /
+						    PAGE_SIZE_2MIB,
+			       "2 MiB-aligned section mapped with 4 KiB pages?");
+		} else {
+			assert(num_walks <= bytes_to_pages(sect_header->size),
+			       "Section mapped with too many pages?");
+		}
+	}
+
+	// We permit some leaking again!
+	return NULL;
+}
+
+// The default kernel.ld links sections on 4 KiB boundaries, so mapping the
+// running image above never uses 2 MiB pages. Map a synthetic image laid out as
+// kernel/kernel-2mib.ld lays it out to check that those which can are.
+static const char *assert_early_map_kernel_elf_2mib_correct(void)
+{
+	struct {
+		uint64_t offset, size, flags;
+		uint64_t num_leaves;
+		bool pse;
+	} sects[] = {
+		// Text within a single 2 MiB page.
+		{1 * PAGE_SIZE_2MIB, 5 * PAGE_SIZE,
+		 ELF_SHF_ALLOC | ELF_SHF_EXECINSTR, 1, true},
+		// Rodata spilling into a second 2 MiB page.
+		{2 * PAGE_SIZE_2MIB, PAGE_SIZE_2MIB + PAGE_SIZE, ELF_SHF_ALLOC,
+		 2, true},
+		// Writable data is never mapped using 2 MiB pages.
+		{4 * PAGE_SIZE_2MIB, 2 * PAGE_SIZE,
+		 ELF_SHF_ALLOC | ELF_SHF_WRITE, 2, false},
+		// Read-only, but sharing its 2 MiB page with the next section.
+		{5 * PAGE_SIZE_2MIB, PAGE_SIZE, ELF_SHF_ALLOC, 1, false},
+		{5 * PAGE_SIZE_2MIB + PAGE_SIZE, PAGE_SIZE,
+		 ELF_SHF_ALLOC | ELF_SHF_WRITE, 1, false},
+	};
+
+	struct elf_header *header = phys_to_virt_ptr(early_page_alloc());
+	memset(header, 0, PAGE_SIZE);
+	header->shoff = sizeof(struct elf_header);
+	header->shnum = ARRAY_COUNT(sects) + 1;
+
+	// Section 0 is the null section, which is left zeroed.
+	struct elf_section_header *sect_headers = (void *)header + header->shoff;
+	for (int i = 0; i < (int)ARRAY_COUNT(sects); i++) {
+		struct elf_section_header *sect_header = &sect_headers[i + 1];
+
+		sect_header->type = ELF_SHT_PROGBITS;
+		sect_header->flags = sects[i].flags;
+		sect_header->addr = KERNEL_ELF_ADDRESS + sects[i].offset;
+		sect_header->offset = sects[i].offset;
+		sect_header->size = sects[i].size;
+	}
+
+	// Padding is only mapped if it was loaded, so pretend the synthetic
+	// image was. The PAs are never accessed.
+	struct early_boot_info *info = early_get_boot_info();
+	uint32_t prev_elf_size = info->kernel_elf_size_bytes;
+	info->kernel_elf_size_bytes = 5 * PAGE_SIZE_2MIB + 2 * PAGE_SIZE;
+
+	pgdaddr_t pgd = early_alloc_pgd();
+	physaddr_t elf_pa = {KERNEL_ELF_ADDRESS_PHYS};
+	early_map_kernel_elf(header, elf_pa, pgd);
+
+	info->kernel_elf_size_bytes = prev_elf_size;
+
+	for (int i = 0; i < (int)ARRAY_COUNT(sects); i++) {
+		virtaddr_t va = {KERNEL_ELF_ADDRESS + sects[i].offset};
+		uint64_t flags = _walk_virt_to_raw_flags(pgd, va, &alloc);
+
+		assert(_walk_virt_to_phys(pgd, va, &alloc).x ==
+			       elf_pa.x + sects[i].offset,
+		       "Misassigned synthetic ELF section PA");
+		assert(IS_MASK_SET(flags, PAGE_FLAG_PSE) == sects[i].pse,
+		       "Synthetic ELF section mapped with wrong page size?");
+		assert(count_leaf_mappings(pgd, va, sects[i].size) ==
+			       sects[i].num_leaves,
+		       "Synthetic ELF section mapped with wrong page count?");
+		if (!IS_MASK_SET(sects[i].flags, ELF_SHF_WRITE))
+			assert(!IS_BIT_SET(flags, PAGE_FLAG_RW_BIT),
+			       "Readonly synthetic ELF section is RW?");
 	}
 
 	// We permit some leaking again!
 	return NULL;
 }
 
+static const char *assert_mem_map_correct(void)
+{
+	struct early_page_alloc_state *alloc_state =
+		early_get_page_alloc_state();
+	uint64_t num_huge = 0;
+
+	for (int i = 0; i < (int)alloc_state->num_spans; i++) {
+		struct early_page_alloc_span *span = &alloc_state->spans[i];
+		uint64_t start = KERNEL_MEM_MAP_ADDRESS +
+				 phys_to_pfn(span->start).x *
+					 sizeof(struct physblock);
+		uint64_t end = start + span->num_pages * sizeof(struct physblock);
+		virtaddr_t va = {ALIGN(start, PAGE_SIZE)};
+
+		while (va.x < end) {
+			uint64_t entry;
+			page_level_t level = _walk_virt(kernel_root_pgd, va,
+							&entry);
+
+			assert(IS_BIT_SET(entry, PAGE_FLAG_PRESENT_BIT),
+			       "Mem map not mapped?");
+
+			// Every 2 MiB-aligned range the span's mem map covers
+			// should be mapped by a huge page.
+			bool covers_2mib = IS_ALIGNED(va.x, PAGE_SIZE_2MIB) &&
+					   va.x + PAGE_SIZE_2MIB <= end;
+			if (covers_2mib)
+				assert(level != PTD,
+				       "Mem map not mapped with huge page?");
+
+			switch (level) {
+			case PUD:
+				va = virt_next_pude(va);
+				num_huge++;
+				break;
+			case PMD:
+				va = virt_next_pmde(va);
+				num_huge++;
+				break;
+			default:
+				va = virt_next_page(va);
+				break;
+			}
+		}
+	}
+
+	// 2 MiB of physblocks describe 256 MiB of RAM, so we should have at
+	// least one huge page given the memory we run tests with.
+	assert(num_huge > 0, "No huge mem map pages?");
+
+	return NULL;
+}
+
 const char *test_mem(void)
 {
 	uint8_t buf[BUF_SIZE] = {0};
@@ -603,5 +811,13 @@ const char *test_mem(void)
 	if (ret != NULL)
 		return ret;
 
+	ret = assert_early_map_kernel_elf_2mib_correct();
+	if (ret != NULL)
+		return ret;
+
+	ret = assert_mem_map_correct();
+	if (ret != NULL)
+		return ret;
+
 	return NULL;
 }
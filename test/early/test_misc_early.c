@@ -42,3 +42,27 @@ const char *test_misc(void)
 
 	return NULL;
 }
+
+const char *test_boot_trace(void)
+{
+	uint64_t start_tsc, num_phases;
+	const struct boot_trace_phase *phases =
+		boot_trace_phases(&start_tsc, &num_phases);
+
+	// early_init() traces serial and video initialisation followed by each
+	// phase of early_mem_init().
+	assert(num_phases == 13, "Unexpected number of boot phases traced?");
+	assert(strcmp(phases[0].name, "early_serial_init_poll") == 0,
+	       "First boot phase not serial init?");
+	assert(strcmp(phases[num_phases - 1].name, "early_init_mem_map") == 0,
+	       "Last boot phase not mem map init?");
+
+	uint64_t prev_tsc = start_tsc;
+	for (uint64_t i = 0; i < num_phases; i++) {
+		assert(phases[i].end_tsc >= prev_tsc,
+		       "Boot phase TSC decreased?");
+		prev_tsc = phases[i].end_tsc;
+	}
+
+	return NULL;
+}
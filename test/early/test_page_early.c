@@ -841,3 +841,466 @@ const char *test_page(void)
 
 	return NULL;
 }
+
+// Retrieve the number of present entries tracked for a page table.
+static uint16_t pagetable_num_entries(uint64_t table_pa)
+{
+	physaddr_t pa = {table_pa};
+	struct physblock *block = phys_to_physblock_lock(pa);
+	uint16_t ret = block->pagetable.num_entries;
+
+	spinlock_release(&block->lock);
+	return ret;
+}
+
+// Determine whether the split lock for a page table is held.
+static bool pagetable_locked(uint64_t table_pa)
+{
+	physaddr_t pa = {table_pa};
+	struct physblock *block = _pfn_to_physblock_raw(phys_to_pfn(pa));
+
+	return spinlock_is_locked(&block->pagetable.lock);
+}
+
+const char *test_page_unmap(void)
+{
+	struct phys_alloc_state *state = phys_get_alloc_state_lock();
+	// We are single threaded at this point so no need for locks.
+	spinlock_release(&state->lock);
+	struct phys_alloc_stats *stats = &state->stats;
+	uint64_t num_pagetable_pages = stats->num_pagetable_pages;
+
+	struct address_space as;
+	address_space_create(&as);
+	assert(stats->num_pagetable_pages == num_pagetable_pages + 1,
+	       "PGD not allocated?");
+
+	// Map 3 x 4 KiB pages followed by a 2 MiB page in the same PMD.
+	virtaddr_t va = {0x400000000UL};
+	physaddr_t pa = {0x400000000UL};
+	uint64_t num_alloc = address_space_map(&as, va, pa, 3, MAP_KERNEL);
+	virtaddr_t va_2mib = {va.x + PAGE_SIZE_2MIB};
+	physaddr_t pa_2mib = {pa.x + PAGE_SIZE_2MIB};
+	num_alloc += address_space_map(&as, va_2mib, pa_2mib, NUM_PAGES_PTD,
+				       MAP_KERNEL);
+	assert(num_alloc == 3, "Allocated page tables != 3?");
+
+	pudaddr_t pud = pgde_pud(*pgde_at(as.pgd, virt_pgde_index(va)));
+	pmdaddr_t pmd = pude_pmd(*pude_at(pud, virt_pude_index(va)));
+	ptdaddr_t ptd = pmde_ptd(*pmde_at(pmd, virt_pmde_index(va)));
+	assert(pagetable_num_entries(pud.x) == 1, "PUD entry count != 1?");
+	assert(pagetable_num_entries(pmd.x) == 2, "PMD entry count != 2?");
+	assert(pagetable_num_entries(ptd.x) == 3, "PTD entry count != 3?");
+	assert(!pagetable_locked(as.pgd.x) && !pagetable_locked(pud.x) &&
+		       !pagetable_locked(pmd.x) && !pagetable_locked(ptd.x),
+	       "Page table lock not released?");
+
+	// Unmapping part of the PTD should not free it.
+	assert(address_space_unmap(&as, va, 1) == 0, "Page table freed?");
+	assert(pagetable_num_entries(ptd.x) == 2, "PTD entry count != 2?");
+
+	// Unmapping unmapped ranges should be a noop.
+	assert(address_space_unmap(&as, va, 1) == 0, "Page table freed?");
+	assert(pagetable_num_entries(ptd.x) == 2, "PTD entry count != 2?");
+
+	// Unmapping the remainder of the PTD should free it.
+	assert(address_space_unmap(&as, va, NUM_PAGES_PTD) == 1,
+	       "PTD not freed?");
+	assert(!pmde_present(*pmde_at(pmd, virt_pmde_index(va))),
+	       "PMDE referencing freed PTD present?");
+	assert(pagetable_num_entries(pmd.x) == 1, "PMD entry count != 1?");
+	assert(!pagetable_locked(as.pgd.x) && !pagetable_locked(pud.x) &&
+		       !pagetable_locked(pmd.x),
+	       "Page table lock not released?");
+
+	// Unmapping the 2 MiB page should free the PMD and PUD.
+	assert(address_space_unmap(&as, va_2mib, NUM_PAGES_PTD) == 2,
+	       "PMD, PUD not freed?");
+	assert(!pgde_present(*pgde_at(as.pgd, virt_pgde_index(va))),
+	       "PGDE referencing freed PUD present?");
+	assert(stats->num_pagetable_pages == num_pagetable_pages + 1,
+	       "Page tables leaked?");
+
+	physaddr_t pgd_pa = {as.pgd.x};
+	phys_free(pgd_pa);
+	assert(stats->num_pagetable_pages == num_pagetable_pages,
+	       "PGD not freed?");
+
+	return NULL;
+}
+
+const char *test_page_collapse(void)
+{
+	struct phys_alloc_state *state = phys_get_alloc_state_lock();
+	// We are single threaded at this point so no need for locks.
+	spinlock_release(&state->lock);
+	struct phys_alloc_stats *stats = &state->stats;
+
+	struct address_space as;
+	address_space_create(&as);
+
+	// Build up a 2 MiB-aligned contiguous range incrementally so it is
+	// mapped by 4 KiB pages, followed by a range which is not contiguous.
+	virtaddr_t va = {0x400000000UL};
+	physaddr_t pa = {0x400000000UL};
+	address_space_map(&as, va, pa, 1, MAP_KERNEL);
+	address_space_map(&as, virt_next_page(va), phys_next_page(pa),
+			  NUM_PAGES_PTD - 1, MAP_KERNEL);
+
+	virtaddr_t va2 = virt_offset_pages(va, NUM_PAGES_PTD);
+	physaddr_t pa2 = phys_offset_pages(pa, NUM_PAGES_PTD);
+	address_space_map(&as, va2, pa2, 1, MAP_KERNEL);
+	address_space_map(&as, virt_next_page(va2),
+			  phys_offset_pages(pa2, 2), NUM_PAGES_PTD - 1,
+			  MAP_KERNEL);
+
+	pudaddr_t pud = pgde_pud(*pgde_at(as.pgd, virt_pgde_index(va)));
+	pmdaddr_t pmd = pude_pmd(*pude_at(pud, virt_pude_index(va)));
+	pmde_t pmde = *pmde_at(pmd, virt_pmde_index(va));
+	assert(pmde_present(pmde) && !pmde_2mib(pmde), "Not mapped by PTD?");
+
+	// The 2 MiB page should inherit the dirty flag from any entry.
+	ptde_at(pmde_ptd(pmde), 7)->x |= PAGE_FLAG_DIRTY;
+
+	uint64_t num_pagetable_pages = stats->num_pagetable_pages;
+	assert(address_space_collapse(&as, va, 2 * NUM_PAGES_PTD) == 1,
+	       "Not exactly 1 PTD collapsed?");
+	assert(stats->num_pagetable_pages == num_pagetable_pages - 1,
+	       "PTD not freed?");
+
+	pmde = *pmde_at(pmd, virt_pmde_index(va));
+	assert(pmde_2mib(pmde), "Not collapsed to 2 MiB PMDE?");
+	assert(pmde_data_2mib(pmde).x == pa.x, "Incorrect 2 MiB mapping?");
+	assert(pmde_raw_flags_2mib(pmde) ==
+		       (map_flags_to_page_flags(MAP_KERNEL) | PAGE_FLAG_PSE |
+			PAGE_FLAG_DIRTY),
+	       "Incorrect 2 MiB flags?");
+	assert(_walk_virt_to_phys(as.pgd, virt_next_page(va),
+				  &kernel_page_allocators)
+			       .x == phys_next_page(pa).x,
+	       "_walk_virt_to_phys() mismatch?");
+
+	pmde = *pmde_at(pmd, virt_pmde_index(va2));
+	assert(!pmde_2mib(pmde), "Non-contiguous range collapsed?");
+
+	// Ranges not containing an entire PTD should not be collapsed.
+	assert(address_space_collapse(&as, virt_next_page(va2),
+				      NUM_PAGES_PTD) == 0,
+	       "Partial range collapsed?");
+
+	assert(address_space_unmap(&as, va, 2 * NUM_PAGES_PTD) == 3,
+	       "PTD, PMD, PUD not freed?");
+	physaddr_t pgd_pa = {as.pgd.x};
+	phys_free(pgd_pa);
+
+	return NULL;
+}
+
+const char *test_page_fault(void)
+{
+	struct address_space *as = &kernel_address_space;
+
+	// The region begins 1 page before a 2 MiB boundary and ends 1 page
+	// after the next.
+	virtaddr_t start = {KERNEL_VMALLOC_ADDRESS + PAGE_SIZE_2MIB - PAGE_SIZE};
+	uint64_t num_pages = NUM_PAGES_PTD + 2;
+	address_space_add_lazy_region(as, start, num_pages, MAP_KERNEL);
+
+	uint64_t entry;
+	_walk_virt(as->pgd, start, &entry);
+	assert(!IS_BIT_SET(entry, PAGE_FLAG_PRESENT_BIT),
+	       "Lazy region mapped before access?");
+
+	// The first page only partially covers its 2 MiB range so should be
+	// faulted in as a 4 KiB page.
+	volatile uint8_t *ptr = (volatile uint8_t *)start.x;
+	assert(*ptr == 0, "Faulted in page not zeroed?");
+	assert(_walk_virt(as->pgd, start, &entry) == PTD &&
+		       IS_BIT_SET(entry, PAGE_FLAG_PRESENT_BIT),
+	       "4 KiB page not faulted in?");
+
+	// The following pages entirely cover a 2 MiB range.
+	virtaddr_t va_2mib = virt_next_page(start);
+	ptr = (volatile uint8_t *)(va_2mib.x + PAGE_SIZE + 1234);
+	*ptr = 123;
+	assert(*ptr == 123, "Write to faulted in page lost?");
+	assert(_walk_virt(as->pgd, va_2mib, &entry) == PMD &&
+		       IS_MASK_SET(entry, PAGE_FLAG_PRESENT | PAGE_FLAG_PSE),
+	       "2 MiB page not faulted in?");
+
+	virtaddr_t last = virt_offset_pages(start, num_pages - 1);
+	ptr = (volatile uint8_t *)last.x;
+	*ptr = 45;
+	assert(_walk_virt(as->pgd, last, &entry) == PTD &&
+		       IS_BIT_SET(entry, PAGE_FLAG_PRESENT_BIT),
+	       "Last 4 KiB page not faulted in?");
+
+	address_space_remove_lazy_region(as, start);
+	assert(list_empty(&as->lazy_regions), "Lazy region not removed?");
+
+	physaddr_t pa_first = _walk_virt_to_phys(as->pgd, start, &alloc);
+	physaddr_t pa_2mib = _walk_virt_to_phys(as->pgd, va_2mib, &alloc);
+	physaddr_t pa_last = _walk_virt_to_phys(as->pgd, last, &alloc);
+	address_space_unmap(as, start, num_pages);
+	phys_free(pa_first);
+	phys_free(pa_2mib);
+	phys_free(pa_last);
+
+	// A kernel PGD entry added after an address space was created should be
+	// copied to it on first access.
+	struct address_space other;
+	address_space_create(&other);
+	virtaddr_t va_sync = {KERNEL_VMALLOC_ADDRESS + 8 * (1UL << PGD_SHIFT)};
+	uint64_t pgde_index = virt_pgde_index(va_sync);
+	physaddr_t pa_sync = phys_alloc_one();
+	address_space_map(as, va_sync, pa_sync, 1, MAP_KERNEL);
+	assert(!pgde_present(*pgde_at(other.pgd, pgde_index)),
+	       "Kernel PGDE present before access?");
+
+	struct address_space *prev = tlb_current();
+	tlb_switch(&other);
+	ptr = (volatile uint8_t *)va_sync.x;
+	*ptr = 67;
+	tlb_switch(prev);
+
+	assert(pgde_at(other.pgd, pgde_index)->x ==
+		       pgde_at(as->pgd, pgde_index)->x,
+	       "Kernel PGDE not synced on fault?");
+	assert(!address_space_sync_kernel(&other, va_sync),
+	       "Present kernel PGDE synced again?");
+	assert(*ptr == 67, "Write via synced PGDE lost?");
+
+	address_space_unmap(as, va_sync, 1);
+	phys_free(pa_sync);
+	physaddr_t pgd_pa = {other.pgd.x};
+	phys_free(pgd_pa);
+
+	return NULL;
+}
+
+// Obtain the reference count of the physblock containing `pa`.
+static uint32_t physblock_refcount(physaddr_t pa)
+{
+	struct physblock *block = phys_to_physblock_lock(pa);
+	uint32_t ret = block->refcount;
+
+	spinlock_release(&block->lock);
+	return ret;
+}
+
+const char *test_page_cow(void)
+{
+	struct address_space src, dst;
+	address_space_create(&src);
+
+	// Map a writable 4 KiB page, a writable 2 MiB page and a read-only
+	// 4 KiB page.
+	virtaddr_t va_4k = {0x400000000};
+	virtaddr_t va_2mib = {0x400200000};
+	virtaddr_t va_ro = {0x400400000};
+
+	physaddr_t pa_4k = phys_alloc_one();
+	physaddr_t pa_2mib = phys_alloc(PMD_SHIFT - PAGE_SHIFT, ALLOC_KERNEL);
+	physaddr_t pa_ro = phys_alloc_one();
+	address_space_map(&src, va_4k, pa_4k, 1, MAP_KERNEL_NOGLOBAL);
+	address_space_map(&src, va_2mib, pa_2mib, NUM_PAGES_PTD,
+			  MAP_KERNEL_NOGLOBAL);
+	address_space_map(&src, va_ro, pa_ro, 1,
+			  MAP_KERNEL_NOGLOBAL | MAP_READONLY);
+
+	uint8_t *ptr_4k = phys_to_virt_ptr(pa_4k);
+	uint8_t *ptr_2mib = phys_to_virt_ptr(pa_2mib);
+	ptr_4k[123] = 45;
+	ptr_2mib[PAGE_SIZE_2MIB - 1] = 67;
+
+	// PUD, PMD and PTD.
+	assert(address_space_clone(&dst, &src) == 3,
+	       "Unexpected number of page tables allocated on clone?");
+	assert(pagetable_num_entries(dst.pgd.x) ==
+		       pagetable_num_entries(src.pgd.x),
+	       "Clone PGD entry count mismatch?");
+
+	uint64_t flags = PAGE_FLAG_PRESENT | PAGE_FLAG_COW;
+	for (int i = 0; i < 2; i++) {
+		pgdaddr_t pgd = i == 0 ? src.pgd : dst.pgd;
+
+		uint64_t raw = _walk_virt_to_raw_flags(pgd, va_4k, &alloc);
+		assert(IS_MASK_SET(raw, flags) &&
+			       !IS_MASK_SET(raw, PAGE_FLAG_RW),
+		       "4 KiB page not copy-on-write?");
+		raw = _walk_virt_to_raw_flags(pgd, va_2mib, &alloc);
+		assert(IS_MASK_SET(raw, flags | PAGE_FLAG_PSE) &&
+			       !IS_MASK_SET(raw, PAGE_FLAG_RW),
+		       "2 MiB page not copy-on-write?");
+		raw = _walk_virt_to_raw_flags(pgd, va_ro, &alloc);
+		assert(!IS_MASK_SET(raw, PAGE_FLAG_COW),
+		       "Read-only page copy-on-write?");
+	}
+	assert(physblock_refcount(pa_4k) == 2, "4 KiB refcount != 2?");
+	assert(physblock_refcount(pa_2mib) == 2, "2 MiB refcount != 2?");
+	assert(physblock_refcount(pa_ro) == 2, "Read-only refcount != 2?");
+
+	fault_flags_t write_flags = FAULT_PROTECTION | FAULT_WRITE;
+	assert(!address_space_fault(&dst, va_ro, write_flags),
+	       "Write to read-only page handled?");
+	assert(!address_space_fault(&dst, va_4k, FAULT_PROTECTION),
+	       "Read protection fault handled?");
+
+	// The first write to a shared page copies it.
+	assert(address_space_fault(&dst, va_4k, write_flags),
+	       "4 KiB copy-on-write fault not handled?");
+	physaddr_t pa = _walk_virt_to_phys(dst.pgd, va_4k, &alloc);
+	assert(pa.x != pa_4k.x, "4 KiB page not copied?");
+	assert(((uint8_t *)phys_to_virt_ptr(pa))[123] == 45,
+	       "4 KiB page contents not copied?");
+	uint64_t raw = _walk_virt_to_raw_flags(dst.pgd, va_4k, &alloc);
+	assert(IS_MASK_SET(raw, PAGE_FLAG_RW) &&
+		       !IS_MASK_SET(raw, PAGE_FLAG_COW),
+	       "Copied 4 KiB page not writable?");
+	assert(physblock_refcount(pa_4k) == 1, "Old 4 KiB ref not dropped?");
+	physaddr_t pa_4k_copy = pa;
+
+	// The last remaining reference is simply made writable.
+	assert(address_space_fault(&src, va_4k, write_flags),
+	       "Exclusive 4 KiB fault not handled?");
+	pa = _walk_virt_to_phys(src.pgd, va_4k, &alloc);
+	assert(pa.x == pa_4k.x, "Exclusive 4 KiB page copied?");
+	raw = _walk_virt_to_raw_flags(src.pgd, va_4k, &alloc);
+	assert(IS_MASK_SET(raw, PAGE_FLAG_RW) &&
+		       !IS_MASK_SET(raw, PAGE_FLAG_COW),
+	       "Exclusive 4 KiB page not writable?");
+
+	// 2 MiB pages are copied whole rather than split.
+	virtaddr_t va = {va_2mib.x + PAGE_SIZE * 7};
+	assert(address_space_fault(&src, va, write_flags),
+	       "2 MiB copy-on-write fault not handled?");
+	uint64_t entry;
+	assert(_walk_virt(src.pgd, va, &entry) == PMD, "2 MiB page split?");
+	pa = _walk_virt_to_phys(src.pgd, va_2mib, &alloc);
+	assert(pa.x != pa_2mib.x, "2 MiB page not copied?");
+	assert(((uint8_t *)phys_to_virt_ptr(pa))[PAGE_SIZE_2MIB - 1] == 67,
+	       "2 MiB page contents not copied?");
+	physaddr_t pa_2mib_copy = pa;
+
+	assert(address_space_fault(&dst, va_2mib, write_flags),
+	       "Exclusive 2 MiB fault not handled?");
+	pa = _walk_virt_to_phys(dst.pgd, va_2mib, &alloc);
+	assert(pa.x == pa_2mib.x, "Exclusive 2 MiB page copied?");
+
+	// A fault on a page which is already writable is spurious.
+	assert(address_space_fault(&dst, va_2mib, write_flags),
+	       "Spurious fault not handled?");
+
+	address_space_unmap(&src, va_4k, NUM_PAGES_PTD * 3);
+	address_space_unmap(&dst, va_4k, NUM_PAGES_PTD * 3);
+	assert(pagetable_num_entries(src.pgd.x) ==
+		       pagetable_num_entries(dst.pgd.x),
+	       "Page tables not freed?");
+
+	phys_free(pa_4k);
+	phys_free(pa_4k_copy);
+	phys_free(pa_2mib);
+	phys_free(pa_2mib_copy);
+	phys_free(pa_ro);
+	phys_free(pa_ro);
+	assert(physblock_refcount(pa_ro) == 0, "Read-only page not freed?");
+
+	physaddr_t src_pgd = {src.pgd.x};
+	physaddr_t dst_pgd = {dst.pgd.x};
+	phys_free(src_pgd);
+	phys_free(dst_pgd);
+
+	return NULL;
+}
+
+const char *test_page_snapshot(void)
+{
+	static struct page_snapshot_record records[256];
+	static struct page_snapshot_record resumed[ARRAY_COUNT(records)];
+
+	struct address_space as;
+	address_space_create(&as);
+
+	// Map 3 writable 4 KiB pages followed by a read-only one, two
+	// contiguous 2 MiB pages, then a 4 KiB page in the next PGD entry.
+	virtaddr_t va_4k = {0x400000000};
+	virtaddr_t va_ro = virt_offset_pages(va_4k, 3);
+	virtaddr_t va_2mib = {0x400200000};
+	virtaddr_t va_far = {0x8000000000};
+
+	physaddr_t pa_4k = phys_alloc(2, ALLOC_KERNEL);
+	physaddr_t pa_2mib = phys_alloc(PMD_SHIFT - PAGE_SHIFT + 1, ALLOC_KERNEL);
+	physaddr_t pa_far = phys_alloc_one();
+	address_space_map(&as, va_4k, pa_4k, 3, MAP_KERNEL_NOGLOBAL);
+	address_space_map(&as, va_ro, phys_offset_pages(pa_4k, 3), 1,
+			  MAP_KERNEL_NOGLOBAL | MAP_READONLY);
+	address_space_map(&as, va_2mib, pa_2mib, NUM_PAGES_PTD * 2,
+			  MAP_KERNEL_NOGLOBAL);
+	address_space_map(&as, va_far, pa_far, 1, MAP_KERNEL_NOGLOBAL);
+
+	struct page_snapshot_iter iter;
+	page_snapshot_init(&iter, as.pgd);
+	uint64_t count = page_snapshot_next(&iter, records,
+					    ARRAY_COUNT(records));
+	assert(count > 4 && count < ARRAY_COUNT(records),
+	       "Unexpected snapshot record count?");
+	assert(page_snapshot_next(&iter, records, 1) == 0,
+	       "Snapshot not complete?");
+
+	struct page_snapshot_record *rec = &records[0];
+	assert(rec->start.x == va_4k.x && rec->level == PTD &&
+		       rec->num_pages == 3 &&
+		       IS_MASK_SET(rec->raw_flags, PAGE_FLAG_RW),
+	       "Writable 4 KiB record incorrect?");
+	rec = &records[1];
+	assert(rec->start.x == va_ro.x && rec->level == PTD &&
+		       rec->num_pages == 1 &&
+		       !IS_MASK_SET(rec->raw_flags, PAGE_FLAG_RW),
+	       "Read-only 4 KiB record incorrect?");
+	rec = &records[2];
+	assert(rec->start.x == va_2mib.x && rec->level == PMD &&
+		       rec->num_pages == 2 &&
+		       IS_MASK_SET(rec->raw_flags, PAGE_FLAG_PSE),
+	       "2 MiB record incorrect?");
+	rec = &records[3];
+	assert(rec->start.x == va_far.x && rec->level == PTD &&
+		       rec->num_pages == 1,
+	       "Far 4 KiB record incorrect?");
+
+	// The remaining records describe kernel mappings and must be
+	// sign-extended and ordered.
+	for (uint64_t i = 4; i < count; i++) {
+		rec = &records[i];
+		assert(IS_BIT_SET(rec->start.x, 63), "VA not sign-extended?");
+		assert(rec->start.x > records[i - 1].start.x,
+		       "Records not ordered?");
+	}
+
+	// Resuming one record at a time must produce identical output.
+	page_snapshot_init(&iter, as.pgd);
+	uint64_t resumed_count = 0;
+	while (page_snapshot_next(&iter, &resumed[resumed_count], 1) == 1) {
+		resumed_count++;
+		assert(resumed_count <= count, "Too many resumed records?");
+	}
+	assert(resumed_count == count, "Resumed record count mismatch?");
+	for (uint64_t i = 0; i < count; i++) {
+		struct page_snapshot_record *a = &records[i];
+		struct page_snapshot_record *b = &resumed[i];
+
+		assert(a->start.x == b->start.x && a->level == b->level &&
+			       a->num_pages == b->num_pages &&
+			       a->raw_flags == b->raw_flags,
+		       "Resumed records mismatch?");
+	}
+
+	address_space_unmap(&as, va_4k, NUM_PAGES_PTD * 3);
+	address_space_unmap(&as, va_far, 1);
+	phys_free(pa_4k);
+	phys_free(pa_2mib);
+	phys_free(pa_far);
+	physaddr_t pgd = {as.pgd.x};
+	phys_free(pgd);
+
+	return NULL;
+}
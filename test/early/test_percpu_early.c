@@ -0,0 +1,76 @@
+#include "test_early.h"
+
+static DEFINE_PER_CPU(uint8_t, test_percpu_u8);
+static DEFINE_PER_CPU(int32_t, test_percpu_s32);
+static DEFINE_PER_CPU(uint64_t, test_percpu_u64);
+static DEFINE_PER_CPU(uint64_t *, test_percpu_ptr);
+static DEFINE_PER_CPU(uint64_t[4], test_percpu_arr);
+
+const char *test_percpu(void)
+{
+	uint32_t cpu = cpu_id();
+
+	assert(cpu == 0, "Not on the boot CPU?");
+	assert(this_cpu_read(this_cpu_offset) == percpu_offsets[cpu],
+	       "this_cpu_offset does not match GS base?");
+	assert(this_cpu_read(this_cpu_offset) != 0, "Still using template?");
+
+	// Each CPU must have its own area, distinct from the template.
+	for (uint32_t i = 0; i < MAX_CPUS; i++) {
+		assert(per_cpu(cpu_number, i) == i, "Incorrect cpu_number?");
+		assert(per_cpu_ptr(test_percpu_u64, i) !=
+			       &PER_CPU_VAR(test_percpu_u64),
+		       "Per-CPU area aliases template?");
+		if (i > 0)
+			assert(per_cpu_ptr(test_percpu_u64, i) !=
+				       per_cpu_ptr(test_percpu_u64, i - 1),
+			       "Per-CPU areas overlap?");
+	}
+	assert(this_cpu_ptr(test_percpu_u64) ==
+		       per_cpu_ptr(test_percpu_u64, cpu),
+	       "this_cpu_ptr() != per_cpu_ptr() for this CPU?");
+
+	// Accessors must reference this CPU's area only.
+	this_cpu_write(test_percpu_u64, 0xdeadbeefcafe);
+	assert(this_cpu_read(test_percpu_u64) == 0xdeadbeefcafe,
+	       "this_cpu_write() not read back?");
+	assert(per_cpu(test_percpu_u64, cpu) == 0xdeadbeefcafe,
+	       "this_cpu_write() not visible via per_cpu()?");
+	assert(per_cpu(test_percpu_u64, 1) == 0, "Other CPU's copy modified?");
+	assert(PER_CPU_VAR(test_percpu_u64) == 0, "Template modified?");
+
+	per_cpu(test_percpu_u64, 1) = 1234;
+	assert(this_cpu_read(test_percpu_u64) == 0xdeadbeefcafe,
+	       "Other CPU's write visible on this CPU?");
+
+	this_cpu_add(test_percpu_u64, 2);
+	assert(this_cpu_read(test_percpu_u64) == 0xdeadbeefcb00,
+	       "this_cpu_add() incorrect?");
+
+	// Sub-word sizes must not touch neighbouring bytes.
+	this_cpu_write(test_percpu_u8, 0xff);
+	this_cpu_add(test_percpu_u8, 1);
+	assert(this_cpu_read(test_percpu_u8) == 0, "u8 did not wrap?");
+
+	this_cpu_write(test_percpu_s32, -5);
+	this_cpu_add(test_percpu_s32, 3);
+	assert(this_cpu_read(test_percpu_s32) == -2, "Signed add incorrect?");
+
+	uint64_t val = 42;
+	this_cpu_write(test_percpu_ptr, &val);
+	assert(*this_cpu_read(test_percpu_ptr) == 42, "Pointer read incorrect?");
+
+	// Aggregates are accessed via pointer.
+	(*this_cpu_ptr(test_percpu_arr))[3] = 7;
+	assert(per_cpu(test_percpu_arr, cpu)[3] == 7, "Array write lost?");
+
+	uint32_t count = 0;
+	uint32_t online_cpu;
+	for_each_cpu(online_cpu) {
+		assert(online_cpu == cpu, "Unexpected online CPU?");
+		count++;
+	}
+	assert(count == 1, "Incorrect number of online CPUs?");
+
+	return NULL;
+}
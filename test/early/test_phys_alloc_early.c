@@ -171,5 +171,24 @@ const char *test_phys_alloc(void)
 	assert(stats->num_free_4k_pages == num_4k_pages,
 	       "Stats not updated after free?");
 
+	// A stats snapshot should match the live stats and no write should be
+	// left in progress.
+	assert((atomic_load_relaxed(&state->stats_seq.sequence) & 1) == 0,
+	       "Stats sequence count left odd?");
+	struct phys_alloc_stats snapshot;
+	phys_get_stats(&snapshot);
+	assert(snapshot.num_4k_pages == stats->num_4k_pages &&
+		       snapshot.num_free_4k_pages == stats->num_free_4k_pages &&
+		       snapshot.num_pagetable_pages ==
+			       stats->num_pagetable_pages &&
+		       snapshot.num_physblock_pages ==
+			       stats->num_physblock_pages,
+	       "Stats snapshot mismatch?");
+	for (uint8_t order = 0; order <= MAX_ORDER; order++) {
+		assert(snapshot.order[order].num_free_pages ==
+			       stats->order[order].num_free_pages,
+		       "Order stats snapshot mismatch?");
+	}
+
 	return NULL;
 }
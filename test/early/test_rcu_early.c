@@ -0,0 +1,105 @@
+#include "test_early.h"
+
+struct rcu_test_elem {
+	int val;
+	struct list_node node;
+	struct rcu_head rcu;
+};
+
+static int num_invoked;
+
+static void count_invoked(struct rcu_head *head)
+{
+	IGNORE_PARAM(head);
+	num_invoked++;
+}
+
+static const char *test_rcu_callbacks(void)
+{
+	struct rcu_head heads[3];
+
+	num_invoked = 0;
+	call_rcu(&heads[0], count_invoked);
+	assert(rcu_num_pending_callbacks() == 1, "Callback not queued?");
+	assert(num_invoked == 0, "Callback invoked before grace period?");
+
+	// We are the only CPU so our quiescent state ends the grace period.
+	rcu_quiescent_state();
+	assert(num_invoked == 1, "Callback not invoked?");
+	assert(rcu_num_pending_callbacks() == 0, "Callback still pending?");
+
+	// Callbacks queued together should be invoked as a single batch.
+	for (int i = 0; i < 3; i++) {
+		call_rcu(&heads[i], count_invoked);
+	}
+	assert(rcu_num_pending_callbacks() == 3, "Callbacks not queued?");
+	rcu_quiescent_state();
+	assert(num_invoked == 4, "Batch not invoked?");
+	assert(rcu_num_pending_callbacks() == 0, "Batch still pending?");
+
+	// synchronize_rcu() must not wait on ourselves and also processes
+	// callbacks.
+	call_rcu(&heads[0], count_invoked);
+	synchronize_rcu();
+	assert(num_invoked == 5, "synchronize_rcu() didn't process callbacks?");
+
+	return NULL;
+}
+
+static const char *test_rcu_list(void)
+{
+	struct rcu_test_elem elems[4];
+	struct rcu_test_elem *elem;
+	LIST_DEFINE(list);
+
+	for (int i = 0; i < 4; i++) {
+		elems[i].val = i;
+	}
+
+	list_push_back_rcu(&list, &elems[1].node);
+	list_push_back_rcu(&list, &elems[3].node);
+	list_push_front_rcu(&list, &elems[0].node);
+	list_node_insert_after_rcu(&elems[1].node, &elems[2].node);
+
+	int expected = 0;
+	rcu_read_lock();
+	for_each_list_element_rcu (&list, elem, node) {
+		assert(elem->val == expected, "RCU list out of order?");
+		expected++;
+	}
+	rcu_read_unlock();
+	assert(expected == 4, "RCU list iteration incomplete?");
+
+	// A reader positioned at a detached node must still reach the rest of
+	// the list.
+	list_detach_rcu(&elems[1].node);
+	assert(elems[1].node.next == &elems[2].node,
+	       "Detached node next pointer not preserved?");
+	assert(list_count(&list) == 3, "Node not detached?");
+
+	expected = 0;
+	rcu_read_lock();
+	for_each_list_element_rcu (&list, elem, node) {
+		assert(elem->val != 1, "Detached node still visible?");
+		expected++;
+	}
+	rcu_read_unlock();
+	assert(expected == 3, "RCU list iteration after detach incomplete?");
+
+	// The detached node may only be reused after a grace period.
+	num_invoked = 0;
+	call_rcu(&elems[1].rcu, count_invoked);
+	rcu_quiescent_state();
+	assert(num_invoked == 1, "Deferred free not invoked?");
+
+	return NULL;
+}
+
+const char *test_rcu(void)
+{
+	const char *res = test_rcu_callbacks();
+	if (res != NULL)
+		return res;
+
+	return test_rcu_list();
+}
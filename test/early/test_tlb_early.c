@@ -0,0 +1,161 @@
+#include "test_early.h"
+
+// The number of shootdowns to average over in the latency benchmark.
+#define BENCH_ITERATIONS (1000)
+
+static const char *test_batch(void)
+{
+	struct tlb_batch batch;
+	virtaddr_t va = {0x100000};
+
+	tlb_batch_init(&batch, &kernel_address_space);
+	tlb_batch_add(&batch, va, 2);
+	assert(batch.num_ranges == 1 && batch.num_pages == 2,
+	       "Range not added?");
+
+	// Adjacent ranges should be coalesced.
+	va.x = 0x102000;
+	tlb_batch_add(&batch, va, 2);
+	assert(batch.num_ranges == 1 && batch.num_pages == 4,
+	       "Adjacent range not coalesced?");
+	assert(batch.ranges[0].start == 0x100000 &&
+		       batch.ranges[0].end == 0x104000,
+	       "Coalesced range incorrect?");
+
+	// Overlapping ranges should be coalesced.
+	va.x = 0xff000;
+	tlb_batch_add(&batch, va, 3);
+	assert(batch.num_ranges == 1 && batch.num_pages == 5,
+	       "Overlapping range not coalesced?");
+
+	// A range which bridges two others should absorb both.
+	va.x = 0x200000;
+	tlb_batch_add(&batch, va, 1);
+	assert(batch.num_ranges == 2, "Disjoint range coalesced?");
+	va.x = 0x104000;
+	tlb_batch_add(&batch, va, 0xfc);
+	assert(batch.num_ranges == 1 && batch.num_pages == 0x102,
+	       "Bridging range not coalesced?");
+
+	// Overflowing ranges should fall back to flushing everything.
+	tlb_batch_init(&batch, &kernel_address_space);
+	for (int i = 0; i <= TLB_BATCH_MAX_RANGES; i++) {
+		va.x = 0x100000 + i * 2 * PAGE_SIZE;
+		tlb_batch_add(&batch, va, 1);
+	}
+	assert(batch.flush_all, "Range overflow did not flush all?");
+
+	return NULL;
+}
+
+// Measure shootdown latency, in TSC cycles, for a range of `num_pages` pages
+// in the kernel address space.
+static void bench_shootdown(uint64_t num_pages)
+{
+	uint64_t total = 0, max = 0;
+
+	for (int i = 0; i < BENCH_ITERATIONS; i++) {
+		struct tlb_batch batch;
+		virtaddr_t va = {KERNEL_ELF_ADDRESS};
+
+		tlb_batch_init(&batch, &kernel_address_space);
+		tlb_batch_add(&batch, va, num_pages);
+
+		uint64_t start = rdtsc();
+		tlb_shootdown(&batch);
+		uint64_t cycles = rdtsc() - start;
+
+		total += cycles;
+		if (cycles > max)
+			max = cycles;
+	}
+
+	early_printf(
+		"tlb: shootdown %lu pages, %u CPUs: avg %lu, max %lu cycles\n",
+		num_pages, cpumask_weight(&cpu_online_mask),
+		total / BENCH_ITERATIONS, max);
+}
+
+const char *test_tlb(void)
+{
+	tlb_init();
+
+	uint64_t cr3 = read_cr3();
+	assert((cr3 & ~X86_CR3_PCID_MASK) == kernel_root_pgd.x,
+	       "tlb_init() did not load kernel root PGD?");
+
+	if (!tlb_pcid_enabled()) {
+		assert((cr3 & X86_CR3_PCID_MASK) == 0, "PCID set when disabled?");
+		return NULL;
+	}
+
+	uint64_t kernel_pcid = cr3 & X86_CR3_PCID_MASK;
+	assert(kernel_pcid != 0, "Kernel address space assigned PCID 0?");
+
+	// Share the kernel PGD so the switch is safe, we only care that a
+	// distinct context gets a distinct PCID.
+	struct address_space as;
+	address_space_init(&as, kernel_root_pgd);
+	assert(as.ctx_id != kernel_address_space.ctx_id, "Context ID reused?");
+
+	tlb_switch(&as);
+	uint64_t pcid = read_cr3() & X86_CR3_PCID_MASK;
+	assert(pcid != 0 && pcid != kernel_pcid, "PCID not distinct?");
+
+	tlb_switch(&kernel_address_space);
+	assert((read_cr3() & X86_CR3_PCID_MASK) == kernel_pcid,
+	       "Kernel PCID not retained across switch?");
+
+	uint64_t gen = atomic_load_relaxed(&as.tlb_gen);
+	virtaddr_t va = {KERNEL_ELF_ADDRESS};
+	tlb_flush_range(&as, va, 1);
+	assert(atomic_load_relaxed(&as.tlb_gen) == gen + 1,
+	       "Flush did not bump generation?");
+
+	tlb_switch(&as);
+	assert((read_cr3() & X86_CR3_PCID_MASK) == pcid,
+	       "PCID not retained after flush?");
+
+	// Cycle through enough address spaces to evict everything.
+	struct address_space others[TLB_NUM_ASIDS];
+	for (int i = 0; i < TLB_NUM_ASIDS; i++) {
+		address_space_init(&others[i], kernel_root_pgd);
+		tlb_switch(&others[i]);
+	}
+
+	tlb_switch(&kernel_address_space);
+	pcid = read_cr3() & X86_CR3_PCID_MASK;
+	assert(pcid > 0 && pcid <= TLB_NUM_ASIDS, "PCID out of range?");
+
+	return NULL;
+}
+
+const char *test_tlb_shootdown(void)
+{
+	const char *res = test_batch();
+	if (res != NULL)
+		return res;
+
+	struct address_space *as = &kernel_address_space;
+	assert(cpumask_test(&as->active_cpus, cpu_id()),
+	       "Current CPU not active in kernel address space?");
+
+	struct tlb_batch batch;
+	virtaddr_t va = {KERNEL_ELF_ADDRESS};
+	uint64_t gen = atomic_load_relaxed(&as->tlb_gen);
+
+	tlb_batch_init(&batch, as);
+	tlb_batch_add(&batch, va, 1);
+	tlb_shootdown_start(&batch);
+	assert(batch.gen == gen + 1, "Shootdown did not bump generation?");
+	assert(!cpumask_test(&batch.pending, cpu_id()),
+	       "Initiating CPU waiting on itself?");
+	tlb_shootdown_wait(&batch);
+	assert(tlb_shootdown_done(&batch), "Shootdown not complete?");
+
+	bench_shootdown(1);
+	bench_shootdown(TLB_FLUSH_ALL_THRESHOLD);
+	bench_shootdown(TLB_FLUSH_ALL_THRESHOLD + 1);
+
+	return NULL;
+}
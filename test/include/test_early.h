@@ -21,12 +21,37 @@ const char *test_string(void);
 
 // test_misc_early.c
 const char *test_misc(void);
+const char *test_boot_trace(void);
 
 // test_mem_early.c
 const char *test_mem(void);
 
 // test_page_early.c
 const char *test_page(void);
+const char *test_page_unmap(void);
+const char *test_page_collapse(void);
+const char *test_page_fault(void);
+const char *test_page_cow(void);
+const char *test_page_snapshot(void);
+
+// test_access_monitor_early.c
+const char *test_access_monitor(void);
+
+// test_rcu_early.c
+const char *test_rcu(void);
 
 // test_phys_alloc_early.c
 const char *test_phys_alloc(void);
+
+// test_percpu_early.c
+const char *test_percpu(void);
+
+// test_log_early.c
+const char *test_log(void);
+
+// test_lockstat_early.c
+const char *test_lockstat(void);
+
+// test_tlb_early.c
+const char *test_tlb(void);
+const char *test_tlb_shootdown(void);
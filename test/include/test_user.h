@@ -25,10 +25,27 @@
 std::string test_range();
 
 // test_spinlock.cpp
+// The CPU each thread is treated as by spinlocks.
+extern thread_local uint32_t test_cpu_id;
 std::string test_spinlock();
+std::string bench_spinlock();
+
+// test_atomic.cpp
+std::string test_atomic();
+
+// test_seqlock.cpp
+std::string test_seqlock();
+
+// test_rwlock.cpp
+std::string test_rwlock();
+std::string bench_rwlock();
+
+// test_ring.cpp
+std::string test_ring();
 
 // test_misc.cpp
 std::string test_misc();
 
 // test_bitmap.cpp
 std::string test_bitmap();
+std::string bench_bitmap();
@@ -0,0 +1,188 @@
+#include "test_user.h"
+
+#include "atomic.h"
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NUM_THREADS (8)
+#define NUM_ITERS (100000)
+
+namespace {
+// Run `fn(thread_index)` on NUM_THREADS threads concurrently.
+template <typename F>
+void run_threads(F fn)
+{
+	std::vector<std::thread> threads;
+	for (int i = 0; i < NUM_THREADS; i++) {
+		threads.emplace_back(fn, i);
+	}
+	for (auto &t : threads) {
+		t.join();
+	}
+}
+
+std::string assert_single_threaded_correct()
+{
+	atomic_t val = {5};
+	atomic64_t val64 = {1UL << 40};
+
+	assert(atomic_exchange_relaxed(&val, 7) == 5, "exchange old value?");
+	assert(atomic_load_acquire(&val) == 7, "exchange not stored?");
+	assert(atomic_fetch_add_relaxed(&val, 3) == 7, "fetch_add old value?");
+	assert(atomic_fetch_sub_release(&val, 10) == 10, "fetch_sub old value?");
+	assert(atomic_load_relaxed(&val) == 0, "fetch_sub not applied?");
+	assert(atomic_fetch_or_seq_cst(&val, 0xf0) == 0, "fetch_or old value?");
+	assert(atomic_fetch_and_acquire(&val, 0x30) == 0xf0,
+	       "fetch_and old value?");
+	assert(atomic_load_seq_cst(&val) == 0x30, "fetch_and not applied?");
+
+	// 64-bit values must not be truncated.
+	assert(atomic_fetch_add_seq_cst(&val64, 1UL << 40) == 1UL << 40,
+	       "64-bit fetch_add old value?");
+	assert(atomic_load_relaxed(&val64) == 1UL << 41,
+	       "64-bit fetch_add truncated?");
+
+	atomic_store_relaxed(&val, 1);
+	assert(!atomic_inc_and_test_relaxed(&val), "inc_and_test(1) zero?");
+	assert(!atomic_dec_and_test_acq_rel(&val), "dec_and_test(2) zero?");
+	assert(atomic_dec_and_test_seq_cst(&val), "dec_and_test(1) not zero?");
+	atomic_store_release(&val, (uint32_t)-1);
+	assert(atomic_inc_and_test_acq_rel(&val), "inc_and_test(-1) not zero?");
+
+	// Compare and exchange.
+	uint32_t old = 1;
+	assert(!atomic_try_cmpxchg_acquire(&val, &old, 2),
+	       "try_cmpxchg succeeded on mismatch?");
+	assert(old == 0, "try_cmpxchg didn't update old value?");
+	assert(atomic_try_cmpxchg_release(&val, &old, 2),
+	       "try_cmpxchg failed on match?");
+	assert(atomic_load_relaxed(&val) == 2, "try_cmpxchg not stored?");
+	assert(atomic_cmpxchg_relaxed(&val, 3, 4) == 2,
+	       "cmpxchg mismatch didn't return current value?");
+	assert(atomic_cmpxchg_seq_cst(&val, 2, 4) == 2,
+	       "cmpxchg match didn't return old value?");
+	assert(atomic_load_relaxed(&val) == 4, "cmpxchg not stored?");
+	uint64_t old64 = 1UL << 41;
+	while (!atomic_try_cmpxchg_weak_relaxed(&val64, &old64, 1UL << 42))
+		;
+	assert(atomic_load_relaxed(&val64) == 1UL << 42,
+	       "64-bit weak try_cmpxchg not stored?");
+
+	// Bit operations.
+	atomic64_t bits = {0};
+	assert(!atomic_test_and_set_bit_acquire(&bits, 63),
+	       "Bit 63 initially set?");
+	assert(atomic_test_and_set_bit_relaxed(&bits, 63), "Bit 63 not set?");
+	assert(atomic_load_relaxed(&bits) == 1UL << 63,
+	       "Wrong bit set in 64-bit value?");
+	assert(atomic_test_and_clear_bit_release(&bits, 63),
+	       "Bit 63 not set on clear?");
+	assert(!atomic_test_and_clear_bit_seq_cst(&bits, 63),
+	       "Bit 63 still set after clear?");
+
+	return "";
+}
+
+std::string assert_concurrent_correct()
+{
+	// Concurrent additions must not be lost.
+	atomic64_t counter = {0};
+	run_threads([&](int) {
+		for (int i = 0; i < NUM_ITERS; i++) {
+			atomic_fetch_add_relaxed(&counter, 1);
+		}
+	});
+	assert(atomic_load_relaxed(&counter) == NUM_THREADS * NUM_ITERS,
+	       "Lost fetch_add updates?");
+
+	// Increment via compare-and-exchange loops.
+	atomic_t cas_counter = {0};
+	run_threads([&](int index) {
+		for (int i = 0; i < NUM_ITERS; i++) {
+			uint32_t old = atomic_load_relaxed(&cas_counter);
+			if (index % 2 == 0) {
+				while (!atomic_try_cmpxchg_weak_relaxed(
+					&cas_counter, &old, old + 1))
+					;
+			} else {
+				uint32_t prev;
+				while ((prev = atomic_cmpxchg_relaxed(
+						&cas_counter, old, old + 1)) !=
+				       old) {
+					old = prev;
+				}
+			}
+		}
+	});
+	assert(atomic_load_relaxed(&cas_counter) == NUM_THREADS * NUM_ITERS,
+	       "Lost cmpxchg updates?");
+
+	// Take and drop references, exactly one drop should reach zero.
+	atomic_t refcount = {1};
+	atomic_t num_zero = {0};
+	run_threads([&](int) {
+		for (int i = 0; i < NUM_ITERS; i++) {
+			atomic_fetch_add_relaxed(&refcount, 1);
+			if (atomic_dec_and_test_acq_rel(&refcount))
+				atomic_fetch_add_relaxed(&num_zero, 1);
+		}
+	});
+	assert(atomic_dec_and_test_acq_rel(&refcount),
+	       "Final reference drop not zero?");
+	assert(atomic_load_relaxed(&num_zero) == 0,
+	       "Refcount reached zero early?");
+
+	// Each thread races to claim every bit, each must be claimed once.
+	atomic64_t bits = {0};
+	atomic_t claims[64] = {};
+	run_threads([&](int) {
+		for (int bit = 0; bit < 64; bit++) {
+			if (!atomic_test_and_set_bit_acquire(&bits, bit))
+				atomic_fetch_add_relaxed(&claims[bit], 1);
+		}
+	});
+	for (int bit = 0; bit < 64; bit++) {
+		assert(atomic_load_relaxed(&claims[bit]) == 1,
+		       "Bit " << bit << " claimed "
+			      << atomic_load_relaxed(&claims[bit]) << " times");
+	}
+	assert(atomic_load_relaxed(&bits) == ~0UL, "Not all bits set?");
+
+	// Message passing - a release store must make prior writes visible to
+	// an acquire load which observes it.
+	for (int i = 0; i < 1000; i++) {
+		uint64_t data = 0;
+		atomic_t ready = {0};
+		bool seen = true;
+
+		std::thread producer([&]() {
+			data = i + 1;
+			smp_wmb();
+			atomic_store_release(&ready, 1);
+		});
+		std::thread consumer([&]() {
+			while (!atomic_load_acquire(&ready))
+				;
+			smp_rmb();
+			seen = data == (uint64_t)i + 1;
+		});
+		producer.join();
+		consumer.join();
+
+		assert(seen, "Release/acquire ordering violated?");
+	}
+
+	return "";
+}
+} // namespace
+
+std::string test_atomic()
+{
+	std::string res = assert_single_threaded_correct();
+	if (!res.empty())
+		return res;
+
+	return assert_concurrent_correct();
+}
@@ -3,6 +3,9 @@
 #include "bitmap.h"
 #undef static_assert // zeptux breaks static_assert in c++ :)
 
+#include <chrono>
+#include <iomanip>
+#include <iostream>
 #include <sstream>
 #include <string>
 
@@ -166,6 +169,21 @@ std::string test_bitmap()
 		bitmap_set(bitmap, i);
 	}
 
+	// Searches from an offset should ignore clear bits prior to it.
+	bitmap_set_all(bitmap);
+	bitmap_clear(bitmap, 3);
+	bitmap_clear(bitmap, 100);
+	assert(bitmap_find_next_clear(bitmap, 0) == 3,
+	       "bitmap_find_next_clear(0) != 3?");
+	assert(bitmap_find_next_clear(bitmap, 3) == 3,
+	       "bitmap_find_next_clear(3) != 3?");
+	assert(bitmap_find_next_clear(bitmap, 4) == 100,
+	       "bitmap_find_next_clear(4) != 100?");
+	assert(bitmap_find_next_clear(bitmap, 101) == -1,
+	       "bitmap_find_next_clear() returns out-of-range bit?");
+	assert(bitmap_find_next_clear(bitmap, 150) == -1,
+	       "bitmap_find_next_clear() past end != -1?");
+
 	bitmap_set_all(bitmap);
 	assert(bitmap_zero_string_longer_than(bitmap, 1) == -1,
 	       "Fully set bitmap reports non-exist zero bitstring?");
@@ -196,5 +214,149 @@ std::string test_bitmap()
 	assert(bitmap_zero_string_longer_than(bitmap, 4) == -1,
 	       "Overlapping into out of range zero bits?");
 
+	// Range operations should mask edge words correctly.
+	bitmap_clear_all(bitmap);
+	bitmap_set_range(bitmap, 3, 5);
+	assert(bitmap->data[0] == 0xf8 && bitmap_weight(bitmap) == 5,
+	       "Single word range not set correctly?");
+	bitmap_set_range(bitmap, 60, 90);
+	assert(bitmap->data[0] == (0xf8 | 0xf000000000000000UL) &&
+		       bitmap->data[1] == ~0UL && bitmap->data[2] == 0x3fffff,
+	       "Multi word range not set correctly?");
+	assert(bitmap_weight(bitmap) == 95, "bitmap_weight() != 95?");
+	bitmap_clear_range(bitmap, 4, 140);
+	assert(bitmap->data[0] == 0x8 && bitmap->data[1] == 0 &&
+		       bitmap->data[2] == 0x3f0000,
+	       "Multi word range not cleared correctly?");
+	assert(bitmap_weight(bitmap) == 7, "bitmap_weight() != 7?");
+	bitmap_clear_range(bitmap, 0, 0);
+	bitmap_set_range(bitmap, 0, 0);
+	assert(bitmap_weight(bitmap) == 7, "Empty range changed bitmap?");
+
+	// Next set bit searches and iteration.
+	assert(bitmap_find_next_set(bitmap, 0) == 3,
+	       "bitmap_find_next_set(0) != 3?");
+	assert(bitmap_find_next_set(bitmap, 4) == 144,
+	       "bitmap_find_next_set(4) != 144?");
+	assert(bitmap_find_next_set(bitmap, 150) == -1,
+	       "bitmap_find_next_set() past end != -1?");
+	assert(bitmap_find_next_clear(bitmap, 144) == -1,
+	       "bitmap_find_next_clear() returns out-of-range bit?");
+	int64_t expected[] = {3, 144, 145, 146, 147, 148, 149};
+	int count = 0;
+	for_each_set_bit(bitmap, bit) {
+		assert(count < 7 && bit == expected[count],
+		       "for_each_set_bit() returned unexpected bit " << bit);
+		count++;
+	}
+	assert(count == 7, "for_each_set_bit() iterated " << count << " bits?");
+
+	// Zero strings may span words.
+	bitmap_clear_all(bitmap);
+	assert(bitmap_zero_run(bitmap, 0, 150) == 0,
+	       "Empty bitmap zero run of 150 not at 0?");
+	assert(bitmap_zero_run(bitmap, 0, 151) == -1,
+	       "Zero run longer than bitmap found?");
+
+	bitmap_set(bitmap, 10);
+	bitmap_set(bitmap, 140);
+	assert(bitmap_zero_run(bitmap, 0, 10) == 0,
+	       "Zero run at start of bitmap not found?");
+	assert(bitmap_zero_run(bitmap, 0, 11) == 11,
+	       "Zero run of 11 not at 11?");
+	assert(bitmap_zero_run(bitmap, 0, 129) == 11,
+	       "Zero run of 129 spanning 3 words not at 11?");
+	assert(bitmap_zero_run(bitmap, 0, 130) == -1,
+	       "Zero run of 130 found?");
+	assert(bitmap_zero_run(bitmap, 12, 100) == 12,
+	       "Zero run from offset not at offset?");
+	assert(bitmap_zero_run(bitmap, 64, 64) == 64,
+	       "Zero run of whole word not found?");
+	assert(bitmap_zero_run(bitmap, 131, 9) == 131,
+	       "Zero run before set bit not found?");
+	assert(bitmap_zero_run(bitmap, 132, 9) == 141,
+	       "Zero run at end of bitmap not found?");
+	assert(bitmap_zero_run(bitmap, 132, 10) == -1,
+	       "Zero run overlapping out of range bits found?");
+
+	return "";
+}
+
+namespace {
+// Time `iters` invocations of `fn`, returning the mean time in nanoseconds.
+template <typename F>
+double time_ns(int iters, F fn)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iters; i++) {
+		fn();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	std::chrono::duration<double, std::nano> elapsed = end - start;
+	return elapsed.count() / iters;
+}
+} // namespace
+
+std::string bench_bitmap()
+{
+	constexpr uint64_t num_bits = 1 << 20;
+	constexpr int iters = 10;
+
+	uint8_t *buf = new uint8_t[bitmap_calc_size(num_bits)];
+	struct bitmap *bitmap = bitmap_init((struct bitmap *)buf, num_bits);
+
+	double per_bit_set_ns = time_ns(iters, [&]() {
+		for (uint64_t i = 0; i < num_bits; i++) {
+			bitmap_set(bitmap, i);
+		}
+	});
+	bitmap_clear_all(bitmap);
+	double range_set_ns = time_ns(
+		iters, [&]() { bitmap_set_range(bitmap, 1, num_bits - 2); });
+	assert(bitmap_weight(bitmap) == num_bits - 2,
+	       "Benchmark range not set?");
+
+	uint64_t weight = 0;
+	double per_bit_weight_ns = time_ns(iters, [&]() {
+		weight = 0;
+		for (uint64_t i = 0; i < num_bits; i++) {
+			weight += bitmap_is_set(bitmap, i);
+		}
+	});
+	double weight_ns =
+		time_ns(iters, [&]() { weight = bitmap_weight(bitmap); });
+	assert(weight == num_bits - 2, "Benchmark weight incorrect?");
+
+	// Iterate over a sparse bitmap with 1 in every 1,000 bits set.
+	bitmap_clear_all(bitmap);
+	for (uint64_t i = 0; i < num_bits; i += 1000) {
+		bitmap_set(bitmap, i);
+	}
+	uint64_t count = 0;
+	double per_bit_iter_ns = time_ns(iters, [&]() {
+		count = 0;
+		for (uint64_t i = 0; i < num_bits; i++) {
+			if (bitmap_is_set(bitmap, i))
+				count++;
+		}
+	});
+	double iter_ns = time_ns(iters, [&]() {
+		count = 0;
+		for_each_set_bit(bitmap, bit) {
+			count++;
+		}
+	});
+	assert(count == (num_bits + 999) / 1000, "Benchmark iteration count?");
+
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "// bitmap bench (" << num_bits << " bits, ns): set "
+		  << per_bit_set_ns << " per-bit vs " << range_set_ns
+		  << " range; weight " << per_bit_weight_ns << " per-bit vs "
+		  << weight_ns << " popcount; sparse iterate " << per_bit_iter_ns
+		  << " per-bit vs " << iter_ns << " for_each_set_bit"
+		  << std::endl;
+
+	delete[] buf;
 	return "";
 }
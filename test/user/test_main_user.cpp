@@ -2,15 +2,30 @@
 
 #include "test_user.h"
 
-int main()
+int main(int argc, char **argv)
 {
 	const auto check = [](std::string res) {
 		if (!res.empty())
 			std::cout << "FAIL: " << res << std::endl;
 	};
 
+	// Benchmarks are slow and their output noisy, so only run on request.
+	if (argc > 1 && std::string(argv[1]) == "--bench") {
+		check(bench_bitmap());
+		check(bench_spinlock());
+		check(bench_rwlock());
+
+		std::cout << "// zeptux USER  bench run complete" << std::endl;
+
+		return EXIT_SUCCESS;
+	}
+
 	check(test_range());
+	check(test_atomic());
 	check(test_spinlock());
+	check(test_seqlock());
+	check(test_rwlock());
+	check(test_ring());
 	check(test_misc());
 	check(test_bitmap());
 
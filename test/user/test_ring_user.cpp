@@ -0,0 +1,213 @@
+#include "test_user.h"
+
+#include "ring.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define CAPACITY (64)
+#define BATCH_SIZE (8)
+
+#define NUM_ITEMS_PER_PRODUCER (200000)
+
+namespace {
+// Encode producer `producer`'s `seq`th item as a ring object. Offset by 1 so no
+// object is NULL.
+void *encode(uint64_t producer, uint64_t seq)
+{
+	return (void *)(((producer << 32) | seq) + 1);
+}
+
+void decode(void *obj, uint64_t &producer, uint64_t &seq)
+{
+	uint64_t val = (uint64_t)obj - 1;
+
+	producer = val >> 32;
+	seq = val & 0xffffffff;
+}
+
+std::string test_basic()
+{
+	struct ring ring;
+	void *slots[CAPACITY];
+	ring_init(&ring, slots, CAPACITY);
+
+	assert(ring_empty(&ring), "New ring not empty?");
+	assert(!ring_full(&ring), "New ring full?");
+
+	void *obj;
+	assert(!ring_dequeue_sc(&ring, &obj), "Dequeued from empty ring?");
+	assert(!ring_dequeue_mc(&ring, &obj), "Dequeued from empty ring?");
+
+	// Fill, overflow, then drain in FIFO order.
+	for (uint64_t i = 0; i < CAPACITY; i++) {
+		assert(ring_enqueue_sp(&ring, encode(0, i)), "Enqueue failed?");
+	}
+	assert(ring_full(&ring), "Ring not full?");
+	assert(ring_count(&ring) == CAPACITY, "Incorrect count?");
+	assert(!ring_enqueue_sp(&ring, encode(0, 0)), "Enqueued to full ring?");
+	assert(!ring_enqueue_mp(&ring, encode(0, 0)), "Enqueued to full ring?");
+
+	for (uint64_t i = 0; i < CAPACITY; i++) {
+		assert(ring_dequeue_sc(&ring, &obj), "Dequeue failed?");
+		assert(obj == encode(0, i), "Dequeued out of order?");
+	}
+	assert(ring_empty(&ring), "Drained ring not empty?");
+
+	// Batches are truncated to available space and entries, and wrap.
+	void *objs[CAPACITY + BATCH_SIZE];
+	for (uint64_t i = 0; i < CAPACITY + BATCH_SIZE; i++) {
+		objs[i] = encode(0, i);
+	}
+	assert(ring_enqueue_batch_mp(&ring, objs, BATCH_SIZE) == BATCH_SIZE,
+	       "Batch enqueue short?");
+	assert(ring_enqueue_batch_sp(&ring, &objs[BATCH_SIZE], CAPACITY) ==
+		       CAPACITY - BATCH_SIZE,
+	       "Batch enqueue not truncated to free space?");
+	assert(ring_enqueue_batch_mp(&ring, objs, 1) == 0,
+	       "Batch enqueued to full ring?");
+
+	void *out[CAPACITY + BATCH_SIZE];
+	assert(ring_dequeue_batch_mc(&ring, out, BATCH_SIZE) == BATCH_SIZE,
+	       "Batch dequeue short?");
+	assert(ring_enqueue_batch_sp(&ring, &objs[CAPACITY], BATCH_SIZE) ==
+		       BATCH_SIZE,
+	       "Batch enqueue across wrap failed?");
+	assert(ring_dequeue_batch_sc(&ring, &out[BATCH_SIZE],
+				     CAPACITY + BATCH_SIZE) == CAPACITY,
+	       "Batch dequeue not truncated to entries?");
+	for (uint64_t i = 0; i < CAPACITY + BATCH_SIZE; i++) {
+		assert(out[i] == objs[i], "Batch dequeued out of order?");
+	}
+	assert(ring_empty(&ring), "Drained ring not empty?");
+
+	return "";
+}
+
+// Run `num_producers` producers against `num_consumers` consumers, using the
+// multi-threaded variant of each side if `mp` or `mc` are set, checking that
+// every item is dequeued exactly once and that each consumer sees each
+// producer's items in order.
+std::string stress(int num_producers, int num_consumers, bool mp, bool mc)
+{
+	struct ring ring;
+	std::vector<void *> slots(CAPACITY);
+	ring_init(&ring, slots.data(), CAPACITY);
+
+	uint64_t num_items = (uint64_t)num_producers * NUM_ITEMS_PER_PRODUCER;
+	std::vector<std::atomic<uint32_t>> seen(num_items);
+	std::atomic<uint64_t> num_dequeued = 0;
+	std::atomic<bool> out_of_order = false;
+	std::atomic<bool> corrupt = false;
+	std::atomic<int> num_producers_done = 0;
+
+	std::vector<std::thread> threads;
+	for (int p = 0; p < num_producers; p++) {
+		threads.emplace_back([&, p] {
+			void *objs[BATCH_SIZE];
+			uint64_t seq = 0;
+
+			while (seq < NUM_ITEMS_PER_PRODUCER) {
+				// Vary the batch size to exercise partial
+				// batches.
+				uint32_t n = 1 + seq % BATCH_SIZE;
+				if (n > NUM_ITEMS_PER_PRODUCER - seq)
+					n = NUM_ITEMS_PER_PRODUCER - seq;
+				for (uint32_t i = 0; i < n; i++) {
+					objs[i] = encode(p, seq + i);
+				}
+
+				uint32_t done =
+					mp ? ring_enqueue_batch_mp(&ring, objs,
+								   n)
+					   : ring_enqueue_batch_sp(&ring, objs,
+								   n);
+				seq += done;
+				if (done == 0)
+					std::this_thread::yield();
+			}
+
+			num_producers_done++;
+		});
+	}
+
+	for (int c = 0; c < num_consumers; c++) {
+		threads.emplace_back([&] {
+			void *objs[BATCH_SIZE];
+			std::vector<int64_t> last(num_producers, -1);
+
+			// Give up if items are lost rather than hang.
+			while (num_dequeued.load() < num_items &&
+			       (num_producers_done.load() < num_producers ||
+				!ring_empty(&ring))) {
+				uint32_t done =
+					mc ? ring_dequeue_batch_mc(&ring, objs,
+								   BATCH_SIZE)
+					   : ring_dequeue_batch_sc(&ring, objs,
+								   BATCH_SIZE);
+				if (done == 0) {
+					std::this_thread::yield();
+					continue;
+				}
+
+				for (uint32_t i = 0; i < done; i++) {
+					uint64_t producer, seq;
+					decode(objs[i], producer, seq);
+
+					if (producer >= (uint64_t)num_producers ||
+					    seq >= NUM_ITEMS_PER_PRODUCER) {
+						corrupt = true;
+						continue;
+					}
+					if ((int64_t)seq <= last[producer])
+						out_of_order = true;
+					last[producer] = seq;
+					seen[producer * NUM_ITEMS_PER_PRODUCER +
+					     seq]++;
+				}
+				num_dequeued += done;
+			}
+		});
+	}
+
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	assert(!corrupt, "Dequeued object never enqueued?");
+	assert(!out_of_order, "Producer's items dequeued out of order?");
+	assert(num_dequeued.load() == num_items, "Items lost?");
+	for (uint64_t i = 0; i < num_items; i++) {
+		assert(seen[i].load() == 1,
+		       "Item " << i << " dequeued " << seen[i].load()
+			       << " times?");
+	}
+	assert(ring_empty(&ring), "Ring not empty after stress?");
+
+	return "";
+}
+} // namespace
+
+std::string test_ring()
+{
+	std::string res = test_basic();
+	if (!res.empty())
+		return res;
+
+	res = stress(1, 1, false, false);
+	if (!res.empty())
+		return "SPSC: " + res;
+
+	res = stress(4, 1, true, false);
+	if (!res.empty())
+		return "MPSC: " + res;
+
+	res = stress(4, 4, true, true);
+	if (!res.empty())
+		return "MPMC: " + res;
+
+	return "";
+}
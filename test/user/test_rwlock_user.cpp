@@ -0,0 +1,240 @@
+#include "test_user.h"
+
+#include "rwlock.h"
+#include "spinlock.h"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NUM_READER_THREADS (16)
+#define NUM_WRITER_THREADS (4)
+
+#define DURATION_MS (200)
+#define BENCH_DURATION_MS (100)
+
+#define BUF_SIZE (1000)
+
+namespace {
+// Shared state protected by the reader-writer lock.
+struct {
+	char buf[BUF_SIZE] = {0};
+	rwlock_t lock = empty_rwlock();
+} shared;
+
+// Check that the buffer consists of a single repeated character.
+bool buf_consistent()
+{
+	char first = shared.buf[0];
+	for (int i = 1; i < BUF_SIZE; i++) {
+		if (shared.buf[i] != first)
+			return false;
+	}
+
+	return true;
+}
+
+// Have `num_readers` threads repeatedly acquire a lock for reading and one
+// thread acquire it for writing, each performing a short critical section, for
+// a fixed duration. Returns the total number of read-side acquisitions.
+template <typename RA, typename RR, typename WA, typename WR>
+uint64_t bench_read_mostly(int num_readers, RA read_acquire, RR read_release,
+			   WA write_acquire, WR write_release)
+{
+	std::atomic<bool> stop = false;
+	std::atomic<uint64_t> reads = 0;
+	uint64_t val = 0;
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_readers; i++) {
+		threads.emplace_back([&, i]() {
+			test_cpu_id = i;
+
+			uint64_t count = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				read_acquire();
+				// Simulate a lookup.
+				for (int j = 0; j < 100; j++) {
+					hint_spinwait();
+				}
+				read_release();
+				count++;
+			}
+			reads += count;
+		});
+	}
+	threads.emplace_back([&]() {
+		test_cpu_id = num_readers;
+
+		while (!stop.load(std::memory_order_relaxed)) {
+			write_acquire();
+			val++;
+			write_release();
+			std::this_thread::sleep_for(
+				std::chrono::microseconds(100));
+		}
+	});
+
+	std::this_thread::sleep_for(
+		std::chrono::milliseconds(BENCH_DURATION_MS));
+	stop = true;
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	return reads;
+}
+} // namespace
+
+std::string test_rwlock()
+{
+	rwlock_t lock = empty_rwlock();
+
+	// Basic single-threaded semantics.
+	assert(rwlock_try_read_acquire(&lock), "Can't read acquire empty lock?");
+	assert(rwlock_try_read_acquire(&lock), "Can't share read lock?");
+	assert(rwlock_num_readers(&lock) == 2, "Reader count incorrect?");
+	assert(!rwlock_try_write_acquire(&lock),
+	       "Write acquired while readers hold lock?");
+	rwlock_read_release(&lock);
+	rwlock_read_release(&lock);
+	assert(rwlock_num_readers(&lock) == 0, "Readers not released?");
+
+	assert(rwlock_try_write_acquire(&lock), "Can't write acquire?");
+	assert(rwlock_is_write_locked(&lock), "Not write locked?");
+	assert(!rwlock_try_read_acquire(&lock), "Read acquired with writer?");
+	assert(!rwlock_try_write_acquire(&lock), "Writer acquired twice?");
+	rwlock_write_release(&lock);
+	assert(atomic_load_relaxed(&lock.val) == 0, "Lock not released?");
+
+	// A waiting writer must block new readers.
+	assert(rwlock_try_read_acquire(&lock), "Can't read acquire?");
+	std::atomic<bool> written = false;
+	std::thread writer([&]() {
+		rwlock_write_acquire(&lock);
+		written = true;
+		rwlock_write_release(&lock);
+	});
+	while (rwlock_num_waiting_writers(&lock) == 0) {
+		std::this_thread::yield();
+	}
+	assert(!rwlock_try_read_acquire(&lock),
+	       "Reader acquired lock with writer waiting?");
+	assert(!written, "Writer acquired lock with reader?");
+	rwlock_read_release(&lock);
+	writer.join();
+	assert(written, "Writer did not acquire lock?");
+
+	// Readers must remain blocked until every waiting writer has had the
+	// lock, not just the first.
+	assert(rwlock_try_read_acquire(&lock), "Can't read acquire?");
+	std::atomic<int> num_written = 0;
+	std::atomic<bool> proceed = false;
+	auto wait_write = [&]() {
+		rwlock_write_acquire(&lock);
+		num_written++;
+		while (!proceed) {
+			std::this_thread::yield();
+		}
+		rwlock_write_release(&lock);
+	};
+	std::thread writer1(wait_write);
+	std::thread writer2(wait_write);
+	while (rwlock_num_waiting_writers(&lock) < 2) {
+		std::this_thread::yield();
+	}
+	rwlock_read_release(&lock);
+	while (num_written == 0) {
+		std::this_thread::yield();
+	}
+	assert(rwlock_num_waiting_writers(&lock) == 1,
+	       "Waiting writer not counted?");
+	proceed = true;
+	writer1.join();
+	writer2.join();
+	assert(num_written == 2, "Writers did not acquire lock?");
+	assert(atomic_load_relaxed(&lock.val) == 0, "Lock not released?");
+
+	// Stress the lock with concurrent readers and writers.
+	std::atomic<bool> stop = false;
+	std::atomic<uint64_t> faults = 0;
+	std::atomic<uint64_t> reads = 0;
+	std::atomic<uint64_t> writes = 0;
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < NUM_WRITER_THREADS; i++) {
+		threads.emplace_back([&, i]() {
+			char chr = 'a' + i;
+
+			while (!stop) {
+				rwlock_write_acquire(&shared.lock);
+				if (rwlock_num_readers(&shared.lock) != 0)
+					faults++;
+				for (int j = 0; j < BUF_SIZE; j++) {
+					shared.buf[j] = chr;
+				}
+				rwlock_write_release(&shared.lock);
+				writes++;
+			}
+		});
+	}
+	for (int i = 0; i < NUM_READER_THREADS; i++) {
+		threads.emplace_back([&]() {
+			while (!stop) {
+				rwlock_read_acquire(&shared.lock);
+				if (!buf_consistent())
+					faults++;
+				rwlock_read_release(&shared.lock);
+				reads++;
+			}
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(DURATION_MS));
+	stop = true;
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	assert(faults == 0, std::to_string(faults) + " faults!");
+	// Writer preference means writers must make progress despite being
+	// outnumbered by readers.
+	assert(writes > 0, "Writers starved?");
+	assert(reads > 0, "Readers starved?");
+	assert(atomic_load_relaxed(&shared.lock.val) == 0,
+	       "Lock not released?");
+
+	return "";
+}
+
+std::string bench_rwlock()
+{
+	std::cout << std::fixed << std::setprecision(0);
+
+	for (int num_readers = 2; num_readers <= 16; num_readers *= 2) {
+		rwlock_t rwlock = empty_rwlock();
+		uint64_t rw_reads = bench_read_mostly(
+			num_readers, [&]() { rwlock_read_acquire(&rwlock); },
+			[&]() { rwlock_read_release(&rwlock); },
+			[&]() { rwlock_write_acquire(&rwlock); },
+			[&]() { rwlock_write_release(&rwlock); });
+
+		spinlock_t spinlock = empty_spinlock();
+		uint64_t spin_reads = bench_read_mostly(
+			num_readers, [&]() { spinlock_acquire(&spinlock); },
+			[&]() { spinlock_release(&spinlock); },
+			[&]() { spinlock_acquire(&spinlock); },
+			[&]() { spinlock_release(&spinlock); });
+
+		std::cout << "// rwlock bench (" << num_readers
+			  << " readers, 1 writer, " << BENCH_DURATION_MS
+			  << "ms): rwlock " << rw_reads << " reads vs spinlock "
+			  << spin_reads << " reads" << std::endl;
+	}
+
+	return "";
+}
@@ -0,0 +1,117 @@
+#include "test_user.h"
+
+#include "seqlock.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define NUM_READER_THREADS (8)
+#define NUM_WRITER_THREADS (2)
+
+#define DURATION_MS (200)
+
+#define NUM_VALS (64)
+
+namespace {
+// Shared state protected by the sequence lock. Writers keep every value equal,
+// so a reader observing differing values has seen a torn write.
+struct {
+	uint64_t vals[NUM_VALS] = {0};
+	seqlock_t lock = empty_seqlock();
+} shared;
+
+void writer()
+{
+	write_seqlock(&shared.lock);
+
+	uint64_t next = shared.vals[0] + 1;
+	for (int i = 0; i < NUM_VALS; i++) {
+		shared.vals[i] = next;
+	}
+
+	write_sequnlock(&shared.lock);
+}
+
+// Read a snapshot of the shared state, returning true if it was consistent.
+bool reader(uint64_t &num_retries)
+{
+	uint64_t snapshot[NUM_VALS];
+	uint64_t seq;
+
+	do {
+		seq = read_seqbegin(&shared.lock);
+		for (int i = 0; i < NUM_VALS; i++) {
+			snapshot[i] = __atomic_load_n(&shared.vals[i],
+						      __ATOMIC_RELAXED);
+		}
+	} while (read_seqretry(&shared.lock, seq) && ++num_retries);
+
+	for (int i = 1; i < NUM_VALS; i++) {
+		if (snapshot[i] != snapshot[0])
+			return false;
+	}
+
+	return true;
+}
+} // namespace
+
+std::string test_seqlock()
+{
+	std::atomic<bool> stop = false;
+	std::atomic<uint64_t> writes = 0;
+	std::atomic<uint64_t> reads = 0;
+	std::atomic<uint64_t> retries = 0;
+	std::atomic<uint64_t> faults = 0;
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < NUM_WRITER_THREADS; i++) {
+		threads.emplace_back([&, i]() {
+			test_cpu_id = i;
+
+			while (!stop) {
+				writer();
+				writes++;
+			}
+		});
+	}
+
+	for (int i = 0; i < NUM_READER_THREADS; i++) {
+		threads.emplace_back([&]() {
+			uint64_t num_retries = 0;
+
+			while (!stop) {
+				if (!reader(num_retries))
+					faults++;
+				reads++;
+			}
+			retries += num_retries;
+		});
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(DURATION_MS));
+	stop = true;
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	assert(faults == 0, std::to_string(faults) + " torn reads!");
+	assert(reads > 0 && writes > 0, "No progress?");
+	assert(shared.vals[0] == writes, "Lost writes?");
+	assert((atomic_load_relaxed(&shared.lock.seqcount.sequence) & 1) == 0,
+	       "Sequence count left odd?");
+	assert(atomic_load_relaxed(&shared.lock.seqcount.sequence) == writes * 2,
+	       "Sequence count not incremented per write?");
+
+	// A sequence count with no writers should never require a retry.
+	seqcount_t seqcount = empty_seqcount();
+	uint64_t seq = read_seqcount_begin(&seqcount);
+	assert(!read_seqcount_retry(&seqcount, seq), "Spurious retry?");
+	write_seqcount_begin(&seqcount);
+	write_seqcount_end(&seqcount);
+	assert(read_seqcount_retry(&seqcount, seq), "Write not detected?");
+
+	return "";
+}
@@ -3,8 +3,11 @@
 #include "spinlock.h"
 #undef static_assert // zeptux breaks static_assert in c++ :)
 
+#include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <iomanip>
+#include <iostream>
 #include <mutex>
 #include <string>
 #include <thread>
@@ -17,6 +20,43 @@
 
 #define BUF_SIZE (1000)
 
+#define BENCH_DURATION_MS (100)
+
+// Each thread acts as a CPU as far as the spinlock is concerned.
+thread_local uint32_t test_cpu_id;
+struct spinlock_cpu_qnodes spinlock_qnodes[SPINLOCK_MAX_CPUS];
+
+// If set, waiters which have spun for long enough yield to other threads,
+// otherwise they keep spinning. Threads may be preempted while holding or
+// queued for the lock, so yielding lets them run.
+std::atomic<bool> test_spinlock_yield = true;
+
+uint32_t spinlock_cpu_id(void)
+{
+	return test_cpu_id;
+}
+
+void spinlock_yield(void)
+{
+	if (test_spinlock_yield.load(std::memory_order_relaxed))
+		std::this_thread::yield();
+	else
+		hint_spinwait();
+}
+
+void spinlock_qnode_wait(struct spinlock_qnode *node)
+{
+	IGNORE_PARAM(node);
+
+	spinlock_yield();
+}
+
+// Waiters never sleep in spinlock_qnode_wait() so there is nothing to wake.
+void spinlock_qnode_kick(struct spinlock_qnode *node)
+{
+	IGNORE_PARAM(node);
+}
+
 // Shared state protected by the spinlock.
 struct {
 	char buf[BUF_SIZE] = {0};
@@ -86,13 +126,86 @@ void writer()
 
 	spinlock_release(&shared.lock);
 }
+
+// The test-and-test-and-set spinlock we previously used, for comparison.
+struct ttas_lock {
+	std::atomic<uint32_t> locked = 0;
+
+	void acquire()
+	{
+		while (locked.exchange(1, std::memory_order_acquire)) {
+			while (locked.load(std::memory_order_relaxed)) {
+				hint_spinwait();
+			}
+		}
+	}
+
+	void release()
+	{
+		locked.store(0, std::memory_order_release);
+	}
+};
+
+// Represents the outcome of a lock benchmark run.
+struct bench_result {
+	uint64_t total;
+	// The fewest and most acquisitions made by any one thread.
+	uint64_t min, max;
+};
+
+// Have `num_threads` threads repeatedly acquire a lock and increment a shared
+// counter for a fixed duration. The lock is taken via `acquire` and `release`.
+template <typename A, typename R>
+bench_result bench_lock(int num_threads, A acquire, R release)
+{
+	std::atomic<bool> stop = false;
+	// Protected by the lock under test.
+	uint64_t counter = 0;
+	std::vector<uint64_t> counts(num_threads);
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < num_threads; i++) {
+		threads.emplace_back([&, i]() {
+			test_cpu_id = i;
+
+			uint64_t count = 0;
+			while (!stop.load(std::memory_order_relaxed)) {
+				acquire();
+				counter++;
+				release();
+				count++;
+			}
+			counts[i] = count;
+		});
+	}
+
+	std::this_thread::sleep_for(
+		std::chrono::milliseconds(BENCH_DURATION_MS));
+	stop = true;
+	for (auto &t : threads) {
+		t.join();
+	}
+
+	bench_result res = {0, counts[0], counts[0]};
+	for (uint64_t count : counts) {
+		res.total += count;
+		res.min = std::min(res.min, count);
+		res.max = std::max(res.max, count);
+	}
+	// The counter will only match if the lock provided mutual exclusion.
+	if (counter != res.total)
+		res.total = 0;
+
+	return res;
+}
 } // namespace
 
 std::string test_spinlock()
 {
 	std::vector<std::thread> writer_threads;
 	for (int i = 0; i < NUM_WRITER_THREADS; i++) {
-		writer_threads.emplace_back([&]() {
+		writer_threads.emplace_back([&, i]() {
+			test_cpu_id = i;
 			while (true) {
 				if (should_stop())
 					break;
@@ -104,7 +217,8 @@ std::string test_spinlock()
 
 	std::vector<std::thread> reader_threads;
 	for (int i = 0; i < NUM_READER_THREADS; i++) {
-		reader_threads.emplace_back([&]() {
+		reader_threads.emplace_back([&, i]() {
+			test_cpu_id = NUM_WRITER_THREADS + i;
 			while (true) {
 				if (should_stop())
 					break;
@@ -130,3 +244,45 @@ std::string test_spinlock()
 
 	return "";
 }
+
+std::string bench_spinlock()
+{
+	std::cout << std::fixed << std::setprecision(2);
+
+	for (int num_threads = 2; num_threads <= 64; num_threads *= 2) {
+		spinlock_t lock = empty_spinlock();
+		bench_result queued = bench_lock(
+			num_threads, [&]() { spinlock_acquire(&lock); },
+			[&]() { spinlock_release(&lock); });
+		assert(queued.total > 0, "Queued spinlock lost updates");
+
+		// Waiters spin indefinitely as they did prior to the
+		// introduction of spinlock_qnode_wait().
+		test_spinlock_yield = false;
+		bench_result spin = bench_lock(
+			num_threads, [&]() { spinlock_acquire(&lock); },
+			[&]() { spinlock_release(&lock); });
+		test_spinlock_yield = true;
+		assert(spin.total > 0, "Spinning queued spinlock lost updates");
+
+		ttas_lock ttas;
+		bench_result simple = bench_lock(
+			num_threads, [&]() { ttas.acquire(); },
+			[&]() { ttas.release(); });
+		assert(simple.total > 0, "TTAS spinlock lost updates");
+
+		// Fairness is expressed as the ratio of the fewest acquisitions
+		// made by a thread to the most, 1 being perfectly fair.
+		std::cout << "// spinlock bench (" << num_threads
+			  << " threads, " << BENCH_DURATION_MS
+			  << "ms): queued " << queued.total << " acquisitions, "
+			  << (double)queued.min / queued.max
+			  << " fairness; spin only " << spin.total
+			  << " acquisitions, " << (double)spin.min / spin.max
+			  << " fairness; ttas " << simple.total
+			  << " acquisitions, " << (double)simple.min / simple.max
+			  << " fairness" << std::endl;
+	}
+
+	return "";
+}